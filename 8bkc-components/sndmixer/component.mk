@@ -6,3 +6,5 @@ COMPONENT_ADD_INCLUDEDIRS := .
 COMPONENT_PRIV_INCLUDEDIRS := ibxm
 
 COMPONENT_SRCDIRS := . ibxm
+#xm2wav is a host tool (see ibxm/Makefile), not part of the component
+COMPONENT_OBJEXCLUDE := ibxm/xm2wav.o
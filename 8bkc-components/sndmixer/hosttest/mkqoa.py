@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+#
+# Makes the QOA files qoa_test decodes, and the golden checksums it checks them against.
+#
+# The files are encoded here from generated test signals. They are then decoded by the reference decoder below,
+# which follows the QOA specification (https://qoaformat.org) and shares no code with snd_source_qoa.c: it
+# computes the dequantization table from the scalefactor formula and decodes to 16-bit samples per channel. Those
+# are mixed down to signed 8-bit mono the way the sndmixer source hands them on, and the golden checksum is the
+# CRC32 of that.
+#
+# Usage: mkqoa.py [golden.txt]
+# Writes the .qoa files to the current directory, and their checksums to golden.txt (default qoa_golden.txt).
+
+import math
+import struct
+import sys
+import zlib
+
+SLICE_LEN = 20
+SLICES_PER_FRAME = 256
+FRAME_LEN = SLICE_LEN * SLICES_PER_FRAME
+
+DEQUANT_BASE = [0.75, -0.75, 2.5, -2.5, 4.5, -4.5, 7.0, -7.0]
+
+
+def round_away(x):
+    return int(math.floor(abs(x) + 0.5)) * (1 if x >= 0 else -1)
+
+
+SCALEFACTOR = [round_away((s + 1) ** 2.75) for s in range(16)]
+DEQUANT = [[round_away(sf * b) for b in DEQUANT_BASE] for sf in SCALEFACTOR]
+
+
+def clamp16(v):
+    return max(-32768, min(32767, v))
+
+
+class Lms:
+    def __init__(self):
+        self.history = [0, 0, 0, 0]
+        self.weights = [0, 0, -(1 << 13), 1 << 14]
+
+    def copy(self):
+        c = Lms()
+        c.history = list(self.history)
+        c.weights = list(self.weights)
+        return c
+
+    def predict(self):
+        return sum(w * h for w, h in zip(self.weights, self.history)) >> 13
+
+    def update(self, sample, residual):
+        delta = residual >> 4
+        self.weights = [w + (-delta if h < 0 else delta) for w, h in zip(self.weights, self.history)]
+        self.history = self.history[1:] + [sample]
+
+
+def pack16(vals):
+    v = 0
+    for x in vals:
+        v = (v << 16) | (x & 0xffff)
+    return struct.pack(">Q", v)
+
+
+def encode_slice(lms, samples):
+    # Try every scalefactor, keep the one with the smallest error.
+    best = None
+    for sf in range(16):
+        l = lms.copy()
+        err = 0
+        slice = sf
+        for s in samples:
+            pred = l.predict()
+            residual = s - pred
+            q = min(range(8), key=lambda i: abs(DEQUANT[sf][i] - residual))
+            dq = DEQUANT[sf][q]
+            recon = clamp16(pred + dq)
+            err += (s - recon) ** 2
+            l.update(recon, dq)
+            slice = (slice << 3) | q
+        slice <<= 3 * (SLICE_LEN - len(samples))
+        if best is None or err < best[0]:
+            best = (err, slice, l)
+    lms.history, lms.weights = best[2].history, best[2].weights
+    return struct.pack(">Q", best[1])
+
+
+def encode(channels, rate):
+    n = len(channels[0])
+    lms = [Lms() for _ in channels]
+    out = b"qoaf" + struct.pack(">I", n)
+    for start in range(0, n, FRAME_LEN):
+        fsamples = min(FRAME_LEN, n - start)
+        slices = (fsamples + SLICE_LEN - 1) // SLICE_LEN
+        fsize = 8 + 16 * len(channels) + 8 * slices * len(channels)
+        out += struct.pack(">BBHHH", len(channels), rate >> 16, rate & 0xffff, fsamples, fsize)
+        for l in lms:
+            assert all(-32768 <= w <= 32767 for w in l.weights)
+            out += pack16(l.history) + pack16(l.weights)
+        for s in range(start, start + fsamples, SLICE_LEN):
+            for c, l in zip(channels, lms):
+                out += encode_slice(l, c[s:min(s + SLICE_LEN, start + fsamples)])
+    return out
+
+
+def decode(data):
+    """Reference decoder. Returns the sample rate and a list of samples per channel."""
+    assert data[:4] == b"qoaf"
+    total = struct.unpack(">I", data[4:8])[0]
+    pos = 8
+    rate = 0
+    out = None
+    while pos < len(data):
+        nch, rate_hi, rate_lo, fsamples, fsize = struct.unpack(">BBHHH", data[pos:pos + 8])
+        rate = (rate_hi << 16) | rate_lo
+        if out is None:
+            out = [[] for _ in range(nch)]
+        p = pos + 8
+        lms = []
+        for c in range(nch):
+            l = Lms()
+            h, w = struct.unpack(">QQ", data[p:p + 16])
+            l.history = [((h >> (48 - 16 * i)) & 0xffff) for i in range(4)]
+            l.weights = [((w >> (48 - 16 * i)) & 0xffff) for i in range(4)]
+            l.history = [x - 65536 if x >= 32768 else x for x in l.history]
+            l.weights = [x - 65536 if x >= 32768 else x for x in l.weights]
+            lms.append(l)
+            p += 16
+        for s in range(0, fsamples, SLICE_LEN):
+            for c in range(nch):
+                slice = struct.unpack(">Q", data[p:p + 8])[0]
+                p += 8
+                sf = slice >> 60
+                for i in range(min(SLICE_LEN, fsamples - s)):
+                    q = (slice >> (57 - 3 * i)) & 7
+                    pred = lms[c].predict()
+                    dq = DEQUANT[sf][q]
+                    recon = clamp16(pred + dq)
+                    lms[c].update(recon, dq)
+                    out[c].append(recon)
+        assert p == pos + fsize
+        pos += fsize
+    assert len(out[0]) == total
+    return rate, out
+
+
+def mixdown8(channels):
+    """Mixes down to signed 8-bit mono like snd_source_qoa: average, rounded towards zero, then >>8."""
+    out = bytearray()
+    for frame in zip(*channels):
+        acc = sum(frame)
+        avg = abs(acc) // len(frame) * (1 if acc >= 0 else -1)
+        out.append((avg >> 8) & 0xff)
+    return bytes(out)
+
+
+class Rng:
+    def __init__(self, seed):
+        self.state = seed
+
+    def next(self, max):
+        self.state = (self.state * 1103515245 + 12345) & 0x7fffffff
+        return (self.state >> 8) % max
+
+
+def sweep(n, rate, f0, f1, ampl):
+    out = []
+    phase = 0.0
+    for i in range(n):
+        f = f0 + (f1 - f0) * i / n
+        phase += 2 * math.pi * f / rate
+        out.append(int(ampl * math.sin(phase)))
+    return out
+
+
+def test_files():
+    rate = 22050
+    rng = Rng(1234)
+    # Not a multiple of the slice length, so the last slice is partial, and more than a frame long.
+    n = 7993
+    left = sweep(n, rate, 100, 4000, 20000)
+    # Chord plus noise, with a loud, clipping burst in the middle
+    right = []
+    for i in range(n):
+        v = 9000 * math.sin(2 * math.pi * 440 * i / rate) + 7000 * math.sin(2 * math.pi * 660 * i / rate)
+        v += rng.next(6000) - 3000
+        if 3000 <= i < 3400:
+            v *= 3
+        right.append(clamp16(int(v)))
+    mono = [clamp16(int(12000 * math.sin(2 * math.pi * 220 * i / 11025)) + rng.next(2000) - 1000) for i in range(3000)]
+    return [("stereo.qoa", [left, right], rate), ("mono.qoa", [mono], 11025)]
+
+
+def main():
+    golden = sys.argv[1] if len(sys.argv) > 1 else "qoa_golden.txt"
+    lines = []
+    for name, channels, rate in test_files():
+        data = encode(channels, rate)
+        with open(name, "wb") as f:
+            f.write(data)
+        drate, decoded = decode(data)
+        assert drate == rate
+        # Sanity check of the encoder: the decoded signal should be close to the original.
+        sig = sum(s * s for c in channels for s in c)
+        noise = sum((a - b) ** 2 for c, d in zip(channels, decoded) for a, b in zip(c, d))
+        print("%s: %d bytes, SNR %.1f dB" % (name, len(data), 10 * math.log10(sig / max(noise, 1))))
+        lines.append("%08x %s\n" % (zlib.crc32(mixdown8(decoded)), name))
+    with open(golden, "w") as f:
+        f.writelines(lines)
+
+
+if __name__ == "__main__":
+    main()
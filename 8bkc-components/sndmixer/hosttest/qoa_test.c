@@ -0,0 +1,111 @@
+/*
+Host test for the QOA sndmixer source. Decodes QOA files through sndmixer_source_qoa, the way the mixer does, and
+checks the CRC32 of the output against the checksums in a golden file. The test files and the golden checksums
+are made by mkqoa.py, which decodes the files using a reference decoder of its own.
+
+Usage: qoa_test -g golden.txt file.qoa...
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libgen.h>
+#include "snd_source_qoa.h"
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, int len) {
+	crc=~crc;
+	for (int i=0; i<len; i++) {
+		crc^=buf[i];
+		for (int b=0; b<8; b++) crc=(crc>>1)^(0xEDB88320&-(crc&1));
+	}
+	return ~crc;
+}
+
+static uint8_t *read_file(const char *name, long *len) {
+	FILE *f=fopen(name, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*len=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data=malloc(*len);
+	if (data && fread(data, 1, *len, f)!=*len) {
+		free(data);
+		data=NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+//Looks up the golden checksum for a file name. Returns 0 if not found.
+static int golden_lookup(const char *golden_file, const char *name, uint32_t *crc) {
+	FILE *f=fopen(golden_file, "r");
+	if (!f) return 0;
+	char line[256], gname[200];
+	unsigned int gcrc;
+	int found=0;
+	while (!found && fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%x %199s", &gcrc, gname)==2 && strcmp(gname, name)==0) {
+			*crc=gcrc;
+			found=1;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+//Decodes a file and checks it against the golden file. Returns 0 if it doesn't match.
+static int check_file(char *file_name, const char *golden_file) {
+	char *name=basename(file_name);
+	long len;
+	uint8_t *data=read_file(file_name, &len);
+	if (!data) {
+		printf("%-12s can't read\n", name);
+		return 0;
+	}
+	const sndmixer_source_t *src=&sndmixer_source_qoa;
+	void *ctx;
+	int chunk=src->init_source(data, data+len, 22050, &ctx);
+	if (chunk<=0) {
+		printf("%-12s init_source failed\n", name);
+		free(data);
+		return 0;
+	}
+	int8_t *buf=malloc(chunk);
+	uint32_t crc=0;
+	long samples=0;
+	int n;
+	while ((n=src->fill_buffer(ctx, buf))>0) {
+		crc=crc32_update(crc, (uint8_t*)buf, n);
+		samples+=n;
+	}
+	int rate=src->get_sample_rate(ctx);
+	src->deinit_source(ctx);
+	free(buf);
+	free(data);
+
+	int ok=1;
+	uint32_t gcrc;
+	printf("%-12s %6ld samples at %5d Hz, %08x", name, samples, rate, crc);
+	if (!golden_lookup(golden_file, name, &gcrc)) {
+		printf("  NO GOLDEN\n");
+		ok=0;
+	} else if (gcrc!=crc) {
+		printf("  MISMATCH (golden %08x)\n", gcrc);
+		ok=0;
+	} else {
+		printf("  OK\n");
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if (argc<4 || strcmp(argv[1], "-g")!=0) {
+		fprintf(stderr, "Usage: %s -g golden.txt file.qoa...\n", argv[0]);
+		return 1;
+	}
+	int ok=1;
+	for (int i=3; i<argc; i++) {
+		if (!check_file(argv[i], argv[2])) ok=0;
+	}
+	return ok?0:1;
+}
@@ -5,7 +5,7 @@
 
 #include "ibxm.h"
 
-#if 1
+#if !IBXM_TRACE_ALLOCS
 #define DO_CALLOC calloc
 #else
 #define DO_CALLOC(n, s) my_calloc(n, s, __FUNCTION__, __LINE__)
@@ -19,6 +19,9 @@ void *my_calloc(size_t nmemb, size_t size, const char *function, int line) {
 }
 #endif
 
+/* Allocate memory belonging to a module, keeping count for module_get_memory_usage(). */
+#define MODULE_CALLOC( module, n, s ) ( ( module )->mem_usage += ( n ) * ( s ), DO_CALLOC( n, s ) )
+
 #if IBXM_MONO
 #define BYTES_PER_SAMPLE 2
 #else
@@ -87,6 +90,21 @@ struct replay {
 	struct module *module;
 };
 
+/* Snapshot of the replay state at the start of a sequence position. */
+struct seek_point {
+	int sample_pos, global_vol;
+	int seq_pos, break_pos, row, next_row, tick;
+	int speed, tempo, pl_count, pl_chan;
+	struct channel *channels;
+};
+
+struct seek_index {
+	struct module *module;
+	int sample_rate, num_channels, num_points;
+	struct seek_point *points;
+	struct channel *channels;
+};
+
 static int exp_2( int x ) {
 	int c, m, y;
 	int x0 = ( x & FP_MASK ) >> ( FP_SHIFT - 7 );
@@ -378,6 +396,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 	struct sample *sample;
 	struct module *module = DO_CALLOC( 1, sizeof( struct module ) );
 	if( module ) {
+		module->mem_usage = sizeof( struct module );
 		if( data_u16le( data, 58 ) != 0x0104 ) {
 			strcpy( message, "XM format version must be 0x0104!" );
 			dispose_module( module );
@@ -400,7 +419,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 		module->default_tempo = data_u16le( data, 78 );
 		module->c2_rate = 8363;
 		module->gain = 64;
-		module->default_panning = DO_CALLOC( module->num_channels, sizeof( unsigned char ) );
+		module->default_panning = MODULE_CALLOC( module, module->num_channels, sizeof( unsigned char ) );
 		module->pattern_cache_handler=module_cache_handler_xm;
 		module->pattern_cache_idx=-1;
 		if( !module->default_panning ) {
@@ -410,7 +429,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 		for( idx = 0; idx < module->num_channels; idx++ ) {
 			module->default_panning[ idx ] = 128;
 		}
-		module->sequence = DO_CALLOC( module->sequence_len, sizeof( unsigned char ) );
+		module->sequence = MODULE_CALLOC( module, module->sequence_len, sizeof( unsigned char ) );
 		if( !module->sequence ) {
 			dispose_module( module );
 			return NULL;
@@ -419,7 +438,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 			entry = data_u8( data, 80 + idx );
 			module->sequence[ idx ] = entry < module->num_patterns ? entry : 0;
 		}
-		module->patterns = DO_CALLOC( module->num_patterns, sizeof( struct pattern ) );
+		module->patterns = MODULE_CALLOC( module, module->num_patterns, sizeof( struct pattern ) );
 		if( !module->patterns ) {
 			dispose_module( module );
 			return NULL;
@@ -446,14 +465,14 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 			module->patterns[ idx ].data_idx = offset;
 			offset = next_offset;
 		}
-		module->pattern_cache.data = DO_CALLOC(module->num_channels * max_rows, 5);
-		module->instruments = DO_CALLOC( module->num_instruments + 1, sizeof( struct instrument ) );
+		module->pattern_cache.data = MODULE_CALLOC( module, module->num_channels * max_rows, 5);
+		module->instruments = MODULE_CALLOC( module, module->num_instruments + 1, sizeof( struct instrument ) );
 		if( !module->instruments ) {
 			dispose_module( module );
 			return NULL;
 		}
 		instrument = &module->instruments[ 0 ];
-		instrument->samples = DO_CALLOC( 1, sizeof( struct sample ) );
+		instrument->samples = MODULE_CALLOC( module, 1, sizeof( struct sample ) );
 		if( !instrument->samples ) {
 			dispose_module( module );
 			return NULL;
@@ -465,7 +484,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 #endif
 			num_samples = data_u16le( data, offset + 27 );
 			instrument->num_samples = ( num_samples > 0 ) ? num_samples : 1;
-			instrument->samples = DO_CALLOC( instrument->num_samples, sizeof( struct sample ) );
+			instrument->samples = MODULE_CALLOC( module, instrument->num_samples, sizeof( struct sample ) );
 			if( !instrument->samples ) {
 				dispose_module( module );
 				return NULL;
@@ -541,7 +560,7 @@ static struct module* module_load_xm( struct data *data, char *message ) {
 					sam_loop_start = sam_data_samples;
 					sam_loop_length = 0;
 				}
-				sample->dcache=DO_CALLOC(module->num_channels+1, sizeof(struct delta_cache));
+				sample->dcache=MODULE_CALLOC( module, module->num_channels+1, sizeof(struct delta_cache));
 				if (!sample->dcache) {
 					dispose_module( module );
 					return NULL;
@@ -637,6 +656,7 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 	struct sample *sample;
 	struct module *module = DO_CALLOC( 1, sizeof( struct module ) );
 	if( module ) {
+		module->mem_usage = sizeof( struct module );
 		memcpy(&module->data, data, sizeof(struct data));
 #if IBXM_SAVE_ASCII_INFO
 		data_ascii( data, 0, 28, module->name );
@@ -668,7 +688,7 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 				channel_map[ idx ] = module->num_channels++;
 			}
 		}
-		module->sequence = DO_CALLOC( module->sequence_len, sizeof( unsigned char ) );
+		module->sequence = MODULE_CALLOC( module, module->sequence_len, sizeof( unsigned char ) );
 		if( !module->sequence ){
 			dispose_module( module );
 			return NULL;
@@ -677,14 +697,14 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 			module->sequence[ idx ] = data_u8( data, 96 + idx );
 		}
 		module_data_idx = 96 + module->sequence_len;
-		module->instruments = DO_CALLOC( module->num_instruments + 1, sizeof( struct instrument ) );
+		module->instruments = MODULE_CALLOC( module, module->num_instruments + 1, sizeof( struct instrument ) );
 		if( !module->instruments ) {
 			dispose_module( module );
 			return NULL;
 		}
 		instrument = &module->instruments[ 0 ];
 		instrument->num_samples = 1;
-		instrument->samples = DO_CALLOC( 1, sizeof( struct sample ) );
+		instrument->samples = MODULE_CALLOC( module, 1, sizeof( struct sample ) );
 		if( !instrument->samples ) {
 			dispose_module( module );
 			return NULL;
@@ -692,7 +712,7 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 		for( ins = 1; ins <= module->num_instruments; ins++ ) {
 			instrument = &module->instruments[ ins ];
 			instrument->num_samples = 1;
-			instrument->samples = DO_CALLOC( 1, sizeof( struct sample ) );
+			instrument->samples = MODULE_CALLOC( module, 1, sizeof( struct sample ) );
 			if( !instrument->samples ) {
 				dispose_module( module );
 				return NULL;
@@ -739,8 +759,8 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 				}
 			}
 		}
-		module->patterns = DO_CALLOC( module->num_patterns, sizeof( struct pattern ) );
-		module->pattern_cache.data = DO_CALLOC(module->num_channels * 64, 5);
+		module->patterns = MODULE_CALLOC( module, module->num_patterns, sizeof( struct pattern ) );
+		module->pattern_cache.data = MODULE_CALLOC( module, module->num_channels * 64, 5);
 		if( !module->patterns || !module->pattern_cache.data) {
 			dispose_module( module );
 			return NULL;
@@ -751,7 +771,7 @@ static struct module* module_load_s3m( struct data *data, char *message ) {
 			module->patterns[ idx ].data_idx = ( data_u16le( data, module_data_idx ) << 4 ) + 2;
 			module_data_idx += 2;
 		}
-		module->default_panning = DO_CALLOC( module->num_channels, sizeof( unsigned char ) );
+		module->default_panning = MODULE_CALLOC( module, module->num_channels, sizeof( unsigned char ) );
 		if( module->default_panning ) {
 			for( chan = 0; chan < 32; chan++ ) {
 				if( channel_map[ chan ] >= 0 ) {
@@ -824,6 +844,7 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 	struct sample *sample;
 	struct module *module = DO_CALLOC( 1, sizeof( struct module ) );
 	if( module ) {
+		module->mem_usage = sizeof( struct module );
 		memcpy(&module->data, data, sizeof(struct data));
 #if IBXM_SAVE_ASCII_INFO
 		data_ascii( data, 0, 20, module->name );
@@ -835,7 +856,7 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 		if( module->restart_pos >= module->sequence_len ) {
 			module->restart_pos = 0;
 		}
-		module->sequence = DO_CALLOC( 128, sizeof( unsigned char ) );
+		module->sequence = MODULE_CALLOC( module, 128, sizeof( unsigned char ) );
 		if( !module->sequence ){
 			dispose_module( module );
 			return NULL;
@@ -874,7 +895,7 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 		module->default_gvol = 64;
 		module->default_speed = 6;
 		module->default_tempo = 125;
-		module->default_panning = DO_CALLOC( module->num_channels, sizeof( unsigned char ) );
+		module->default_panning = MODULE_CALLOC( module, module->num_channels, sizeof( unsigned char ) );
 		if( !module->default_panning ) {
 			dispose_module( module );
 			return NULL;
@@ -886,9 +907,9 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 			}
 		}
 		module_data_idx = 1084;
-		module->patterns = DO_CALLOC( module->num_patterns, sizeof( struct pattern ) );
+		module->patterns = MODULE_CALLOC( module, module->num_patterns, sizeof( struct pattern ) );
 		pat_data_len = module->num_channels * 64 * 5;
-		module->pattern_cache.data = DO_CALLOC( 1, pat_data_len );
+		module->pattern_cache.data = MODULE_CALLOC( module, 1, pat_data_len );
 		if( !module->patterns || !module->pattern_cache.data ) {
 			dispose_module( module );
 			return NULL;
@@ -900,14 +921,14 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 			module_data_idx += module->num_channels * 64 * 4;
 		}
 		module->num_instruments = 31;
-		module->instruments = DO_CALLOC( module->num_instruments + 1, sizeof( struct instrument ) );
+		module->instruments = MODULE_CALLOC( module, module->num_instruments + 1, sizeof( struct instrument ) );
 		if( !module->instruments ) {
 			dispose_module( module );
 			return NULL;
 		}
 		instrument = &module->instruments[ 0 ];
 		instrument->num_samples = 1;
-		instrument->samples = DO_CALLOC( 1, sizeof( struct sample ) );
+		instrument->samples = MODULE_CALLOC( module, 1, sizeof( struct sample ) );
 		if( !instrument->samples ) {
 			dispose_module( module );
 			return NULL;
@@ -915,7 +936,7 @@ static struct module* module_load_mod( struct data *data, char *message ) {
 		for( ins = 1; ins <= module->num_instruments; ins++ ) {
 			instrument = &module->instruments[ ins ];
 			instrument->num_samples = 1;
-			instrument->samples = DO_CALLOC( 1, sizeof( struct sample ) );
+			instrument->samples = MODULE_CALLOC( module, 1, sizeof( struct sample ) );
 			if( !instrument->samples ) {
 				dispose_module( module );
 				return NULL;
@@ -970,6 +991,131 @@ struct module* module_load( struct data *data, char *message ) {
 	return module;
 }
 
+static int xm_pattern_rows( struct data *data, int pattern ) {
+	int pat, rows = 0, offset = 60 + data_u32le( data, 60 );
+	for( pat = 0; pat <= pattern; pat++ ) {
+		rows = data_u16le( data, offset + 5 );
+		offset += data_u32le( data, offset ) + data_u16le( data, offset + 7 );
+	}
+	return rows < 1 ? 1 : rows;
+}
+
+/* Returns the amount of memory module_load() allocates for the module in data, or -1 if it is not recognised.
+   Also returns what is needed to calculate the size of a replay of the module. */
+static int module_calculate_load_usage( struct data *data, int *num_channels, int *seq_len, int *seq_rows, char *message ) {
+	char ascii[ 16 ];
+	int idx, usage, nch = 0, npat = 0, nins, pat, rows, max_rows = 0;
+	int offset, ins, num_samples, sam_head_offset, all_samples = 0;
+	*seq_rows = 0;
+	if( !memcmp( data_ascii( data, 0, 16, ascii ), "Extended Module:", 16 ) ) {
+		if( data_u16le( data, 58 ) != 0x0104 ) {
+			strcpy( message, "XM format version must be 0x0104!" );
+			return -1;
+		}
+		offset = 60 + data_u32le( data, 60 );
+		*seq_len = data_u16le( data, 64 );
+		nch = data_u16le( data, 68 );
+		npat = data_u16le( data, 70 );
+		nins = data_u16le( data, 72 );
+		for( pat = 0; pat < npat; pat++ ) {
+			rows = data_u16le( data, offset + 5 );
+			if( rows > max_rows ) {
+				max_rows = rows;
+			}
+			offset += data_u32le( data, offset ) + data_u16le( data, offset + 7 );
+		}
+		if( max_rows < 1 && npat > 0 ) {
+			max_rows = 1;
+		}
+		usage = npat * sizeof( struct pattern ) + nch * max_rows * 5;
+		usage += *seq_len + nch + ( nins + 1 ) * sizeof( struct instrument ) + sizeof( struct sample );
+		for( ins = 1; ins <= nins; ins++ ) {
+			num_samples = data_u16le( data, offset + 27 );
+			usage += ( num_samples > 0 ? num_samples : 1 ) * sizeof( struct sample );
+			all_samples += num_samples;
+			offset += data_u32le( data, offset );
+			sam_head_offset = offset;
+			offset += num_samples * 40;
+			for( idx = 0; idx < num_samples; idx++ ) {
+				offset += data_u32le( data, sam_head_offset + idx * 40 );
+			}
+		}
+		usage += all_samples * ( nch + 1 ) * sizeof( struct delta_cache );
+		if( npat > 0 ) {
+			for( idx = 0; idx < *seq_len; idx++ ) {
+				pat = data_u8( data, 80 + idx );
+				*seq_rows += xm_pattern_rows( data, pat < npat ? pat : 0 );
+			}
+		}
+	} else if( !memcmp( data_ascii( data, 44, 4, ascii ), "SCRM", 4 ) ) {
+		*seq_len = data_u16le( data, 32 );
+		nins = data_u16le( data, 34 );
+		npat = data_u16le( data, 36 );
+		for( idx = 0; idx < 32; idx++ ) {
+			if( data_u8( data, 64 + idx ) < 16 ) {
+				nch++;
+			}
+		}
+		usage = *seq_len + ( nins + 1 ) * ( sizeof( struct instrument ) + sizeof( struct sample ) );
+		usage += npat * sizeof( struct pattern ) + nch * 64 * 5 + nch;
+		for( idx = 0; idx < *seq_len; idx++ ) {
+			if( data_u8( data, 96 + idx ) < npat ) {
+				*seq_rows += 64;
+			}
+		}
+	} else {
+		switch( data_u16be( data, 1082 ) ) {
+			case 0x4b2e: /* M.K. */
+			case 0x4b21: /* M!K! */
+			case 0x5434: /* FLT4 */
+				nch = 4;
+				break;
+			case 0x484e: /* xCHN */
+				nch = data_u8( data, 1080 ) - 48;
+				break;
+			case 0x4348: /* xxCH */
+				nch = ( data_u8( data, 1080 ) - 48 ) * 10 + data_u8( data, 1081 ) - 48;
+				break;
+			default:
+				strcpy( message, "MOD Format not recognised!" );
+				return -1;
+		}
+		for( idx = 0; idx < 128; idx++ ) {
+			pat = data_u8( data, 952 + idx ) & 0x7F;
+			if( pat >= npat ) {
+				npat = pat + 1;
+			}
+		}
+		*seq_len = data_u8( data, 950 ) & 0x7F;
+		usage = 128 + nch + npat * sizeof( struct pattern ) + nch * 64 * 5;
+		usage += 32 * ( sizeof( struct instrument ) + sizeof( struct sample ) );
+		*seq_rows = *seq_len * 64;
+	}
+	*num_channels = nch;
+	return usage + sizeof( struct module );
+}
+
+static int calculate_replay_usage( int num_channels, int sequence_len, int seq_rows ) {
+	return sizeof( struct replay ) + 128 * sizeof( int ) + num_channels * sizeof( struct channel )
+		+ sequence_len * sizeof( char * ) + seq_rows;
+}
+
+/* Returns the amount of heap memory, in bytes, that module_load() followed by new_replay() would allocate
+   for the specified data, without allocating anything. */
+int module_calculate_memory_usage( struct data *data, char *message ) {
+	int num_channels, seq_len, seq_rows;
+	int usage = module_calculate_load_usage( data, &num_channels, &seq_len, &seq_rows, message );
+	if( usage < 0 ) {
+		return -1;
+	}
+	return usage + calculate_replay_usage( num_channels, seq_len, seq_rows );
+}
+
+/* Returns the amount of heap memory, in bytes, allocated for the specified module. */
+int module_get_memory_usage( struct module *module ) {
+	return module->mem_usage;
+}
+
 static void pattern_get_note( struct pattern *pattern, int row, int chan, struct note *dest ) {
 	int offset = ( row * pattern->num_channels + chan ) * 5;
 	if( offset >= 0 && row < pattern->num_rows && chan < pattern->num_channels ) {
@@ -1933,6 +2079,19 @@ void replay_set_sequence_pos( struct replay *replay, int pos ) {
 	replay_tick( replay );
 }
 
+/* Returns the amount of heap memory, in bytes, allocated for the specified replay. */
+int replay_get_memory_usage( struct replay *replay ) {
+	struct module *module = replay->module;
+	int idx, pat, seq_rows = 0;
+	for( idx = 0; idx < module->sequence_len; idx++ ) {
+		pat = module->sequence[ idx ];
+		if( pat < module->num_patterns ) {
+			seq_rows += module->patterns[ pat ].num_rows;
+		}
+	}
+	return calculate_replay_usage( module->num_channels, module->sequence_len, seq_rows );
+}
+
 /* Deallocate the specified replay. */
 void dispose_replay( struct replay *replay ) {
 	if( replay->play_count ) {
@@ -1984,11 +2143,10 @@ int replay_calculate_duration( struct replay *replay ) {
 	return duration;
 }
 
-/* Seek to approximately the specified sample position.
+/* Advance the replay from current_pos towards sample_pos by simulating ticks without mixing.
    The actual sample position reached is returned. */
-int replay_seek( struct replay *replay, int sample_pos ) {
-	int idx, tick_len, current_pos = 0;
-	replay_set_sequence_pos( replay, 0 );
+static int replay_seek_from( struct replay *replay, int current_pos, int sample_pos ) {
+	int idx, tick_len;
 	tick_len = calculate_tick_len( replay->tempo, replay->sample_rate );
 	while( ( sample_pos - current_pos ) >= tick_len ) {
 		for( idx = 0; idx < replay->module->num_channels; idx++ ) {
@@ -2002,6 +2160,129 @@ int replay_seek( struct replay *replay, int sample_pos ) {
 	return current_pos;
 }
 
+/* Seek to approximately the specified sample position.
+   The actual sample position reached is returned. */
+int replay_seek( struct replay *replay, int sample_pos ) {
+	replay_set_sequence_pos( replay, 0 );
+	return replay_seek_from( replay, 0, sample_pos );
+}
+
+static void seek_point_save( struct seek_point *point, struct replay *replay, int sample_pos ) {
+	point->sample_pos = sample_pos;
+	point->global_vol = replay->global_vol;
+	point->seq_pos = replay->seq_pos;
+	point->break_pos = replay->break_pos;
+	point->row = replay->row;
+	point->next_row = replay->next_row;
+	point->tick = replay->tick;
+	point->speed = replay->speed;
+	point->tempo = replay->tempo;
+	point->pl_count = replay->pl_count;
+	point->pl_chan = replay->pl_chan;
+	memcpy( point->channels, replay->channels, replay->module->num_channels * sizeof( struct channel ) );
+}
+
+static void seek_point_restore( struct seek_point *point, struct replay *replay ) {
+	int idx;
+	replay->global_vol = point->global_vol;
+	replay->seq_pos = point->seq_pos;
+	replay->break_pos = point->break_pos;
+	replay->row = point->row;
+	replay->next_row = point->next_row;
+	replay->tick = point->tick;
+	replay->speed = point->speed;
+	replay->tempo = point->tempo;
+	replay->pl_count = point->pl_count;
+	replay->pl_chan = point->pl_chan;
+	memcpy( replay->channels, point->channels, replay->module->num_channels * sizeof( struct channel ) );
+	/* The snapshot may come from another replay of the same module. */
+	for( idx = 0; idx < replay->module->num_channels; idx++ ) {
+		replay->channels[ idx ].replay = replay;
+	}
+}
+
+/* Deallocate the specified seek index. */
+void dispose_seek_index( struct seek_index *index ) {
+	if( index ) {
+		free( index->channels );
+		free( index->points );
+		free( index );
+	}
+}
+
+/* Build a seek index for the module played by the specified replay. */
+struct seek_index* new_seek_index( struct replay *replay, int stride ) {
+	int idx, count = 0, current_pos = 0, max_points, last_seq_pos = -1;
+	char *recorded;
+	struct module *module = replay->module;
+	struct seek_index *index;
+	if( stride < 1 ) {
+		stride = 1;
+	}
+	max_points = ( module->sequence_len + stride - 1 ) / stride;
+	index = DO_CALLOC( 1, sizeof( struct seek_index ) );
+	recorded = DO_CALLOC( module->sequence_len + 1, sizeof( char ) );
+	if( !index || !recorded ) {
+		free( recorded );
+		dispose_seek_index( index );
+		return NULL;
+	}
+	index->module = module;
+	index->sample_rate = replay->sample_rate;
+	index->num_channels = module->num_channels;
+	index->points = DO_CALLOC( max_points + 1, sizeof( struct seek_point ) );
+	index->channels = DO_CALLOC( ( max_points + 1 ) * module->num_channels, sizeof( struct channel ) );
+	if( !index->points || !index->channels ) {
+		free( recorded );
+		dispose_seek_index( index );
+		return NULL;
+	}
+	/* Play through the song once without mixing, snapshotting the state every
+	   time a sequence position that is a multiple of stride is entered for the first time. */
+	replay_set_sequence_pos( replay, 0 );
+	while( count < 1 ) {
+		if( replay->seq_pos != last_seq_pos ) {
+			last_seq_pos = replay->seq_pos;
+			if( ( replay->seq_pos % stride ) == 0 && !recorded[ replay->seq_pos ]
+				&& index->num_points < max_points ) {
+				recorded[ replay->seq_pos ] = 1;
+				index->points[ index->num_points ].channels = &index->channels[ index->num_points * module->num_channels ];
+				seek_point_save( &index->points[ index->num_points ], replay, current_pos );
+				index->num_points++;
+			}
+		}
+		for( idx = 0; idx < module->num_channels; idx++ ) {
+			channel_update_sample_idx( &replay->channels[ idx ],
+				calculate_tick_len( replay->tempo, replay->sample_rate ) * 2, replay->sample_rate * 2 );
+		}
+		current_pos += calculate_tick_len( replay->tempo, replay->sample_rate );
+		count = replay_tick( replay );
+	}
+	free( recorded );
+	replay_set_sequence_pos( replay, 0 );
+	return index;
+}
+
+/* Seek to approximately the specified sample position, starting from the nearest
+   preceding snapshot in the index. The actual sample position reached is returned. */
+int replay_seek_indexed( struct replay *replay, struct seek_index *index, int sample_pos ) {
+	int idx, best = -1;
+	if( !index || index->module != replay->module || index->sample_rate != replay->sample_rate
+		|| index->num_channels != replay->module->num_channels ) {
+		return replay_seek( replay, sample_pos );
+	}
+	/* Points are stored in playing order, so their sample positions are ascending. */
+	for( idx = 0; idx < index->num_points && index->points[ idx ].sample_pos <= sample_pos; idx++ ) {
+		best = idx;
+	}
+	replay_set_sequence_pos( replay, 0 );
+	if( best < 0 ) {
+		return replay_seek_from( replay, 0, sample_pos );
+	}
+	seek_point_restore( &index->points[ best ], replay );
+	return replay_seek_from( replay, index->points[ best ].sample_pos, sample_pos );
+}
+
 static void replay_volume_ramp( struct replay *replay, int *mix_buf, int tick_len ) {
 	int idx, a1, a2, ramp_rate = 256 * 2048 / replay->sample_rate;
 	for( idx = 0, a1 = 0; a1 < 256; idx += (BYTES_PER_SAMPLE/2), a1 += ramp_rate ) {
@@ -5,8 +5,10 @@
 #define IBXM_SAVE_ASCII_INFO 0
 //Set to 1 to output mono samples
 #define IBXM_MONO 1
+//Set to 1 to print every allocation made while loading and playing
+#define IBXM_TRACE_ALLOCS 0
 
-const char *IBXM_VERSION;
+extern const char *IBXM_VERSION;
 
 struct data {
 	char *buffer;
@@ -78,6 +80,7 @@ struct module {
 	struct pattern pattern_cache;
 	int pattern_cache_idx;
 	pattern_cache_hdl_t pattern_cache_handler;
+	int mem_usage;
 };
 
 /* Allocate and initialize a module from the specified data, returns NULL on error.
@@ -85,15 +88,36 @@ struct module {
 struct module* module_load( struct data *data, char *message );
 /* Deallocate the specified module. */
 void dispose_module( struct module *module );
+/* Returns the amount of heap memory, in bytes, that module_load() followed by new_replay() would allocate
+   for the specified data, without allocating anything. Allocator overhead is not included.
+   Returns -1 on error; message should point to a 64-character buffer to receive error messages. */
+int module_calculate_memory_usage( struct data *data, char *message );
+/* Returns the amount of heap memory, in bytes, allocated for the specified module. Sample data
+   is played in place from the module data and is not included. */
+int module_get_memory_usage( struct module *module );
 /* Allocate and initialize a replay with the specified module and sampling rate. */
 struct replay* new_replay( struct module *module, int sample_rate, int interpolation );
 /* Deallocate the specified replay. */
 void dispose_replay( struct replay *replay );
+/* Returns the amount of heap memory, in bytes, allocated for the specified replay. */
+int replay_get_memory_usage( struct replay *replay );
 /* Returns the song duration in samples at the current sampling rate. */
 int replay_calculate_duration( struct replay *replay );
 /* Seek to approximately the specified sample position.
    The actual sample position reached is returned. */
 int replay_seek( struct replay *replay, int sample_pos );
+/* Allocate a seek index for the module played by the specified replay. The song is played through
+   once (without mixing) and the replay and channel state is stored every time a sequence position that
+   is a multiple of stride is entered. Memory used is roughly (sequence length / stride) * channels * 250 bytes.
+   The index can be used with any replay of the same module at the same sampling rate. */
+struct seek_index* new_seek_index( struct replay *replay, int stride );
+/* Deallocate the specified seek index. */
+void dispose_seek_index( struct seek_index *index );
+/* Same as replay_seek(), but restores the nearest snapshot before sample_pos from the index
+   first, so at most stride sequence positions need to be simulated. Falls back to replay_seek()
+   if index is NULL or does not match the replay. Note that the song-end detection used by
+   replay_calculate_duration() starts counting from the restored position. */
+int replay_seek_indexed( struct replay *replay, struct seek_index *index, int sample_pos );
 /* Set the pattern in the sequence to play. The tempo is reset to the default. */
 void replay_set_sequence_pos( struct replay *replay, int pos );
 /* Generates audio and returns the number of stereo samples written into mix_buf. */
@@ -6,6 +6,9 @@
 
 #include "ibxm.h"
 #include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
 
 static long read_file( char *file_name, void *buffer ) {
 	long file_length = -1, bytes_read;
@@ -108,6 +111,231 @@ static int xm_to_wav( struct module *module, char *wav ) {
 	return length;
 }
 
+static long cpu_time_ns( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static unsigned int crc32_update( unsigned int crc, const unsigned char *buf, int len ) {
+	int idx, bit;
+	crc = ~crc;
+	for( idx = 0; idx < len; idx++ ) {
+		crc ^= buf[ idx ];
+		for( bit = 0; bit < 8; bit++ ) {
+			crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+		}
+	}
+	return ~crc;
+}
+
+/* Adds the output of replay_get_audio() to the checksum, as the 16-bit samples xm2wav would write. */
+static unsigned int crc32_audio( unsigned int crc, const int *mix_buf, int frames ) {
+	int idx, ampl, samples = frames;
+	unsigned char out[ 2 ];
+#if !IBXM_MONO
+	samples = frames * 2;
+#endif
+	for( idx = 0; idx < samples; idx++ ) {
+		ampl = mix_buf[ idx ];
+		if( ampl > 32767 ) {
+			ampl = 32767;
+		}
+		if( ampl < -32768 ) {
+			ampl = -32768;
+		}
+		out[ 0 ] = ampl & 0xFF;
+		out[ 1 ] = ( ampl >> 8 ) & 0xFF;
+		crc = crc32_update( crc, out, 2 );
+	}
+	return crc;
+}
+
+/* Checksum of the next second of audio of the replay. */
+static unsigned int crc32_next_second( struct replay *replay, int rate, int *mix_buf ) {
+	unsigned int crc = 0;
+	int rendered = 0;
+	while( rendered < rate ) {
+		int frames = replay_get_audio( replay, mix_buf );
+		crc = crc32_audio( crc, mix_buf, frames );
+		rendered += frames;
+	}
+	return crc;
+}
+
+/* Seeks to a number of positions, in mixed order, with both replay_seek() and replay_seek_indexed() and checks
+   that both reach the same position and give the same audio after it. The index is built using a replay that is
+   disposed of before it's used, as a game would when it keeps the index around for a later replay.
+   Returns 0 if something differs, -1 if out of memory. */
+static int check_seek( struct module *module, int rate, int duration, int *mix_buf ) {
+	static const int eighths[] = { 3, 0, 7, 5, 1, 6, 2, 4 };
+	int idx, pos, plain_pos, indexed_pos, ok = 1;
+	struct replay *plain = new_replay( module, rate, 0 );
+	struct replay *indexed = new_replay( module, rate, 0 );
+	struct replay *builder = new_replay( module, rate, 0 );
+	struct seek_index *index = builder ? new_seek_index( builder, 2 ) : NULL;
+	if( builder ) {
+		dispose_replay( builder );
+	}
+	if( !plain || !indexed || !index ) {
+		ok = -1;
+	}
+	for( idx = 0; ok > 0 && idx < 8; idx++ ) {
+		pos = ( long ) duration * eighths[ idx ] / 8;
+		plain_pos = replay_seek( plain, pos );
+		indexed_pos = replay_seek_indexed( indexed, index, pos );
+		if( plain_pos != indexed_pos || crc32_next_second( plain, rate, mix_buf ) != crc32_next_second( indexed, rate, mix_buf ) ) {
+			ok = 0;
+		}
+	}
+	dispose_seek_index( index );
+	if( plain ) {
+		dispose_replay( plain );
+	}
+	if( indexed ) {
+		dispose_replay( indexed );
+	}
+	return ok;
+}
+
+/* Looks up the golden checksum for the given module name and rate. Returns 0 if not found. */
+static int golden_lookup( char *golden_file, char *name, int rate, unsigned int *crc ) {
+	char line[ 256 ], gname[ 200 ];
+	unsigned int gcrc;
+	int grate, found = 0;
+	FILE *file = fopen( golden_file, "r" );
+	if( file == NULL ) {
+		return 0;
+	}
+	while( fgets( line, sizeof( line ), file ) ) {
+		if( sscanf( line, "%x %d %199s", &gcrc, &grate, gname ) == 3 && grate == rate && !strcmp( gname, name ) ) {
+			*crc = gcrc;
+			found = 1;
+		}
+	}
+	fclose( file );
+	return found;
+}
+
+/* Renders the module as the sound mixer would and reports speed and a checksum of the output.
+   Returns 0 if the checksum does not match the golden file. */
+static int bench_module( char *file_name, int rate, int max_secs, char *golden_file, int update ) {
+	int frames, duration, seek_ok, rendered = 0, ok = 1;
+	long start, tick_time, total_time = 0, peak_time = 0;
+	unsigned int crc = 0, golden_crc;
+	char message[ 64 ] = "";
+	char *name = basename( file_name );
+	int *mix_buf = calloc( calculate_mix_buf_len( rate ), sizeof( int ) );
+	long length = read_file( file_name, NULL );
+	struct data data;
+	struct module *module;
+	struct replay *replay;
+	if( length < 0 || !mix_buf ) {
+		free( mix_buf );
+		return 0;
+	}
+	data.buffer = calloc( length, 1 );
+	data.length = length;
+	if( !data.buffer || read_file( file_name, data.buffer ) < 0 ) {
+		free( data.buffer );
+		free( mix_buf );
+		return 0;
+	}
+	module = module_load( &data, message );
+	if( !module ) {
+		fprintf( stderr, "%s: %s\n", name, message );
+		free( data.buffer );
+		free( mix_buf );
+		return 0;
+	}
+	replay = new_replay( module, rate, 0 );
+	if( !replay ) {
+		fprintf( stderr, "%s: can't allocate replay\n", name );
+		dispose_module( module );
+		free( data.buffer );
+		free( mix_buf );
+		return 0;
+	}
+	duration = replay_calculate_duration( replay );
+	if( max_secs > 0 && duration > max_secs * rate ) {
+		duration = max_secs * rate;
+	}
+	while( rendered < duration ) {
+		start = cpu_time_ns();
+		frames = replay_get_audio( replay, mix_buf );
+		tick_time = cpu_time_ns() - start;
+		total_time += tick_time;
+		if( tick_time > peak_time ) {
+			peak_time = tick_time;
+		}
+		crc = crc32_audio( crc, mix_buf, frames );
+		rendered += frames;
+	}
+	seek_ok = check_seek( module, rate, duration, mix_buf );
+	printf( "%-24s %7.1fs %8.2f ms/s %7ld us peak/tick %6d bytes heap  seek %s  %08x",
+		name, ( double ) rendered / rate, ( total_time / 1e6 ) / ( ( double ) rendered / rate ),
+		peak_time / 1000, module_get_memory_usage( module ) + replay_get_memory_usage( replay ),
+		seek_ok > 0 ? "OK" : seek_ok < 0 ? "NOMEM" : "DIFFERS", crc );
+	if( seek_ok <= 0 ) {
+		ok = 0;
+	}
+	if( update ) {
+		printf( "\n" );
+	} else if( golden_file == NULL ) {
+		printf( "\n" );
+	} else if( !golden_lookup( golden_file, name, rate, &golden_crc ) ) {
+		printf( "  NO GOLDEN\n" );
+	} else if( golden_crc != crc ) {
+		printf( "  MISMATCH (golden %08x)\n", golden_crc );
+		ok = 0;
+	} else {
+		printf( "  OK\n" );
+	}
+	if( update && golden_file ) {
+		FILE *file = fopen( golden_file, "a" );
+		if( file ) {
+			fprintf( file, "%08x %d %s\n", crc, rate, name );
+			fclose( file );
+		}
+	}
+	dispose_replay( replay );
+	dispose_module( module );
+	free( data.buffer );
+	free( mix_buf );
+	return ok;
+}
+
+static int bench_main( int argc, char **argv ) {
+	int opt, idx, rate = 22050, max_secs = 0, update = 0, failed = 0;
+	char *golden_file = NULL;
+	while( ( opt = getopt( argc, argv, "br:s:g:u" ) ) != -1 ) {
+		switch( opt ) {
+			case 'b': break;
+			case 'r': rate = atoi( optarg ); break;
+			case 's': max_secs = atoi( optarg ); break;
+			case 'g': golden_file = optarg; break;
+			case 'u': update = 1; break;
+			default: return EXIT_FAILURE;
+		}
+	}
+	if( update && golden_file ) {
+		/* Start the golden file afresh. */
+		FILE *file = fopen( golden_file, "w" );
+		if( file ) {
+			fclose( file );
+		}
+	}
+	for( idx = optind; idx < argc; idx++ ) {
+		if( !bench_module( argv[ idx ], rate, max_secs, golden_file, update ) ) {
+			failed++;
+		}
+	}
+	if( failed ) {
+		printf( "%d of %d modules failed.\n", failed, argc - optind );
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main( int argc, char **argv ) {
 	int result, length;
 	char *input, *output;
@@ -115,8 +343,12 @@ int main( int argc, char **argv ) {
 	struct data data;
 	struct module *module;
 	result = EXIT_FAILURE;
+	if( argc > 1 && !strcmp( argv[ 1 ], "-b" ) ) {
+		return bench_main( argc, argv );
+	}
 	if( argc != 3 ) {
 		fprintf( stderr, "%s\nUsage: %s input.xm output.wav\n", IBXM_VERSION, argv[ 0 ] );
+		fprintf( stderr, "       %s -b [-r rate] [-s max_seconds] [-g golden.txt [-u]] module...\n", argv[ 0 ] );
 	} else {
 		/* Read module file.*/
 		length = read_file( argv[ 1 ], NULL );
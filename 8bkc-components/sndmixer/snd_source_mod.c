@@ -4,10 +4,18 @@
 #include <ibxm/ibxm.h>
 #include "snd_source_mod.h"
 
+//Sequence positions between the snapshots in the seek index of a seekable mod. Every snapshot takes about 250 bytes per
+//channel; a seek has to simulate at most this many positions.
+#define SEEK_STRIDE 8
+
 typedef struct {
 	struct module *module;
 	struct replay *replay;
+	struct seek_index *index; //or NULL if not seekable
 	int sample_rate;
+	int *mixbuf; //one tick worth of ibxm output
+	int mixbuf_pos; //next sample in mixbuf to hand to the mixer
+	int mixbuf_len; //amount of valid samples in mixbuf
 } mod_ctx_t;
 
 int mod_init_source(const void *data_start, const void *data_end, int req_sample_rate, void **ctx) {
@@ -25,9 +33,11 @@ int mod_init_source(const void *data_start, const void *data_end, int req_sample
 	}
 	mod->replay=new_replay(mod->module, req_sample_rate, 0);
 	if (!mod->replay) goto err;
+	mod->mixbuf=malloc(calculate_mix_buf_len(req_sample_rate)*sizeof(int));
+	if (!mod->mixbuf) goto err;
 	mod->sample_rate=req_sample_rate;
 	*ctx=(void*)mod;
-	return calculate_mix_buf_len(req_sample_rate)*4; //ToDo: check this!
+	return 1;
 err:
 	if (mod->module) dispose_module(mod->module);
 	if (mod->replay) dispose_replay(mod->replay);
@@ -35,37 +45,90 @@ err:
 	return -1;
 }
 
+//Same as mod_init_source, but also builds a seek index. This plays through the song once, without mixing.
+int mod_init_source_seekable(const void *data_start, const void *data_end, int req_sample_rate, void **ctx) {
+	int r=mod_init_source(data_start, data_end, req_sample_rate, ctx);
+	if (r<=0) return r;
+	mod_ctx_t *mod=(mod_ctx_t*)*ctx;
+	mod->index=new_seek_index(mod->replay, SEEK_STRIDE);
+	//Without an index, seeking still works; it's just slower.
+	if (!mod->index) printf("Failed building mod seek index\n");
+	return r;
+}
+
+int mod_calculate_memory_usage(const void *data_start, const void *data_end, int sample_rate) {
+	char error[64];
+	struct data data={
+		.buffer=(char*)data_start,
+		.length=(char*)data_end-(char*)data_start
+	};
+	int r=module_calculate_memory_usage(&data, error);
+	if (r<0) {
+		printf("Can't calculate mod memory use: %s\n", error);
+		return -1;
+	}
+	return r+sizeof(mod_ctx_t)+calculate_mix_buf_len(sample_rate)*sizeof(int);
+}
+
 int mod_get_sample_rate(void *ctx) {
 	mod_ctx_t *mod=(mod_ctx_t*)ctx;
 	return mod->sample_rate;
 }
 
-int mod_fill_buffer(void *ctx, int8_t *buffer) {
+//ibxm renders at the mixer sample rate, so its output can go into the accumulator as-is.
+int mod_mix_buffer(void *ctx, int *acc, int len, int volume) {
 	mod_ctx_t *mod=(mod_ctx_t*)ctx;
-	int *samps=(int*)buffer;
-	int r=replay_get_audio(mod->replay, samps);
-//	printf("Got %d samps from ibxm.\n", r);
-	for (int i=0; i<r; i++) {
-		int s=samps[i+1];
-		if (s>32767) s=32767;
-		if (s<-32767) s=-32767;
-		buffer[i]=s>>8;
-//		if (i<16) buffer[i]=0;
+	int i=0;
+	while (i<len) {
+		if (mod->mixbuf_pos>=mod->mixbuf_len) {
+			mod->mixbuf_len=replay_get_audio(mod->replay, mod->mixbuf);
+			mod->mixbuf_pos=0;
+		}
+		int n=mod->mixbuf_len-mod->mixbuf_pos;
+		if (n>len-i) n=len-i;
+		const int *samps=&mod->mixbuf[mod->mixbuf_pos];
+		for (int j=0; j<n; j++) {
+			int s=samps[j];
+			if (s>32767) s=32767;
+			if (s<-32767) s=-32767;
+			//s is 16-bit; the accumulator wants an 8-bit sample times the volume.
+			acc[i+j]+=(s*volume)>>8;
+		}
+		mod->mixbuf_pos+=n;
+		i+=n;
 	}
-	return r;
-//	return r-10;
+	return len;
+}
+
+int mod_seek(void *ctx, int ms) {
+	mod_ctx_t *mod=(mod_ctx_t*)ctx;
+	int pos=replay_seek_indexed(mod->replay, mod->index, ((int64_t)ms*mod->sample_rate)/1000);
+	mod->mixbuf_pos=0;
+	mod->mixbuf_len=0;
+	return ((int64_t)pos*1000)/mod->sample_rate;
 }
 
 void mod_deinit_source(void *ctx) {
 	mod_ctx_t *mod=(mod_ctx_t*)ctx;
 	if (mod->module) dispose_module(mod->module);
 	if (mod->replay) dispose_replay(mod->replay);
+	if (mod->index) dispose_seek_index(mod->index);
+	free(mod->mixbuf);
 	free(mod);
 }
 
 const sndmixer_source_t sndmixer_source_mod={
 	.init_source=mod_init_source,
 	.get_sample_rate=mod_get_sample_rate,
-	.fill_buffer=mod_fill_buffer,
-	.deinit_source=mod_deinit_source
-};
\ No newline at end of file
+	.deinit_source=mod_deinit_source,
+	.mix_buffer=mod_mix_buffer,
+	.seek=mod_seek
+};
+
+const sndmixer_source_t sndmixer_source_mod_seekable={
+	.init_source=mod_init_source_seekable,
+	.get_sample_rate=mod_get_sample_rate,
+	.deinit_source=mod_deinit_source,
+	.mix_buffer=mod_mix_buffer,
+	.seek=mod_seek
+};
@@ -1,4 +1,9 @@
 #pragma once
 #include "sndmixer.h"
 
-extern const sndmixer_source_t sndmixer_source_mod;
\ No newline at end of file
+extern const sndmixer_source_t sndmixer_source_mod;
+//Same, but builds a seek index when initialized, so seeking is fast.
+extern const sndmixer_source_t sndmixer_source_mod_seekable;
+
+//Returns the amount of heap memory the mod source needs to play the given module, or -1 on error.
+int mod_calculate_memory_usage(const void *data_start, const void *data_end, int sample_rate);
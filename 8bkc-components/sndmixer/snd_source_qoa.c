@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "snd_source_qoa.h"
+
+/*
+Decoder for QOA, the 'Quite OK Audio' format (see https://qoaformat.org). A QOA file is a 8-byte file
+header followed by frames of up to 256 slices per channel. Every slice packs 20 samples in 64 bits: a
+4-bit scalefactor and 20 3-bit residuals, which are added to the prediction of a 4-tap LMS filter.
+Decoding a slice is a table lookup and a handful of multiply-adds per sample, so we decode one slice
+per fill_buffer call. Multi-channel files are mixed down to mono.
+*/
+
+#define SLICE_LEN 20
+#define MAX_CHANNELS 8
+#define FILE_HDR_LEN 8
+#define LMS_LEN 4
+
+typedef struct {
+	int history[LMS_LEN];
+	int weights[LMS_LEN];
+} qoa_lms_t;
+
+typedef struct {
+	const uint8_t *data;
+	const uint8_t *pos; //next byte to decode
+	const uint8_t *end;
+	int rate;
+	int channels; //channels in the current frame
+	int frame_samples; //samples per channel in the current frame
+	int frame_pos; //samples per channel decoded in the current frame
+	qoa_lms_t lms[MAX_CHANNELS];
+} qoa_ctx_t;
+
+static const int dequant_tab[16][8] = {
+	{1, -1, 3, -3, 5, -5, 7, -7},
+	{5, -5, 18, -18, 32, -32, 49, -49},
+	{16, -16, 53, -53, 95, -95, 147, -147},
+	{34, -34, 113, -113, 203, -203, 315, -315},
+	{63, -63, 210, -210, 378, -378, 588, -588},
+	{104, -104, 345, -345, 621, -621, 966, -966},
+	{158, -158, 528, -528, 950, -950, 1477, -1477},
+	{228, -228, 760, -760, 1368, -1368, 2128, -2128},
+	{316, -316, 1053, -1053, 1895, -1895, 2947, -2947},
+	{422, -422, 1405, -1405, 2529, -2529, 3934, -3934},
+	{548, -548, 1828, -1828, 3290, -3290, 5117, -5117},
+	{696, -696, 2320, -2320, 4176, -4176, 6496, -6496},
+	{868, -868, 2893, -2893, 5207, -5207, 8099, -8099},
+	{1064, -1064, 3548, -3548, 6386, -6386, 9933, -9933},
+	{1286, -1286, 4288, -4288, 7718, -7718, 12005, -12005},
+	{1536, -1536, 5120, -5120, 9216, -9216, 14336, -14336},
+};
+
+//All values in QOA files are big-endian.
+static uint64_t read_u64(const uint8_t *p) {
+	uint32_t hi=(p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+	uint32_t lo=(p[4]<<24)|(p[5]<<16)|(p[6]<<8)|p[7];
+	return ((uint64_t)hi<<32)|lo;
+}
+
+//Parses a frame header plus the LMS state that follows it. Returns 0 if there is no valid frame at pos.
+static int qoa_start_frame(qoa_ctx_t *qoa) {
+	const uint8_t *p=qoa->pos;
+	if (qoa->end-p<8) return 0;
+	int channels=p[0];
+	int rate=(p[1]<<16)|(p[2]<<8)|p[3];
+	int samples=(p[4]<<8)|p[5];
+	int size=(p[6]<<8)|p[7];
+	if (channels==0 || channels>MAX_CHANNELS || samples==0 || rate==0) return 0;
+	if (size>qoa->end-p || size<8+channels*16) return 0;
+	p+=8;
+	for (int c=0; c<channels; c++) {
+		uint64_t history=read_u64(p);
+		uint64_t weights=read_u64(p+8);
+		p+=16;
+		for (int i=0; i<LMS_LEN; i++) {
+			qoa->lms[c].history[i]=(int16_t)(history>>48);
+			qoa->lms[c].weights[i]=(int16_t)(weights>>48);
+			history<<=16;
+			weights<<=16;
+		}
+	}
+	qoa->channels=channels;
+	qoa->rate=rate;
+	qoa->frame_samples=samples;
+	qoa->frame_pos=0;
+	qoa->pos=p;
+	return 1;
+}
+
+int qoa_init_source(const void *data_start, const void *data_end, int req_sample_rate, void **ctx) {
+	const uint8_t *p=(const uint8_t*)data_start;
+	if ((const uint8_t*)data_end-p<FILE_HDR_LEN) return -1;
+	if (memcmp(p, "qoaf", 4)!=0) {
+		printf("QOA: not a qoa file\n");
+		return -1;
+	}
+	qoa_ctx_t *qoa=calloc(sizeof(qoa_ctx_t), 1);
+	if (!qoa) return -1;
+	qoa->data=p;
+	qoa->pos=p+FILE_HDR_LEN;
+	qoa->end=(const uint8_t*)data_end;
+	//Parse the first frame for the sample rate. The stream is assumed not to change it later on.
+	if (!qoa_start_frame(qoa)) {
+		printf("QOA: no valid frame\n");
+		free(qoa);
+		return -1;
+	}
+	*ctx=(void*)qoa;
+	return SLICE_LEN;
+}
+
+int qoa_get_sample_rate(void *ctx) {
+	qoa_ctx_t *qoa=(qoa_ctx_t*)ctx;
+	return qoa->rate;
+}
+
+int qoa_fill_buffer(void *ctx, int8_t *buffer) {
+	qoa_ctx_t *qoa=(qoa_ctx_t*)ctx;
+	if (qoa->frame_pos>=qoa->frame_samples) {
+		if (!qoa_start_frame(qoa)) return 0; //end of file, or garbage
+	}
+	int len=qoa->frame_samples-qoa->frame_pos;
+	if (len>SLICE_LEN) len=SLICE_LEN;
+	if (qoa->end-qoa->pos<qoa->channels*8) return 0; //truncated file
+	int acc[SLICE_LEN]={0};
+	//The frame contains one slice for each channel, one after the other.
+	for (int c=0; c<qoa->channels; c++) {
+		qoa_lms_t *lms=&qoa->lms[c];
+		uint64_t slice=read_u64(qoa->pos);
+		qoa->pos+=8;
+		const int *dq=dequant_tab[slice>>60];
+		slice<<=4;
+		for (int i=0; i<len; i++) {
+			int pred=0;
+			for (int j=0; j<LMS_LEN; j++) pred+=lms->weights[j]*lms->history[j];
+			pred>>=13;
+			int r=dq[slice>>61];
+			slice<<=3;
+			int s=pred+r;
+			if (s>32767) s=32767;
+			if (s<-32768) s=-32768;
+			acc[i]+=s;
+			//Adapt the LMS filter
+			int delta=r>>4;
+			for (int j=0; j<LMS_LEN; j++) lms->weights[j]+=(lms->history[j]<0)?-delta:delta;
+			for (int j=0; j<LMS_LEN-1; j++) lms->history[j]=lms->history[j+1];
+			lms->history[LMS_LEN-1]=s;
+		}
+	}
+	for (int i=0; i<len; i++) {
+		buffer[i]=(acc[i]/qoa->channels)>>8;
+	}
+	qoa->frame_pos+=len;
+	return len;
+}
+
+void qoa_deinit_source(void *ctx) {
+	free(ctx);
+}
+
+const sndmixer_source_t sndmixer_source_qoa={
+	.init_source=qoa_init_source,
+	.get_sample_rate=qoa_get_sample_rate,
+	.fill_buffer=qoa_fill_buffer,
+	.deinit_source=qoa_deinit_source
+};
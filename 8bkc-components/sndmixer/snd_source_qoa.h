@@ -0,0 +1,5 @@
+#pragma once
+#include "sndmixer.h"
+
+extern const sndmixer_source_t sndmixer_source_qoa;
+
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "snd_source_synth.h"
+
+//Pitch, duty and vibrato are updated once every this many samples; the envelope and oscillator run per sample.
+#define STEP 32
+
+typedef struct {
+	const sndmixer_sfx_t *p;
+	int rate;
+	uint32_t phase; //oscillator phase; 2^32 is one period
+	int64_t inc; //phase increment per sample, 32.16 fixed
+	int64_t slide; //change of inc per step, 32.16 fixed
+	int64_t slide_accel; //change of slide per step, 32.16 fixed
+	int64_t inc_limit; //sound ends if inc goes below this
+	uint32_t cur_inc; //inc with vibrato applied, as used by the oscillator
+	int duty; //8.8 fixed
+	int duty_step; //change of duty per step, 8.8 fixed
+	uint32_t lfo_phase;
+	uint32_t lfo_inc; //per step
+	uint32_t noise_seed;
+	int noise_val;
+	int env_stage; //0=attack, 1=sustain, 2=decay, 3=done
+	int env_pos; //samples into current stage
+	int env_len[3]; //length of the stages, in samples
+	int env; //current envelope value, 16.16 fixed
+	int env_delta; //change of env per sample
+	int amp; //sfx volume, 0-256
+	int arp_at; //samples since (re)start at which arp kicks in, or -1
+	int repeat_len; //samples between pitch restarts, or 0
+	int t; //samples since (re)start of pitch
+	int step_pos; //samples until next step update
+} synth_ctx_t;
+
+static int ms_to_samples(int ms, int rate) {
+	return ((int64_t)ms*rate)/1000; //in 64 bits, as 65535 mS at 44.1KHz doesn't fit an int
+}
+
+//Sets (or resets, for repeats) the pitch-related state to the start values in the parameter block.
+static void synth_reset_pitch(synth_ctx_t *s) {
+	const sndmixer_sfx_t *p=s->p;
+	s->inc=((((int64_t)p->freq)<<32)/s->rate)<<16;
+	s->slide=((((int64_t)p->slide)<<32)/s->rate)*STEP*65536/s->rate;
+	s->slide_accel=((((int64_t)p->slide_accel)<<32)/s->rate)*STEP*65536/s->rate*STEP/s->rate;
+	s->duty=p->duty<<8;
+	s->t=0;
+}
+
+int synth_init_source(const void *data_start, const void *data_end, int req_sample_rate, void **ctx) {
+	if ((const char*)data_end-(const char*)data_start < (int)sizeof(sndmixer_sfx_t)) return -1;
+	synth_ctx_t *s=calloc(sizeof(synth_ctx_t), 1);
+	if (!s) return -1;
+	const sndmixer_sfx_t *p=(const sndmixer_sfx_t*)data_start;
+	s->p=p;
+	s->rate=req_sample_rate;
+	synth_reset_pitch(s);
+	s->inc_limit=((((int64_t)p->freq_limit)<<32)/s->rate)<<16;
+	s->duty_step=(p->duty_sweep*256*10*STEP)/s->rate;
+	s->lfo_inc=(uint32_t)(((((int64_t)p->vibrato_speed)<<32)/(s->rate*10))*STEP);
+	s->noise_seed=0x12345678;
+	s->env_len[0]=ms_to_samples(p->attack, s->rate);
+	s->env_len[1]=ms_to_samples(p->sustain, s->rate);
+	s->env_len[2]=ms_to_samples(p->decay, s->rate);
+	if (s->env_len[0]) s->env_delta=65536/s->env_len[0];
+	s->amp=p->volume+(p->volume>>7); //0-255 -> 0-256
+	s->arp_at=p->arp_time?ms_to_samples(p->arp_time, s->rate):-1;
+	s->repeat_len=ms_to_samples(p->repeat, s->rate);
+	*ctx=(void*)s;
+	return 1;
+}
+
+int synth_get_sample_rate(void *ctx) {
+	synth_ctx_t *s=(synth_ctx_t*)ctx;
+	return s->rate;
+}
+
+//Updates pitch, duty and vibrato. Returns 0 if the sound has slid out of range and should end.
+static int synth_step(synth_ctx_t *s) {
+	const sndmixer_sfx_t *p=s->p;
+	if (s->repeat_len && s->t>=s->repeat_len) synth_reset_pitch(s);
+	if (s->arp_at>=0 && s->t>=s->arp_at && s->t<s->arp_at+STEP) {
+		s->inc=(s->inc*p->arp_mult)>>8;
+	}
+	s->slide+=s->slide_accel;
+	s->inc+=s->slide;
+	if (s->inc<=0 || s->inc<s->inc_limit) return 0;
+	s->duty+=s->duty_step;
+	if (s->duty<0) s->duty=0;
+	if (s->duty>(255<<8)) s->duty=255<<8;
+	int64_t inc=s->inc>>16;
+	if (p->vibrato_depth) {
+		//Triangle LFO, -256..255
+		int t=s->lfo_phase>>22;
+		int lfo=(t<512)?(t-256):(767-t);
+		inc+=(inc*lfo*p->vibrato_depth)>>18;
+		s->lfo_phase+=s->lfo_inc;
+	}
+	s->cur_inc=(uint32_t)inc;
+	return 1;
+}
+
+//Returns the envelope, 0-65536 (or more during punch), advancing it by one sample. Returns -1 when done.
+static inline int synth_env(synth_ctx_t *s) {
+	while (s->env_stage<3 && s->env_pos>=s->env_len[s->env_stage]) {
+		//Go to the next stage, skipping stages with a length of 0.
+		s->env_stage++;
+		s->env_pos=0;
+		if (s->env_stage==3) break;
+		int len=s->env_len[s->env_stage];
+		if (len==0) continue;
+		if (s->env_stage==1) {
+			s->env=65536+(s->p->punch<<8);
+			s->env_delta=-(s->p->punch<<8)/len;
+		} else {
+			s->env=65536;
+			s->env_delta=-65536/len;
+		}
+	}
+	if (s->env_stage==3) return -1;
+	int r=s->env;
+	s->env+=s->env_delta;
+	s->env_pos++;
+	return r;
+}
+
+static inline int synth_osc(synth_ctx_t *s) {
+	uint32_t old=s->phase;
+	s->phase+=s->cur_inc;
+	int wave=s->p->wave;
+	if (wave==SNDMIXER_SFX_SQUARE) {
+		return ((int)(s->phase>>24)<(s->duty>>8))?127:-127;
+	} else if (wave==SNDMIXER_SFX_SAW) {
+		return (int)(s->phase>>24)-128;
+	} else {
+		//Noise: pick a new random value 16 times per period, so the pitch still colours the noise.
+		if ((old^s->phase)>>28) {
+			s->noise_seed^=s->noise_seed<<13;
+			s->noise_seed^=s->noise_seed>>17;
+			s->noise_seed^=s->noise_seed<<5;
+			s->noise_val=(int)(s->noise_seed>>24)-128;
+		}
+		return s->noise_val;
+	}
+}
+
+int synth_mix_buffer(void *ctx, int *acc, int len, int volume) {
+	synth_ctx_t *s=(synth_ctx_t*)ctx;
+	//Scale the sfx volume by the channel volume once, instead of per sample.
+	int vol=(s->amp*volume)>>8;
+	for (int i=0; i<len; i++) {
+		if (s->step_pos==0) {
+			if (!synth_step(s)) return i;
+			s->step_pos=STEP;
+		}
+		s->step_pos--;
+		s->t++;
+		int env=synth_env(s);
+		if (env<0) return i;
+		int v=synth_osc(s);
+		//env is 16.16, vol is 0-256; acc wants sample*0-256.
+		acc[i]+=v*(((env>>8)*vol)>>8);
+	}
+	return len;
+}
+
+void synth_deinit_source(void *ctx) {
+	free(ctx);
+}
+
+const sndmixer_source_t sndmixer_source_synth={
+	.init_source=synth_init_source,
+	.get_sample_rate=synth_get_sample_rate,
+	.deinit_source=synth_deinit_source,
+	.mix_buffer=synth_mix_buffer
+};
@@ -2,10 +2,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/portmacro.h"
 
 #include "8bkc-hal.h"
@@ -13,6 +15,8 @@
 
 #include "snd_source_wav.h"
 #include "snd_source_mod.h"
+#include "snd_source_synth.h"
+#include "snd_source_qoa.h"
 
 #define CHFL_EVICTABLE (1<<0)
 #define CHFL_PAUSED (1<<1)
@@ -21,13 +25,18 @@
 typedef enum {
 	CMD_QUEUE_WAV	=	1,
 	CMD_QUEUE_MOD,
+	CMD_QUEUE_SFX,
+	CMD_QUEUE_QOA,
+	CMD_QUEUE_MOD_SEEKABLE,
 	CMD_LOOP,
 	CMD_VOLUME,
+	CMD_SEEK,
 	CMD_PLAY,
 	CMD_PAUSE,
 	CMD_STOP,
 	CMD_PAUSE_ALL,
-	CMD_RESUME_ALL
+	CMD_RESUME_ALL,
+	CMD_DEINIT
 } sndmixer_cmd_ins_t;
 
 typedef struct {
@@ -62,6 +71,8 @@ static int no_channels;
 static int samplerate;
 static volatile uint32_t curr_id=0;
 static QueueHandle_t cmd_queue;
+static SemaphoreHandle_t deinit_done_sema;
+static bool deinit_requested;
 
 //Grabs a new ID by atomically increasing curr_id and returning its value. This is called outside of the audio playing thread, hence the atomicity.
 static uint32_t new_id() {
@@ -106,6 +117,7 @@ static int init_source(int ch, const sndmixer_source_t *srcfns, const void *data
 	if (chunksz<=0) return 0; //failed
 	channel[ch].source=srcfns;
 	channel[ch].volume=256;
+	if (srcfns->mix_buffer) return 1; //source mixes into the accumulator itself; no buffer or resampling needed
 	channel[ch].buffer=malloc(chunksz);
 	if (!channel[ch].buffer) {
 		clean_up_channel(ch);
@@ -119,7 +131,8 @@ static int init_source(int ch, const sndmixer_source_t *srcfns, const void *data
 }
 
 static void handle_cmd(sndmixer_cmd_t *cmd) {
-	if (cmd->cmd==CMD_QUEUE_WAV || cmd->cmd==CMD_QUEUE_MOD) {
+	if (cmd->cmd==CMD_QUEUE_WAV || cmd->cmd==CMD_QUEUE_MOD || cmd->cmd==CMD_QUEUE_SFX || cmd->cmd==CMD_QUEUE_QOA ||
+			cmd->cmd==CMD_QUEUE_MOD_SEEKABLE) {
 		int ch=find_free_channel();
 		if (ch<0) return; //no free channels
 		int r=0;
@@ -128,6 +141,12 @@ static void handle_cmd(sndmixer_cmd_t *cmd) {
 			r=init_source(ch, &sndmixer_source_wav, cmd->queue_file_start, cmd->queue_file_end);
 		} else if (cmd->cmd==CMD_QUEUE_MOD) {
 			r=init_source(ch, &sndmixer_source_mod, cmd->queue_file_start, cmd->queue_file_end);
+		} else if (cmd->cmd==CMD_QUEUE_SFX) {
+			r=init_source(ch, &sndmixer_source_synth, cmd->queue_file_start, cmd->queue_file_end);
+		} else if (cmd->cmd==CMD_QUEUE_QOA) {
+			r=init_source(ch, &sndmixer_source_qoa, cmd->queue_file_start, cmd->queue_file_end);
+		} else if (cmd->cmd==CMD_QUEUE_MOD_SEEKABLE) {
+			r=init_source(ch, &sndmixer_source_mod_seekable, cmd->queue_file_start, cmd->queue_file_end);
 		}
 		if (!r) {
 			printf("Sndmixer: Failed to start decoder for id %d\n", cmd->id);
@@ -139,6 +158,8 @@ static void handle_cmd(sndmixer_cmd_t *cmd) {
 		for (int x=0; x<no_channels; x++) channel[x].flags|=CHFL_PAUSED;
 	} else if (cmd->cmd==CMD_RESUME_ALL) {
 		for (int x=0; x<no_channels; x++) channel[x].flags&=~CHFL_PAUSED;
+	} else if (cmd->cmd==CMD_DEINIT) {
+		deinit_requested=true;
 	} else {
 		//Rest are all commands that act on a certain ID. Look up if we have a channel with that ID first.
 		int ch=-1;
@@ -153,6 +174,8 @@ static void handle_cmd(sndmixer_cmd_t *cmd) {
 			if (cmd->param) channel[ch].flags|=CHFL_LOOP; else channel[ch].flags&=~CHFL_LOOP;
 		} else if (cmd->cmd==CMD_VOLUME) {
 			channel[ch].volume=cmd->param;
+		} else if (cmd->cmd==CMD_SEEK) {
+			if (channel[ch].source->seek) channel[ch].source->seek(channel[ch].src_ctx, cmd->param);
 		} else if (cmd->cmd==CMD_PLAY) {
 			channel[ch].flags&=~CHFL_PAUSED;
 		} else if (cmd->cmd==CMD_PAUSE) {
@@ -165,49 +188,112 @@ static void handle_cmd(sndmixer_cmd_t *cmd) {
 }
 
 #define CHUNK_SIZE 64
+//Total size of the I2S DMA buffers, in samples. This is what is passed to kchal_sound_start, which spreads it
+//out over 4 DMA buffers.
+#define I2S_BUF_SAMPLES 1024
+//Amount of silence pushed after waking up, before the first real samples.
+#define PREROLL_SAMPLES CHUNK_SIZE
+
+static bool has_active_channel() {
+	for (int ch=0; ch<no_channels; ch++) {
+		if (channel[ch].source && !(channel[ch].flags & CHFL_PAUSED)) return true;
+	}
+	return false;
+}
+
+static void push_silence(int len) {
+	uint8_t silence[CHUNK_SIZE];
+	memset(silence, 128, CHUNK_SIZE);
+	for (int i=0; i<len; i+=CHUNK_SIZE) kchal_sound_push(silence, CHUNK_SIZE);
+}
 
 //Sound mixer main loop.
 static void sndmixer_task(void *arg) {
 	uint8_t mixbuf[CHUNK_SIZE];
+	bool suspended=false;
 	printf("Sndmixer task up.\n");
-	while(1) {
+	while(!deinit_requested) {
 		//Handle any commands that are sent to us.
 		sndmixer_cmd_t cmd;
 		while(xQueueReceive(cmd_queue, &cmd, 0) == pdTRUE) {
 			handle_cmd(&cmd);
 		}
+		if (deinit_requested) break;
+
+		if (!has_active_channel()) {
+			//Nothing to play. Instead of mixing silence, mute the output and sleep until a command comes in.
+			if (!suspended) {
+				//Fill the DMA buffers with silence first, so the output ends on DC instead of clicking, and
+				//whatever the DMA keeps cycling through while muted is silence as well.
+				push_silence(I2S_BUF_SAMPLES);
+				kchal_sound_mute(1);
+				suspended=true;
+			}
+			if (xQueueReceive(cmd_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+				handle_cmd(&cmd);
+			}
+			continue;
+		}
+		if (suspended) {
+			//Something started playing. Unmute, and give the DAC a bit of silence to settle.
+			kchal_sound_mute(0);
+			push_silence(PREROLL_SAMPLES);
+			suspended=false;
+		}
 
 		//Assemble CHUNK_SIZE worth of samples and dump it into the I2S subsystem.
-		for (int i=0; i<CHUNK_SIZE; i++) {
-			int s=0; //current sample value, multiplied by 256 (because of multiplies by channel volume)
-			for (int ch=0; ch<no_channels; ch++) {
-				if (channel[ch].source) {
-					//Channel is active.
-					channel[ch].dds_acc+=channel[ch].dds_rate; //select next sample
-					//dds_acc>>16 now gives us which sample to get from the buffer.
-					if ((channel[ch].dds_acc>>16)>=channel[ch].chunksz) {
-						//That value is outside the channels chunk buffer. Refill that first.
-						int r=channel[ch].source->fill_buffer(channel[ch].src_ctx, channel[ch].buffer);
-						if (r==0) {
-							//Source is done.
-							printf("Sndmixer: %d: cleaning up source because of EOF\n", channel[ch].id); 
-							clean_up_channel(ch);
-							continue;
-						}
-						channel[ch].dds_acc-=(channel[ch].chunksz<<16); //reset dds acc; we have parsed chunksize samples.
-						channel[ch].chunksz=r; //save new chunksize
+		//Accumulated sample values are multiplied by 256 (because of multiplies by channel volume)
+		//Static, to keep it off the small stack of this task; there's only one mixer task.
+		static int acc[CHUNK_SIZE];
+		memset(acc, 0, sizeof(acc));
+		for (int ch=0; ch<no_channels; ch++) {
+			if (!channel[ch].source || (channel[ch].flags & CHFL_PAUSED)) continue;
+			if (channel[ch].source->mix_buffer) {
+				//Source renders at our sample rate straight into the accumulator.
+				int r=channel[ch].source->mix_buffer(channel[ch].src_ctx, acc, CHUNK_SIZE, channel[ch].volume);
+				if (r<CHUNK_SIZE) {
+					printf("Sndmixer: %d: cleaning up source because of EOF\n", channel[ch].id); 
+					clean_up_channel(ch);
+				}
+				continue;
+			}
+			for (int i=0; i<CHUNK_SIZE; i++) {
+				channel[ch].dds_acc+=channel[ch].dds_rate; //select next sample
+				//dds_acc>>16 now gives us which sample to get from the buffer.
+				if ((channel[ch].dds_acc>>16)>=channel[ch].chunksz) {
+					//That value is outside the channels chunk buffer. Refill that first.
+					int r=channel[ch].source->fill_buffer(channel[ch].src_ctx, channel[ch].buffer);
+					if (r==0) {
+						//Source is done.
+						printf("Sndmixer: %d: cleaning up source because of EOF\n", channel[ch].id); 
+						clean_up_channel(ch);
+						break;
 					}
-					//Multiply by volume, add to cumulative sample
-					s+=channel[ch].buffer[channel[ch].dds_acc>>16]*channel[ch].volume;
+					channel[ch].dds_acc-=(channel[ch].chunksz<<16); //reset dds acc; we have parsed chunksize samples.
+					channel[ch].chunksz=r; //save new chunksize
 				}
+				//Multiply by volume, add to cumulative sample
+				acc[i]+=channel[ch].buffer[channel[ch].dds_acc>>16]*channel[ch].volume;
 			}
+		}
+		for (int i=0; i<CHUNK_SIZE; i++) {
 			//Bring back to -128-127. Volume did *256, channels did *no_channels.
-			s=(s/no_channels)>>8;
+			int s=(acc[i]/no_channels)>>8;
+			//Synthesized effects with punch can go over full scale; clip rather than wrap around.
+			if (s>127) s=127;
+			if (s<-128) s=-128;
 			mixbuf[i]=s+128; //because samples are signed, mix_buf is unsigned
 		}
 		kchal_sound_push(mixbuf, CHUNK_SIZE);
 	}
-	//ToDo: de-init channels/buffers/... if we ever implement a deinit cmd
+	for (int ch=0; ch<no_channels; ch++) {
+		if (channel[ch].source) clean_up_channel(ch);
+	}
+	free(channel);
+	channel=NULL;
+	if (suspended) kchal_sound_mute(0);
+	printf("Sndmixer task done.\n");
+	xSemaphoreGive(deinit_done_sema);
 	vTaskDelete(NULL);
 }
 
@@ -217,24 +303,44 @@ static void sndmixer_task(void *arg) {
 int sndmixer_init(int p_no_channels, int p_samplerate) {
 	no_channels=p_no_channels;
 	samplerate=p_samplerate;
-	kchal_sound_start(samplerate, 1024);
+	kchal_sound_start(samplerate, I2S_BUF_SAMPLES);
 	channel=calloc(sizeof(sndmixer_channel_t), no_channels);
 	if (!channel) return 0;
 	curr_id=0;
+	deinit_requested=false;
 	cmd_queue=xQueueCreate(10, sizeof(sndmixer_cmd_t));
 	if (cmd_queue==NULL) {
 		free(channel);
 		return 0;
 	}
+	deinit_done_sema=xSemaphoreCreateBinary();
+	if (deinit_done_sema==NULL) {
+		free(channel);
+		vQueueDelete(cmd_queue);
+		return 0;
+	}
 	int r=xTaskCreatePinnedToCore(&sndmixer_task, "sndmixer", 2048, NULL, 5, NULL, MY_CORE);
 	if (!r) {
 		free(channel);
 		vQueueDelete(cmd_queue);
+		vSemaphoreDelete(deinit_done_sema);
 		return 0;
 	}
 	return 1;
 }
 
+void sndmixer_deinit() {
+	sndmixer_cmd_t cmd={
+		.cmd=CMD_DEINIT,
+	};
+	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
+	//Wait for the mixer task to free everything and finish.
+	xSemaphoreTake(deinit_done_sema, portMAX_DELAY);
+	vSemaphoreDelete(deinit_done_sema);
+	vQueueDelete(cmd_queue);
+	kchal_sound_stop();
+}
+
 // The following functions all are essentially wrappers for the axt of pushing a command into the command queue.
 
 int sndmixer_queue_wav(const void *wav_start, const void *wav_end, int evictable) {
@@ -263,6 +369,49 @@ int sndmixer_queue_mod(const void *mod_start, const void *mod_end) {
 	return id;
 }
 
+int sndmixer_queue_mod_seekable(const void *mod_start, const void *mod_end) {
+	int id=new_id();
+	sndmixer_cmd_t cmd={
+		.id=id,
+		.cmd=CMD_QUEUE_MOD_SEEKABLE,
+		.queue_file_start=mod_start,
+		.queue_file_end=mod_end,
+		.flags=CHFL_PAUSED
+	};
+	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
+	return id;
+}
+
+int sndmixer_queue_qoa(const void *qoa_start, const void *qoa_end) {
+	int id=new_id();
+	sndmixer_cmd_t cmd={
+		.id=id,
+		.cmd=CMD_QUEUE_QOA,
+		.queue_file_start=qoa_start,
+		.queue_file_end=qoa_end,
+		.flags=CHFL_PAUSED
+	};
+	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
+	return id;
+}
+
+int sndmixer_queue_sfx(const sndmixer_sfx_t *sfx, int evictable) {
+	int id=new_id();
+	sndmixer_cmd_t cmd={
+		.id=id,
+		.cmd=CMD_QUEUE_SFX,
+		.queue_file_start=sfx,
+		.queue_file_end=sfx+1,
+		.flags=CHFL_PAUSED|(evictable?CHFL_EVICTABLE:0)
+	};
+	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
+	return id;
+}
+
+int sndmixer_get_mod_memory_usage(const void *mod_start, const void *mod_end) {
+	return mod_calculate_memory_usage(mod_start, mod_end, samplerate);
+}
+
 void sndmixer_set_loop(int id, int do_loop) {
 	sndmixer_cmd_t cmd={
 		.cmd=CMD_LOOP,
@@ -281,6 +430,15 @@ void sndmixer_set_volume(int id, int volume) {
 	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
 }
 
+void sndmixer_seek(int id, int ms) {
+	sndmixer_cmd_t cmd={
+		.cmd=CMD_SEEK,
+		.id=id,
+		.param=ms
+	};
+	xQueueSend(cmd_queue, &cmd, portMAX_DELAY);
+}
+
 void sndmixer_play(int id) {
 	sndmixer_cmd_t cmd={
 		.cmd=CMD_PLAY,
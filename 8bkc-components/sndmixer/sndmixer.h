@@ -10,7 +10,8 @@ extern "C" {
  * @brief Structure describing a sound source
  */
 typedef struct {
-	/*! Initialize the sound source. Returns size of data returned per call of fill_buffer. */
+	/*! Initialize the sound source. Returns size of data returned per call of fill_buffer. Sources that implement
+	    mix_buffer only need to return a positive value on success. */
 	int (*init_source)(const void *data_start, const void *data_end, int req_sample_rate, void **ctx);
 	/*! Get the actual sample rate at which the source returns data */
 	int (*get_sample_rate)(void *ctx);
@@ -18,8 +19,50 @@ typedef struct {
 	int (*fill_buffer)(void *ctx, int8_t *buffer);
 	/*! Destroy source, free resources */
 	void (*deinit_source)(void *ctx);
+	/*! Optional. If not NULL, the mixer does not allocate a chunk buffer or call fill_buffer, but has the source add len
+	    samples at the mixer sample rate directly to the accumulator acc. A sample value s in the -128..127 range at volume
+	    vol (0-256) should add s*vol. Returns the amount of samples mixed; less than len when the source has ended. */
+	int (*mix_buffer)(void *ctx, int *acc, int len, int volume);
+	/*! Optional. Seek to about ms milliseconds from the start. Returns the position reached, in milliseconds. */
+	int (*seek)(void *ctx, int ms);
 } sndmixer_source_t;
 
+/**
+ * @brief Waveforms for synthesized sound effects
+ */
+typedef enum {
+	SNDMIXER_SFX_SQUARE=0,	/*!< Square wave, with variable duty cycle */
+	SNDMIXER_SFX_SAW,		/*!< Sawtooth wave */
+	SNDMIXER_SFX_NOISE,		/*!< White noise; the frequency sets how often a new random value is picked */
+} sndmixer_sfx_wave_t;
+
+/**
+ * @brief Parameters for a synthesized sound effect, as played by sndmixer_queue_sfx
+ *
+ * This is modelled on sfxr: an oscillator with a pitch sweep, running through an attack-sustain-decay
+ * envelope. The effect ends when the envelope is done, or when the pitch slides below freq_limit.
+ * All-zero fields disable the corresponding feature.
+ */
+typedef struct {
+	uint8_t wave;			/*!< Waveform, one of sndmixer_sfx_wave_t */
+	uint8_t volume;			/*!< Volume, 0-255 */
+	uint8_t duty;			/*!< Square wave duty cycle, 0-255. 128 is a 50% duty cycle. */
+	int8_t duty_sweep;		/*!< Change in duty cycle per 100mS */
+	uint16_t freq;			/*!< Start frequency, in Hz */
+	uint16_t freq_limit;	/*!< Effect stops when the frequency slides below this, in Hz */
+	int16_t slide;			/*!< Frequency slide, in Hz per second */
+	int16_t slide_accel;	/*!< Change in frequency slide, in Hz per second per second */
+	uint16_t attack;		/*!< Attack time in mS: volume ramps up from 0 */
+	uint16_t sustain;		/*!< Sustain time in mS: volume stays at max */
+	uint16_t decay;			/*!< Decay time in mS: volume ramps down to 0 */
+	uint8_t punch;			/*!< Extra volume at the start of sustain, fading out during sustain. 255 is twice as loud. */
+	uint8_t vibrato_depth;	/*!< Vibrato depth; 255 is about 25% of the frequency */
+	uint16_t vibrato_speed;	/*!< Vibrato speed, in 0.1Hz */
+	uint16_t arp_time;		/*!< Time after start (or repeat) when the frequency jumps by arp_mult, in mS */
+	uint16_t arp_mult;		/*!< Frequency multiplier for the arpeggio jump, in 8.8 fixed point (256 = no change) */
+	uint16_t repeat;		/*!< If not 0, the frequency, slide, duty and arpeggio restart every this many mS */
+} sndmixer_sfx_t;
+
 /**
  * @brief Initialize the sound mixer
  *
@@ -31,6 +74,14 @@ typedef struct {
  */
 int sndmixer_init(int no_channels, int samplerate);
 
+/**
+ * @brief De-initialize the sound mixer
+ *
+ * Stops and frees all sounds, ends the mixer task and frees its resources, and shuts down the sound
+ * subsystem using kchal_sound_stop. Call sndmixer_init again to use the mixer afterwards.
+ */
+void sndmixer_deinit();
+
 /**
  * @brief Queue the data of a .wav file to be played
  *
@@ -55,6 +106,63 @@ int sndmixer_queue_wav(const void *wav_start, const void *wav_end, int evictable
  */
 int sndmixer_queue_mod(const void *mod_start, const void *mod_end);
 
+/**
+ * @brief Queue the data of a .mod/.xm/.s3m file to be played, and make seeking in it fast
+ *
+ * Same as sndmixer_queue_mod, but also builds a seek index for the module, so sndmixer_seek only has to simulate
+ * a few patterns instead of the song up to the position sought to. Building the index plays through the song
+ * once (without mixing), so this takes a while; best do it while loading a level. The index takes roughly
+ * (song length in patterns / 8) * channels * 250 bytes of heap, on top of what sndmixer_get_mod_memory_usage returns.
+ *
+ * @param mod_start Start of the filedata
+ * @param mod_end End of the filedata
+ * @return The ID of the queued sound, for use with the other functions.
+ */
+int sndmixer_queue_mod_seekable(const void *mod_start, const void *mod_end);
+
+/**
+ * @brief Queue the data of a .qoa file to be played
+ *
+ * This queues a QOA ('Quite OK Audio') compressed file to be played. It will not be actually played until sndmixer_play is called.
+ * QOA compresses 16-bit audio to about 3.2 bits per sample and is cheap to decode, making it a good choice for music that
+ * isn't available as a module. Files with more than one channel are mixed down to mono.
+ *
+ * @param qoa_start Start of the filedata
+ * @param qoa_end End of the filedata
+ * @return The ID of the queued sound, for use with the other functions.
+ */
+int sndmixer_queue_qoa(const void *qoa_start, const void *qoa_end);
+
+/**
+ * @brief Queue a synthesized sound effect to be played
+ *
+ * This queues a sound effect that is generated on the fly from a small set of parameters, rather than
+ * decoded from sample data. It will not be actually played until sndmixer_play is called.
+ *
+ * @note The parameters are not copied; they need to stay valid until the effect is done playing. Normally,
+ *       they are simply a const variable.
+ *
+ * @param sfx Parameters of the effect
+ * @param evictable If true, if all audio channels are filled and a new sound is queued, this
+ *                  sound can be stopped to make room for the new sound.
+ * @return The ID of the queued sound, for use with the other functions.
+ */
+int sndmixer_queue_sfx(const sndmixer_sfx_t *sfx, int evictable);
+
+/**
+ * @brief Calculate how much memory playing a .mod/.xm/.s3m file needs
+ *
+ * This only parses the headers of the module; nothing is allocated. Sample and pattern data are used
+ * in place from the file data, so this is mostly the size of the instrument, channel and play state
+ * structures. Call this after sndmixer_init, as the size of the render buffer depends on the sample rate.
+ *
+ * @param mod_start Start of the filedata
+ * @param mod_end End of the filedata
+ * @return The amount of heap memory, in bytes, sndmixer_queue_mod would allocate for this file, or -1 if
+ *         the file is not a recognized module.
+ */
+int sndmixer_get_mod_memory_usage(const void *mod_start, const void *mod_end);
+
 /**
  * @brief Set or unset a sound to looping mode
  *
@@ -76,6 +184,19 @@ void sndmixer_set_loop(int id, int loop);
  */
 void sndmixer_set_volume(int id, int volume);
 
+/**
+ * @brief Seek in a sound
+ *
+ * Continues playback of the sound at about the given position, for instance to resume the music of a level
+ * where it was left. Only music modules can seek; this does nothing for other sounds. Seeking in a module
+ * queued with sndmixer_queue_mod simulates the song from the start up to the position, which can take a while
+ * for positions far into a long song; use sndmixer_queue_mod_seekable to make this fast.
+ *
+ * @param id ID of the sound, obtained when queueing it
+ * @param ms Position to seek to, in milliseconds from the start of the sound
+ */
+void sndmixer_seek(int id, int ms);
+
 /**
  * @brief Play a sound
  * 
@@ -1,7 +1,7 @@
 /*
  This program converts one or multiple .tmx files (as generated by Tiled) to C includes to be used by the tilegfx
  component of the PocketSprite SDK. It is fairly limited; please refer to the documentation to read what it can and
- cannot do.
+ cannot do. With -a as the first argument, it writes a data file that tilegfx_file_open() can load from appfs instead.
 
  (And yes, this piece of code is an unstructured ball of mud. Sorry for that.)
 */
@@ -13,12 +13,29 @@
 #include <libxml/tree.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 
-FILE *cfile, *hfile;
+FILE *cfile, *hfile, *binfile; //binfile is set when writing a data file; cfile and hfile are NULL then
 char *basedir;
 char *filebase;
 int bytestotal;
 
+static void cprintf(const char *fmt, ...) {
+	if (!cfile) return;
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(cfile, fmt, ap);
+	va_end(ap);
+}
+
+static void hprintf(const char *fmt, ...) {
+	if (!hfile) return;
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(hfile, fmt, ap);
+	va_end(ap);
+}
+
 typedef struct tmx_llitem_t tmx_llitem_t;
 struct tmx_llitem_t {
 	char *tmxname;
@@ -28,6 +45,144 @@ struct tmx_llitem_t {
 
 tmx_llitem_t *tmxinfo=NULL;
 
+/*
+Data file output ('-a'). Instead of C files, everything goes into one file that tilegfx can load from appfs; see
+tilegfx_appfs.c for the format. Tilesets and maps are collected while converting and written out at the end.
+*/
+typedef struct bin_item_t bin_item_t;
+struct bin_item_t {
+	char *name;
+	int is_map;
+	//Tileset
+	int trans_col, format, tile_count, anim_frame_count, pal_len, tile_words;
+	uint8_t *masks; //NULL if none
+	uint16_t *anim_offsets, *anim_frames, *pal, *tiles;
+	uint32_t *collision[8]; //NULL for flags no tile has
+	int coll_words;
+	//Map
+	char *tileset;
+	int w, h, chunks, datalen;
+	uint32_t *index;
+	uint16_t *data;
+	bin_item_t *next;
+};
+
+bin_item_t *bin_items=NULL, *bin_items_last=NULL;
+
+static bin_item_t *bin_add(const char *name, int is_map) {
+	bin_item_t *b=calloc(1, sizeof(bin_item_t));
+	if (strlen(name)>31) {
+		fprintf(stderr, "Warning: name %s is too long for a data file; truncating to 31 characters\n", name);
+	}
+	b->name=strndup(name, 31);
+	b->is_map=is_map;
+	if (bin_items_last) {
+		bin_items_last->next=b;
+	} else {
+		bin_items=b;
+	}
+	bin_items_last=b;
+	return b;
+}
+
+typedef struct {
+	uint8_t *d;
+	int len;
+} bin_buf_t;
+
+//Appends len bytes (or zeroes if data is NULL) to the buffer, aligned to 4 bytes. Returns the offset.
+static int bin_put(bin_buf_t *b, const void *data, int len) {
+	int off=(b->len+3)&~3;
+	b->d=realloc(b->d, off+len);
+	memset(&b->d[b->len], 0, off-b->len);
+	if (data) {
+		memcpy(&b->d[off], data, len);
+	} else {
+		memset(&b->d[off], 0, len);
+	}
+	b->len=off+len;
+	return off;
+}
+
+static void put32(bin_buf_t *b, int off, uint32_t v) {
+	for (int i=0; i<4; i++) b->d[off+i]=v>>(i*8);
+}
+
+static int bin_put16(bin_buf_t *b, const uint16_t *v, int count) {
+	int off=bin_put(b, NULL, count*2);
+	for (int i=0; i<count; i++) {
+		b->d[off+i*2]=v[i];
+		b->d[off+i*2+1]=v[i]>>8;
+	}
+	return off;
+}
+
+static int write_data_file() {
+	bin_buf_t b={0}, data={0};
+	int count=0;
+	for (bin_item_t *i=bin_items; i; i=i->next) count++;
+	bin_put(&b, NULL, 20+count*40);
+	put32(&b, 0, 0x58464754); //'TGFX'
+	put32(&b, 4, 2);
+	put32(&b, 8, count);
+	int n=0;
+	for (bin_item_t *i=bin_items; i; i=i->next, n++) {
+		int e=20+n*40;
+		strcpy((char*)&b.d[e], i->name);
+		put32(&b, e+32, i->is_map);
+		if (!i->is_map) {
+			int o=bin_put(&b, NULL, 72);
+			put32(&b, e+36, o);
+			put32(&b, o, i->trans_col);
+			put32(&b, o+4, i->format);
+			put32(&b, o+8, i->tile_count);
+			put32(&b, o+12, i->anim_frame_count);
+			if (i->masks) put32(&b, o+16, bin_put(&b, i->masks, i->tile_count*8));
+			if (i->anim_frame_count) {
+				put32(&b, o+20, bin_put16(&b, i->anim_offsets, i->tile_count));
+				put32(&b, o+24, bin_put16(&b, i->anim_frames, i->anim_frame_count*2));
+			}
+			if (i->pal) {
+				put32(&b, o+28, bin_put16(&b, i->pal, i->pal_len));
+				put32(&b, o+32, i->pal_len);
+			}
+			put32(&b, o+36, bin_put16(&b, i->tiles, i->tile_count*i->tile_words));
+			for (int c=0; c<8; c++) {
+				if (!i->collision[c]) continue;
+				int co=bin_put(&b, NULL, i->coll_words*4);
+				for (int j=0; j<i->coll_words; j++) put32(&b, co+j*4, i->collision[c][j]);
+				put32(&b, o+40+c*4, co);
+			}
+		} else {
+			int ts=0;
+			for (bin_item_t *t=bin_items; t; t=t->next, ts++) {
+				if (!t->is_map && strcmp(t->name, i->tileset)==0) break;
+			}
+			int o=bin_put(&b, NULL, 16);
+			put32(&b, e+36, o);
+			put32(&b, o, i->w);
+			put32(&b, o+4, i->h);
+			put32(&b, o+8, ts);
+			//Chunks of all maps go into one blob, so the offsets in the index need to move up.
+			int base=bin_put16(&data, i->data, i->datalen)/2;
+			int idx=bin_put(&b, NULL, i->chunks*4);
+			for (int c=0; c<i->chunks; c++) put32(&b, idx+c*4, base+i->index[c]);
+			put32(&b, o+12, idx);
+		}
+	}
+	int data_off=bin_put(&b, NULL, 0);
+	put32(&b, 12, data_off);
+	put32(&b, 16, data.len);
+	if (fwrite(b.d, b.len, 1, binfile)!=1 || (data.len && fwrite(data.d, data.len, 1, binfile)!=1)) {
+		perror("writing data file");
+		return 0;
+	}
+	bytestotal=b.len+data.len;
+	free(b.d);
+	free(data.d);
+	return 1;
+}
+
 void conv_to_c_ident(char *str) {
 	char *p=str;
 	while (*p!=0) {
@@ -50,52 +205,234 @@ xmlNodePtr findNodeByName(xmlNodePtr parent, const xmlChar *name) {
 	return NULL;
 }
 
-int output_tileset(FILE *f, char *name, int trans_col, int has_anim) {
+//Reads tile n of the image as 64 pixels, converted to the format tilegfx uses.
+static void get_tile_pixels(gdImagePtr im, int n, uint16_t *px) {
+	int w=gdImageSX(im)/8;
+	int tx=(n%w)*8, ty=(n/w)*8;
+	for (int yy=0; yy<8; yy++) {
+		for (int xx=0; xx<8; xx++) {
+			int c=gdImageGetTrueColorPixel(im, tx+xx, ty+yy);
+			int r=gdTrueColorGetRed(c);
+			int g=gdTrueColorGetGreen(c);
+			int b=gdTrueColorGetBlue(c);
+			//Re-order for easy output to OLED
+			uint16_t rgb16=((r>>(3))<<11)+((g>>(2))<<5)+((b>>(3))<<0);
+			px[yy*8+xx]=(rgb16>>8)|((rgb16<<8)&0xff00);
+		}
+	}
+}
+
+//Outputs a byte per tile row with a bit set for every non-transparent pixel (bit 0 is the leftmost pixel), so
+//the renderer can skip empty tiles, memcpy opaque ones and copy runs of pixels for the rest. The masks are also
+//stored in masks (count*8 bytes).
+static void output_opaque_masks(gdImagePtr im, char *name, int count, int trans_col, uint8_t *masks) {
+	int opaque=0, empty=0;
+	cprintf("\nconst uint8_t %s_opaque_masks[]={", name);
+	for (int i=0; i<count; i++) {
+		uint16_t px[64];
+		get_tile_pixels(im, i, px);
+		int all=0xff, any=0;
+		cprintf("\n\t");
+		for (int yy=0; yy<8; yy++) {
+			int m=0;
+			for (int xx=0; xx<8; xx++) {
+				if (px[yy*8+xx]!=trans_col) m|=(1<<xx);
+			}
+			all&=m;
+			any|=m;
+			masks[i*8+yy]=m;
+			cprintf("0x%02X, ", m);
+		}
+		cprintf("//tile %d: %s", i, (all==0xff)?"opaque":(any==0)?"empty":"mixed");
+		if (all==0xff) opaque++;
+		if (any==0) empty++;
+		bytestotal+=8;
+	}
+	cprintf("\n};\n");
+	printf("Tileset %s: %d opaque, %d empty, %d mixed tiles\n", name, opaque, empty, count-opaque-empty);
+}
+
+//Builds the palette for an indexed tileset. If there is a transparent color, it always gets index 0.
+//Returns the amount of colors, or -1 if there are more than max_cols.
+static int build_palette(gdImagePtr im, int count, int trans_col, uint16_t *pal, int max_cols) {
+	int ncols=0;
+	if (trans_col!=-1) pal[ncols++]=trans_col;
+	for (int i=0; i<count; i++) {
+		uint16_t px[64];
+		get_tile_pixels(im, i, px);
+		for (int j=0; j<64; j++) {
+			int k;
+			for (k=0; k<ncols; k++) {
+				if (pal[k]==px[j]) break;
+			}
+			if (k!=ncols) continue;
+			if (ncols==max_cols) return -1;
+			pal[ncols++]=px[j];
+		}
+	}
+	return ncols;
+}
+
+//Bpp is 16 for a plain RGB565 tileset, or 8 or 4 for an indexed one. Anim_frames (delay/tile pairs) and
+//anim_offsets are only used for data files; the C arrays for them are already written. Collision has a bitset
+//of coll_words words for every collision flag, or NULL if no tile has the flag.
+int output_tileset(FILE *f, char *name, int trans_col, int anim_frame_count, int bpp, uint16_t *anim_frames, uint16_t *anim_offsets,
+			uint32_t **collision, int coll_words) {
+	uint16_t pal[256];
+	int ncols=0;
 	gdImagePtr im=gdImageCreateFromPng(f);
 	if (im==NULL) goto err;
 	int h=gdImageSY(im)/8;
 	int w=gdImageSX(im)/8;
-	fprintf(hfile, "extern const tilegfx_tileset_t tileset_%s;\n", name);
-	fprintf(cfile, "\nconst tilegfx_tileset_t tileset_%s={ //%d tiles\n", name, w*h);
+	bin_item_t *b=NULL;
+	if (binfile) {
+		b=bin_add(name, 0);
+		b->tile_count=w*h;
+		b->tile_words=bpp*4;
+		b->tiles=malloc(w*h*bpp*8);
+		b->anim_frame_count=anim_frame_count;
+		b->anim_frames=anim_frames;
+		b->anim_offsets=anim_offsets;
+		b->format=(bpp==16)?0:(bpp==8)?1:2; //tilegfx_format_t
+	}
+	//The collision bitsets go with the amount of tiles in the image, which can differ from the tile count in Tiled.
+	int tile_coll_words=(w*h+31)/32;
+	for (int i=0; i<8; i++) {
+		if (!collision[i]) continue;
+		uint32_t *c=calloc(tile_coll_words, 4);
+		memcpy(c, collision[i], ((coll_words<tile_coll_words)?coll_words:tile_coll_words)*4);
+		cprintf("\nconst uint32_t %s_collision_%d[]={", name, i);
+		for (int j=0; j<tile_coll_words; j++) {
+			if ((j&7)==0) cprintf("\n\t");
+			cprintf("0x%08X, ", c[j]);
+			bytestotal+=4;
+		}
+		cprintf("\n};\n");
+		if (b) {
+			b->collision[i]=c;
+			b->coll_words=tile_coll_words;
+		} else {
+			free(c);
+		}
+	}
+	if (bpp!=16) {
+		ncols=build_palette(im, w*h, trans_col, pal, 1<<bpp);
+		if (ncols<0) {
+			fprintf(stderr, "Tileset %s has more than %d colors; can't store it as %dbpp.\n", name, 1<<bpp, bpp);
+			goto err;
+		}
+		printf("Tileset %s: %d colors, stored as %dbpp\n", name, ncols, bpp);
+		//The palette is in RAM, so the program can modify it.
+		cprintf("\nuint16_t %s_palette[%d]={", name, 1<<bpp);
+		for (int i=0; i<ncols; i++) {
+			if ((i&7)==0) cprintf("\n\t");
+			cprintf("0x%04X, ", pal[i]);
+		}
+		cprintf("\n};\n");
+	}
+	if (b && bpp!=16) {
+		b->pal=malloc(ncols*2);
+		memcpy(b->pal, pal, ncols*2);
+		b->pal_len=ncols;
+	}
+	if (trans_col!=-1) {
+		uint8_t *masks=malloc(w*h*8);
+		output_opaque_masks(im, name, w*h, trans_col, masks);
+		if (b) {
+			b->masks=masks;
+		} else {
+			free(masks);
+		}
+	}
+	//For indexed tilesets, the transparent color is always palette entry 0.
+	if (b) b->trans_col=(trans_col==-1)?-1:(bpp==16)?trans_col:0;
+	hprintf("extern const tilegfx_tileset_t tileset_%s;\n", name);
+	cprintf("\nconst tilegfx_tileset_t tileset_%s={ //%d tiles\n", name, w*h);
 	if (trans_col==-1) {
-		fprintf(cfile, "\t.trans_col=-1, //No transparency\n");
+		cprintf("\t.trans_col=-1, //No transparency\n");
+		cprintf("\t.opaque_masks=NULL,\n");
+	} else {
+		//For indexed tilesets, the transparent color is always palette entry 0.
+		cprintf("\t.trans_col=0x%04X,\n", (bpp==16)?trans_col:0);
+		cprintf("\t.opaque_masks=%s_opaque_masks,\n", name);
+	}
+	if (anim_frame_count) {
+		cprintf("\t.anim_offsets=%s_anim_offsets,\n", name);
+		cprintf("\t.anim_frames=%s_anim_frames,\n", name);
 	} else {
-		fprintf(cfile, "\t.trans_col=0x%04X,\n", trans_col);
+		cprintf("\t.anim_offsets=NULL,\n");
+		cprintf("\t.anim_frames=NULL,\n");
 	}
-	if (has_anim) {
-		fprintf(cfile, "\t.anim_offsets=%s_anim_offsets,\n", name);
-		fprintf(cfile, "\t.anim_frames=%s_anim_frames,\n", name);
+	cprintf("\t.anim_frame_count=%d,\n", anim_frame_count);
+	if (bpp==16) {
+		cprintf("\t.format=TILEGFX_FORMAT_RGB565,\n");
 	} else {
-		fprintf(cfile, "\t.anim_offsets=NULL,\n");
-		fprintf(cfile, "\t.anim_frames=NULL,\n");
-	}
-	fprintf(cfile, "\t.tile={");
-	for (int y=0; y<h; y++) {
-		for (int x=0; x<w; x++) {
-			fprintf(cfile, "\n\t\t");
-			for (int yy=0; yy<8; yy++) {
-				for (int xx=0; xx<8; xx++) {
-					int c=gdImageGetTrueColorPixel(im, x*8+xx, y*8+yy);
-					int r=gdTrueColorGetRed(c);
-					int g=gdTrueColorGetGreen(c);
-					int b=gdTrueColorGetBlue(c);
-					//Re-order for easy output to OLED
-					uint16_t rgb16=((r>>(3))<<11)+((g>>(2))<<5)+((b>>(3))<<0);
-					fprintf(cfile, "0x%04X, ", (rgb16>>8)|((rgb16<<8)&0xff00));
-					bytestotal+=2;
+		cprintf("\t.format=TILEGFX_FORMAT_INDEXED%d,\n", bpp);
+		cprintf("\t.palette=%s_palette,\n", name);
+	}
+	for (int i=0; i<8; i++) {
+		if (collision[i]) cprintf("\t.collision[%d]=%s_collision_%d,\n", i, name, i);
+	}
+	cprintf("\t.tile={");
+	for (int i=0; i<w*h; i++) {
+		uint16_t px[64];
+		get_tile_pixels(im, i, px);
+		cprintf("\n\t\t");
+		if (bpp==16) {
+			for (int j=0; j<64; j++) {
+				cprintf("0x%04X, ", px[j]);
+				if (b) b->tiles[i*64+j]=px[j];
+				bytestotal+=2;
+			}
+		} else {
+			//Convert to palette indexes, and pack them into the 16-bit words of the tile array so that in memory
+			//(which is little-endian), the first pixel comes first. At 4bpp, the first pixel is in the lower nibble.
+			uint8_t bytes[64]={0};
+			for (int j=0; j<64; j++) {
+				int k=0;
+				while (pal[k]!=px[j]) k++;
+				if (bpp==8) {
+					bytes[j]=k;
+				} else {
+					bytes[j/2]|=k<<((j&1)*4);
 				}
 			}
+			for (int j=0; j<bpp*8; j+=2) {
+				cprintf("0x%04X, ", bytes[j]|(bytes[j+1]<<8));
+				if (b) b->tiles[i*bpp*4+j/2]=bytes[j]|(bytes[j+1]<<8);
+				bytestotal+=2;
+			}
 		}
 	}
-	fprintf(cfile, "\n\t}\n};\n");
+	cprintf("\n\t}\n};\n");
+	gdImageDestroy(im);
 	return 1;
 err:
 	fprintf(stderr, "Error outputing tileset for %s\n", name);
 	return 0;
 }
 
+//Returns the value of a custom property (as set in Tiled) of a node, or NULL if it does not have it.
+static char *get_custom_property(xmlNode *node, const char *name) {
+	xmlNode *props=findNodeByName(node, "properties");
+	if (props==NULL) return NULL;
+	for (xmlNode *p=props->children; p!=NULL; p=p->next) {
+		if (xmlStrcmp(p->name, "property")) continue;
+		char *pname=xmlGetProp(p, "name");
+		if (pname && strcmp(pname, name)==0) return xmlGetProp(p, "value");
+	}
+	return NULL;
+}
+
 static int load_tileset_ext(char *filename, char *designator, char **name);
 
+static uint16_t *add_anim_frame(uint16_t *frames, int n, int delay, int tile) {
+	frames=realloc(frames, (n+1)*4);
+	frames[n*2]=delay;
+	frames[n*2+1]=tile;
+	return frames;
+}
+
 
 int load_tileset(xmlNode *tileset, char *designator, char **name) {
 	int ret;
@@ -151,20 +488,50 @@ int load_tileset(xmlNode *tileset, char *designator, char **name) {
 		trans_col=((trans_col<<8)|(trans_col>>8))&0xffff;
 	}
 	
+	//Tiles can be stored as indexed colors by giving the tileset a 'format' property of '4bpp' or '8bpp'.
+	int bpp=16;
+	char *format=get_custom_property(tileset, "format");
+	if (format) {
+		if (strcmp(format, "4bpp")==0) {
+			bpp=4;
+		} else if (strcmp(format, "8bpp")==0) {
+			bpp=8;
+		} else if (strcmp(format, "rgb565")!=0) {
+			fprintf(stderr, "%s: Unknown tileset format %s\n", designator, format);
+			goto err;
+		}
+	}
+
 	//Output animation frames if any
 	uint16_t *animatedTiles=malloc(count*2);
 	memset(animatedTiles, 0xff, count*2);
+	uint16_t *animFrames=NULL; //delay/tile pairs, for data files
+	uint32_t *collision[8]={NULL}; //bitset of tiles for every collision flag
 	xmlNodePtr node=tileset->children;
 	int animFrCt=0;
 	while (node) {
 		if (!xmlStrcmp(node->name, "tile")) {
 			char *atid=xmlGetProp(node, "id");
+			//A 'collision' property on a tile gives its collision flags, as a bitmap.
+			char *coll=get_custom_property(node, "collision");
+			if (coll && atid && atoi(atid)<count) {
+				int flags=atoi(coll);
+				if (flags<0 || flags>255) {
+					fprintf(stderr, "%s: tile %s: collision flags need to be between 0 and 255\n", designator, atid);
+					goto err;
+				}
+				for (int i=0; i<8; i++) {
+					if (!(flags&(1<<i))) continue;
+					if (!collision[i]) collision[i]=calloc((count+31)/32, 4);
+					collision[i][atoi(atid)/32]|=(1U<<(atoi(atid)&31));
+				}
+			}
 			xmlNodePtr anim=findNodeByName(node, "animation");
 			if (anim) {
 				xmlNodePtr frame=anim->children;
 				if (frame) {
 					int totalDuration=0;
-					if (animFrCt==0) fprintf(cfile, "\nconst tilegfx_anim_frame_t %s_anim_frames[]={\n", *name);
+					if (animFrCt==0) cprintf("\nconst tilegfx_anim_frame_t %s_anim_frames[]={\n", *name);
 					while(frame) {
 						if (!xmlStrcmp(frame->name, "frame")) {
 							char *dur=xmlGetProp(frame, "duration");
@@ -173,7 +540,8 @@ int load_tileset(xmlNode *tileset, char *designator, char **name) {
 						frame=frame->next;
 					}
 					animatedTiles[atoi(atid)]=animFrCt;
-					fprintf(cfile, "\t{%d, 0xffff}, ", totalDuration);
+					cprintf("\t{%d, 0xffff}, ", totalDuration);
+					animFrames=add_anim_frame(animFrames, animFrCt, totalDuration, 0xffff);
 					animFrCt++;
 					frame=anim->children;
 					while(frame) {
@@ -181,31 +549,31 @@ int load_tileset(xmlNode *tileset, char *designator, char **name) {
 							char *dur=xmlGetProp(frame, "duration");
 							char *tid=xmlGetProp(frame, "tileid");
 							if (!dur || !tid) break;
-							fprintf(cfile, "{%d, %d}, ", atoi(dur), atoi(tid));
+							cprintf("{%d, %d}, ", atoi(dur), atoi(tid));
+							animFrames=add_anim_frame(animFrames, animFrCt, atoi(dur), atoi(tid));
 							animFrCt++;
 						}
 						frame=frame->next;
 					}
-					fprintf(cfile, " //tile %d\n", atoi(atid)-1);
+					cprintf(" //tile %d\n", atoi(atid)-1);
 				}
 			}
 		}
 		node=node->next;
 	}
 	if (animFrCt!=0) {
-		fprintf(cfile, "};\n");
-		fprintf(cfile, "\nconst uint16_t %s_anim_offsets[]={", *name);
+		cprintf("};\n");
+		cprintf("\nconst uint16_t %s_anim_offsets[]={", *name);
 		for (int i=0; i<count; i++) {
-			if ((i&7)==0) fprintf(cfile, "\n\t");
+			if ((i&7)==0) cprintf("\n\t");
 			if (animatedTiles[i]==0xffff) {
-				fprintf(cfile, "0xffff, ");
+				cprintf("0xffff, ");
 			} else {
-				fprintf(cfile, "% 6d, ", animatedTiles[i]);
+				cprintf("% 6d, ", animatedTiles[i]);
 			};
 		}
-		fprintf(cfile, "};\n");
+		cprintf("};\n");
 	}
-	free(animatedTiles);
 
 	char *imgfile=malloc(strlen(basedir)+strlen(src)+2);
 	sprintf(imgfile, "%s%s", basedir, src);
@@ -215,8 +583,13 @@ int load_tileset(xmlNode *tileset, char *designator, char **name) {
 		goto err;
 	}
 	free(imgfile);
-	ret=output_tileset(f, *name, trans_col, animFrCt!=0);
+	ret=output_tileset(f, *name, trans_col, animFrCt, bpp, animFrames, animatedTiles, collision, (count+31)/32);
 	fclose(f);
+	for (int i=0; i<8; i++) free(collision[i]);
+	if (!binfile) {
+		free(animFrames);
+		free(animatedTiles);
+	}
 	return ret;
 err:
 	if (*name) free(*name);
@@ -253,10 +626,109 @@ err:
 	return 0;
 }
 
+#define CHUNK_SIZE 8 //TILEGFX_CHUNK_SIZE
+#define CHUNK_TILES (CHUNK_SIZE*CHUNK_SIZE)
+
+//Run-length encodes the tiles of one chunk as described at tilegfx_map_chunks_t. Returns the amount of words
+//written to out, which needs space for CHUNK_TILES+1 words.
+static int encode_chunk(const uint16_t *t, uint16_t *out) {
+	int n=0, i=0;
+	while (i<CHUNK_TILES) {
+		int run=1;
+		while (i+run<CHUNK_TILES && t[i+run]==t[i]) run++;
+		if (run>=3) {
+			out[n++]=0x8000|run;
+			out[n++]=t[i];
+			i+=run;
+		} else {
+			//Literal tiles, up to the next run of at least 3 equal ones
+			int start=i;
+			while (i<CHUNK_TILES && !(i+2<CHUNK_TILES && t[i]==t[i+1] && t[i]==t[i+2])) i++;
+			out[n++]=i-start;
+			memcpy(&out[n], &t[start], (i-start)*2);
+			n+=i-start;
+		}
+	}
+	return n;
+}
+
+static void write_tiles(const uint16_t *tiles, int count) {
+	for (int i=0; i<count; i++) {
+		if ((i&31)==0) cprintf("\n\t\t");
+		cprintf("% 4d,", tiles[i]);
+	}
+	bytestotal+=count*2;
+}
+
+//Compresses the tiles of a map into chunks. Chunks that are the same (e.g. the empty ones) are only stored once.
+//Returns the amount of chunks; *index gets the offset of every chunk in *data, *datalen the length of that.
+static int compress_map(const char *name, const uint16_t *tiles, int w, int h, uint32_t **index, uint16_t **data, int *datalen) {
+	int cw=(w+CHUNK_SIZE-1)/CHUNK_SIZE;
+	int ch=(h+CHUNK_SIZE-1)/CHUNK_SIZE;
+	uint16_t *d=malloc(cw*ch*(CHUNK_TILES+1)*2);
+	uint32_t *idx=malloc(cw*ch*sizeof(uint32_t));
+	int *len=malloc(cw*ch*sizeof(int));
+	int dlen=0;
+	for (int n=0; n<cw*ch; n++) {
+		uint16_t t[CHUNK_TILES];
+		for (int y=0; y<CHUNK_SIZE; y++) {
+			for (int x=0; x<CHUNK_SIZE; x++) {
+				int mx=(n%cw)*CHUNK_SIZE+x;
+				int my=(n/cw)*CHUNK_SIZE+y;
+				t[y*CHUNK_SIZE+x]=(mx<w && my<h)?tiles[my*w+mx]:0xffff;
+			}
+		}
+		len[n]=encode_chunk(t, &d[dlen]);
+		idx[n]=dlen;
+		for (int i=0; i<n; i++) {
+			if (len[i]==len[n] && memcmp(&d[idx[i]], &d[dlen], len[n]*2)==0) {
+				idx[n]=idx[i];
+				break;
+			}
+		}
+		if (idx[n]==dlen) dlen+=len[n];
+	}
+	free(len);
+	*index=idx;
+	*data=d;
+	*datalen=dlen;
+	printf("%s: compressed %d map bytes to %d\n", name, w*h*2, dlen*2+cw*ch*4);
+	return cw*ch;
+}
+
+//Writes the tiles as the chunks of a compressed map, named map_[name]_chunks.
+static void write_map_chunks(const uint16_t *tiles, int w, int h, char *name) {
+	uint32_t *index;
+	uint16_t *data;
+	int datalen;
+	int chunks=compress_map(name, tiles, w, h, &index, &data, &datalen);
+	cprintf("static const uint16_t map_%s_chunk_data[]={", name);
+	write_tiles(data, datalen);
+	cprintf("\n};\n");
+	cprintf("static const uint32_t map_%s_chunk_index[]={", name);
+	for (int n=0; n<chunks; n++) {
+		if ((n&15)==0) cprintf("\n\t");
+		cprintf("%d,", index[n]);
+	}
+	cprintf("\n};\n");
+	cprintf("static const tilegfx_map_chunks_t map_%s_chunks={\n", name);
+	cprintf("\t.index=map_%s_chunk_index,\n", name);
+	cprintf("\t.data=map_%s_chunk_data,\n", name);
+	cprintf("};\n");
+	bytestotal+=chunks*4;
+	free(data);
+	free(index);
+}
+
+static int is_true(char *v) {
+	return v && (strcmp(v, "true")==0 || strcmp(v, "1")==0);
+}
+
 int write_map(xmlDoc *doc, xmlNode *layer, char *file, char *designator) {
 	char *mn=xmlGetProp(layer, "name");
 	char *mh=xmlGetProp(layer, "height");
 	char *mw=xmlGetProp(layer, "width");
+	uint16_t *tiles=NULL;
 	if (mn==NULL || mh==NULL || mw==NULL) goto err;
 
 	char *name=malloc(strlen(mn)+strlen(filebase)+2);
@@ -268,13 +740,6 @@ int write_map(xmlDoc *doc, xmlNode *layer, char *file, char *designator) {
 
 	int h=atoi(mh);
 	int w=atoi(mw);
-	fprintf(hfile, "extern const tilegfx_map_t map_%s;\n", name);
-	fprintf(cfile, "const tilegfx_map_t map_%s={\n", name);
-	fprintf(cfile, "\t.h=%d,\n", h);
-	fprintf(cfile, "\t.w=%d,\n", w);
-	fprintf(cfile, "\t.gfx=&tileset_%s,\n", i->tilename);
-	fprintf(cfile, "\t.tiles={");
-
 	xmlNode *data=findNodeByName(layer, "data");
 	if (data==NULL) goto err;
 	char *menc=xmlGetProp(data, "encoding");
@@ -282,14 +747,25 @@ int write_map(xmlDoc *doc, xmlNode *layer, char *file, char *designator) {
 		fprintf(stderr, "%s, %s:Unsupported encoding in map layer data; only support csv.\n", designator, name);
 		goto err;
 	}
+	tiles=malloc(w*h*2);
 	char *csv=xmlNodeListGetString(doc, data->xmlChildrenNode, 1);
 	char *p=csv;
 	for (int i=0; i<w*h; i++) {
-		if ((i&31)==0) fprintf(cfile, "\n\t\t");
-		int tile=atoi(p)-1; //csv is base-1 for some reason; we want base-0.
-		if (tile==-1) tile=0xffff; //tile not filled in.
-		fprintf(cfile, "% 4d,", tile);
-		bytestotal+=2;
+		//Tiled stores flipping in the upper bits of the gid: bit 31 is horizontal, 30 vertical, 29 diagonal.
+		//Bit 28 is used for hexagonal maps only.
+		uint32_t gid=strtoul(p, NULL, 10);
+		int flags=((gid>>31)&1?0x8000:0)|((gid>>30)&1?0x4000:0)|((gid>>29)&1?0x2000:0);
+		int tile=(gid&0x0FFFFFFF)-1; //csv is base-1 for some reason; we want base-0.
+		if (tile==-1) {
+			tile=0xffff; //tile not filled in.
+		} else if (tile>=0x1fff) {
+			//Tile 0x1fff with all flip bits set would be 0xffff, which means 'not filled in'.
+			fprintf(stderr, "%s, %s: tile %d out of range; tilemaps can use up to 8191 tiles\n", designator, name, tile);
+			goto err;
+		} else {
+			tile|=flags;
+		}
+		tiles[i]=tile;
 		p=strchr(p, ',');
 		if (p!=NULL && *p==',') {
 			p++; 
@@ -298,13 +774,44 @@ int write_map(xmlDoc *doc, xmlNode *layer, char *file, char *designator) {
 			goto err;
 		}
 	}
-	fprintf(cfile, "\n\t}\n};\n");
 	xmlFree(csv);
 
+	//A 'compress' property on the layer or the map stores the layer as a compressed map.
+	int compress=is_true(get_custom_property(layer, "compress")) || 
+			is_true(get_custom_property(xmlDocGetRootElement(doc), "compress"));
+	if (binfile) {
+		//Maps in data files are always compressed.
+		bin_item_t *b=bin_add(name, 1);
+		b->tileset=i->tilename;
+		b->w=w;
+		b->h=h;
+		b->chunks=compress_map(name, tiles, w, h, &b->index, &b->data, &b->datalen);
+		free(tiles);
+		free(name);
+		return 1;
+	}
+	if (compress) write_map_chunks(tiles, w, h, name);
+
+	hprintf("extern const tilegfx_map_t map_%s;\n", name);
+	cprintf("const tilegfx_map_t map_%s={\n", name);
+	cprintf("\t.h=%d,\n", h);
+	cprintf("\t.w=%d,\n", w);
+	cprintf("\t.gfx=&tileset_%s,\n", i->tilename);
+	if (compress) {
+		cprintf("\t.chunks=&map_%s_chunks,\n", name);
+	} else {
+		cprintf("\t.tiles={");
+		write_tiles(tiles, w*h);
+		cprintf("\n\t}\n");
+	}
+	cprintf("};\n");
+
+	free(tiles);
 	free(name);
 	return 1;
 err:
 	fprintf(stderr, "Error parsing layer in %s\n", designator);
+	free(tiles);
 	free(name);
 	return 0;
 }
@@ -379,22 +886,35 @@ err:
 
 int main(int argc, char **argv) {
 	bytestotal=0;
-	cfile=fopen(argv[1], "w");
-	if (cfile==NULL) {
-		perror(argv[1]);
+	if (argc<4) {
+		fprintf(stderr, "Usage: %s out.c out.h in.tmx [in2.tmx ...]\n", argv[0]);
+		fprintf(stderr, "   or: %s -a out.bin in.tmx [in2.tmx ...]\n", argv[0]);
 		exit(1);
 	}
-	fprintf(cfile, "//Auto-generated by conv_png_tile\n");
-	fprintf(cfile, "#include \"%s\"\n", argv[2]);
-	fprintf(cfile, "#define NULL ( (void *) 0)\n");
-	
-	hfile=fopen(argv[2], "w");
-	if (hfile==NULL) {
-		perror(argv[2]);
-		exit(1);
+	if (strcmp(argv[1], "-a")==0) {
+		binfile=fopen(argv[2], "wb");
+		if (binfile==NULL) {
+			perror(argv[2]);
+			exit(1);
+		}
+	} else {
+		cfile=fopen(argv[1], "w");
+		if (cfile==NULL) {
+			perror(argv[1]);
+			exit(1);
+		}
+		cprintf("//Auto-generated by conv_png_tile\n");
+		cprintf("#include \"%s\"\n", argv[2]);
+		cprintf("#define NULL ( (void *) 0)\n");
+		
+		hfile=fopen(argv[2], "w");
+		if (hfile==NULL) {
+			perror(argv[2]);
+			exit(1);
+		}
+		hprintf("//Auto-generated by conv_png_tile\n");
+		hprintf("#include \"tilegfx.h\"\n\n");
 	}
-	fprintf(hfile, "//Auto-generated by conv_png_tile\n");
-	fprintf(hfile, "#include \"tilegfx.h\"\n\n");
 	for (int i=3; i<argc; i++) {
 		int r=parse_tmx_file(argv[i], STEP_TILES);
 		if (!r) exit(1);
@@ -403,9 +923,12 @@ int main(int argc, char **argv) {
 		int r=parse_tmx_file(argv[i], STEP_MAP);
 		if (!r) exit(1);
 	}
+	if (binfile) {
+		if (!write_data_file()) exit(1);
+		fclose(binfile);
+	}
 
 	xmlCleanupParser();
 	printf("Done. Written %d map/gfx bytes (%dK)\n", bytestotal, bytestotal/1024);
 	return 0;
 }
-
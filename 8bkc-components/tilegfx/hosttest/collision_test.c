@@ -0,0 +1,225 @@
+/*
+Host test for the tilegfx collision queries. Makes a random map with random collision flags and checks collision
+maps, rectangle queries and rays against straightforward per-tile implementations. Also benchmarks rectangle
+queries against looking up every tile under the rectangle.
+
+Usage: collision_test [-b queries]
+ -b: time this many rectangle queries
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "tilegfx_collision.h"
+#include "testutil.h"
+
+#define NTILES 40
+#define MAP_W 70
+#define MAP_H 45
+
+static uint32_t rng_state=0x7F4A7C15;
+
+static uint32_t rng(uint32_t max) {
+	rng_state^=rng_state<<13;
+	rng_state^=rng_state>>17;
+	rng_state^=rng_state<<5;
+	return rng_state%max;
+}
+
+static uint8_t tile_flags[NTILES];
+
+//Tileset without graphics; only the collision bitsets matter here. Flag 1 is not used by any tile.
+static tilegfx_tileset_t *make_tileset() {
+	tilegfx_tileset_t *ts=calloc(1, sizeof(tilegfx_tileset_t));
+	for (int i=0; i<NTILES; i++) {
+		tile_flags[i]=rng(256)&~2;
+		if (rng(3)==0) tile_flags[i]=0;
+	}
+	for (int f=0; f<TILEGFX_COLLISION_FLAGS; f++) {
+		if (f==1) continue;
+		uint32_t *c=calloc((NTILES+31)/32, 4);
+		for (int i=0; i<NTILES; i++) {
+			if (tile_flags[i]&(1<<f)) c[i/32]|=(1U<<(i&31));
+		}
+		ts->collision[f]=c;
+	}
+	return ts;
+}
+
+static tilegfx_map_t *make_map(const tilegfx_tileset_t *ts) {
+	tilegfx_map_t *map=calloc(1, sizeof(tilegfx_map_t)+MAP_W*MAP_H*2);
+	map->w=MAP_W;
+	map->h=MAP_H;
+	map->gfx=ts;
+	for (int i=0; i<MAP_W*MAP_H; i++) {
+		//Mostly empty, like a level is
+		uint16_t t=0xffff;
+		if (rng(5)==0) {
+			t=rng(NTILES);
+			t|=rng(8)<<13;
+		}
+		tilegfx_set_tile(map, i%MAP_W, i/MAP_W, t);
+	}
+	return map;
+}
+
+static uint8_t ref_flags(const tilegfx_map_t *map, int x, int y) {
+	if (x<0 || y<0 || x>=map->w || y>=map->h) return 0;
+	uint16_t t=tilegfx_get_tile(map, x, y);
+	if (t==0xffff) return 0;
+	return tile_flags[t&TILEGFX_TILE_IDX_MASK];
+}
+
+static int ref_rect(const tilegfx_map_t *map, uint8_t flags, int x, int y, int w, int h) {
+	for (int py=y; py<y+h; py++) {
+		for (int px=x; px<x+w; px++) {
+			if (ref_flags(map, (int)floor(px/8.0), (int)floor(py/8.0))&flags) return 1;
+		}
+	}
+	return 0;
+}
+
+//Where the ray from pixel center (x0,y0) to (x1,y1) is inside tile (tx,ty), as fractions of the ray. Returns 0
+//if it does not go through the tile.
+static int ray_in_tile(int x0, int y0, int x1, int y1, int tx, int ty, double *tin, double *tout) {
+	double p[2]={x0+0.5, y0+0.5}, d[2]={x1-x0, y1-y0};
+	double lo[2]={tx*8, ty*8};
+	double a=0, b=1;
+	for (int i=0; i<2; i++) {
+		if (d[i]==0) {
+			if (p[i]<lo[i] || p[i]>=lo[i]+8) return 0;
+			continue;
+		}
+		double t0=(lo[i]-p[i])/d[i], t1=(lo[i]+8-p[i])/d[i];
+		if (t0>t1) {
+			double t=t0;
+			t0=t1;
+			t1=t;
+		}
+		if (t0>a) a=t0;
+		if (t1<b) b=t1;
+	}
+	*tin=a;
+	*tout=b;
+	return a<=b;
+}
+
+//Checks a ray result: a hit needs to be on a colliding tile on the ray, with no colliding tile before it. No hit
+//means the ray doesn't really go through any colliding tile. Touching the corner of one doesn't count.
+static int check_ray(const tilegfx_map_t *map, uint8_t flags, int x0, int y0, int x1, int y1, int hit, int hx, int hy) {
+	const double eps=1e-9;
+	double hit_in=2, tin, tout;
+	if (hit) {
+		if (!(ref_flags(map, hx, hy)&flags)) return 0;
+		if (!ray_in_tile(x0, y0, x1, y1, hx, hy, &tin, &tout)) return 0;
+		hit_in=tin;
+	}
+	for (int ty=0; ty<map->h; ty++) {
+		for (int tx=0; tx<map->w; tx++) {
+			if (!(ref_flags(map, tx, ty)&flags)) continue;
+			if (!ray_in_tile(x0, y0, x1, y1, tx, ty, &tin, &tout)) continue;
+			if (tout-tin<eps && !(x0==x1 && y0==y1)) continue;
+			if (tin<hit_in-eps) return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	int bench=0;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-b")==0 && i+1<argc) {
+			bench=atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "Usage: %s [-b queries]\n", argv[0]);
+			return 1;
+		}
+	}
+	tilegfx_tileset_t *ts=make_tileset();
+	tilegfx_map_t *map=make_map(ts);
+	const uint8_t flag_sets[]={0x01, 0x02, 0x05, 0xff};
+	int ok=1;
+	for (int fs=0; fs<sizeof(flag_sets); fs++) {
+		uint8_t flags=flag_sets[fs];
+		tilegfx_collision_map_t *cmap=tilegfx_create_collision_map(map, flags);
+		int bad_map=0, bad_rect=0, bad_ray=0, hits=0;
+		for (int y=-1; y<=MAP_H; y++) {
+			for (int x=-1; x<=MAP_W; x++) {
+				if (tilegfx_get_tile_collision(map, x, y)!=ref_flags(map, x, y)) bad_map++;
+				if (tilegfx_collision_at(cmap, x, y)!=((ref_flags(map, x, y)&flags)!=0)) bad_map++;
+			}
+		}
+		for (int i=0; i<3000; i++) {
+			int x=rng(MAP_W*8+80)-40, y=rng(MAP_H*8+80)-40;
+			int w=rng(i<1000?24:300), h=rng(i<1000?24:100);
+			int r=tilegfx_collision_rect(cmap, x, y, w, h);
+			if (r!=ref_rect(map, flags, x, y, w, h)) bad_rect++;
+			hits+=r;
+		}
+		for (int i=0; i<2000; i++) {
+			int x0=rng(MAP_W*8+40)-20, y0=rng(MAP_H*8+40)-20;
+			int x1, y1;
+			if (i%4==0) {
+				//Straight lines, and lines through tile corners
+				x1=(i&4)?x0:x0+rng(200)-100;
+				y1=(i&4)?y0+rng(200)-100:y0+(x1-x0);
+			} else {
+				x1=x0+rng(300)-150;
+				y1=y0+rng(300)-150;
+			}
+			int hx=-1, hy=-1;
+			int r=tilegfx_collision_ray(cmap, x0, y0, x1, y1, &hx, &hy);
+			if (!check_ray(map, flags, x0, y0, x1, y1, r, hx, hy)) bad_ray++;
+		}
+		printf("flags %02x: %d rect hits, map %s, rects %s, rays %s\n", flags, hits,
+				bad_map?"DIFFERS":"OK", bad_rect?"DIFFER":"OK", bad_ray?"DIFFER":"OK");
+		if (bad_map || bad_rect || bad_ray) ok=0;
+
+		//Change the map and update the changed part; should be the same as a new collision map.
+		tilegfx_map_t *m2=tilegfx_dup_tilemap(map);
+		for (int i=0; i<50; i++) tilegfx_set_tile(m2, 10+rng(20), 5+rng(8), (i&1)?0xffff:rng(NTILES));
+		tilegfx_update_collision_map(cmap, m2, 10, 5, 20, 8);
+		tilegfx_collision_map_t *cmap2=tilegfx_create_collision_map(m2, flags);
+		if (memcmp(cmap->bits, cmap2->bits, cmap->stride*cmap->h*4)!=0) {
+			printf("flags %02x: updated collision map DIFFERS\n", flags);
+			ok=0;
+		}
+		tilegfx_destroy_collision_map(cmap2);
+		tilegfx_destroy_tilemap(m2);
+		tilegfx_destroy_collision_map(cmap);
+	}
+
+	if (bench) {
+		//An entity of 16x16 pixels moving around, checked every step
+		tilegfx_collision_map_t *cmap=tilegfx_create_collision_map(map, 0x01);
+		int *pos=malloc(bench*2*sizeof(int));
+		for (int i=0; i<bench; i++) {
+			pos[i*2]=rng(MAP_W*8);
+			pos[i*2+1]=rng(MAP_H*8);
+		}
+		int n=0;
+		double t=now_ns();
+		for (int i=0; i<bench; i++) n+=tilegfx_collision_rect(cmap, pos[i*2], pos[i*2+1], 16, 16);
+		double t2=now_ns();
+		int m=0;
+		for (int i=0; i<bench; i++) {
+			int x=pos[i*2], y=pos[i*2+1], hit=0;
+			for (int ty=y/8; ty<=(y+15)/8 && !hit; ty++) {
+				for (int tx=x/8; tx<=(x+15)/8 && !hit; tx++) {
+					if (tilegfx_get_tile_collision(map, tx, ty)&0x01) hit=1;
+				}
+			}
+			m+=hit;
+		}
+		double t3=now_ns();
+		printf("rect 16x16  %6.1f ns/query (%d hits)\n", (t2-t)/bench, n);
+		printf("rect 16x16  %6.1f ns/query (per-tile lookup, %d hits)\n", (t3-t2)/bench, m);
+		free(pos);
+		tilegfx_destroy_collision_map(cmap);
+	}
+	tilegfx_destroy_tilemap(map);
+	for (int f=0; f<TILEGFX_COLLISION_FLAGS; f++) free((void*)ts->collision[f]);
+	free(ts);
+	return ok?0:1;
+}
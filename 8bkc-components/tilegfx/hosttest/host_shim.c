@@ -0,0 +1,369 @@
+/*
+Host implementations of the HAL, esp_timer, FreeRTOS and appfs calls tilegfx uses. The OLED is a buffer, time only
+moves when the test sets it, tasks, queues and semaphores are pthreads, mutexes and condition variables, and appfs
+files are buffers in memory.
+*/
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_shim.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "appfs.h"
+
+uint16_t host_screen[KC_SCREEN_W*KC_SCREEN_H];
+long host_bytes_sent;
+
+void kchal_send_fb(const uint16_t *fb) {
+	memcpy(host_screen, fb, sizeof(host_screen));
+	host_bytes_sent+=sizeof(host_screen);
+}
+
+void kchal_send_fb_partial(const uint16_t *fb, int x, int y, int h, int w) {
+	if (x<0 || y<0 || w<=0 || h<=0 || x+w>KC_SCREEN_W || y+h>KC_SCREEN_H) {
+		fprintf(stderr, "kchal_send_fb_partial: bad rect %d,%d %dx%d\n", x, y, w, h);
+		abort();
+	}
+	for (int i=0; i<h; i++) memcpy(&host_screen[(y+i)*KC_SCREEN_W+x], &fb[i*w], w*2);
+	host_bytes_sent+=w*h*2;
+}
+
+/* esp_timer */
+
+#define MAX_TIMERS 4
+
+typedef struct {
+	esp_timer_create_args_t args;
+	int running;
+} host_timer_t;
+
+static host_timer_t timers[MAX_TIMERS];
+static int64_t now_us;
+
+void host_set_time(int64_t us) {
+	now_us=us;
+}
+
+void host_vblank() {
+	for (int i=0; i<MAX_TIMERS; i++) {
+		if (timers[i].args.callback && timers[i].running) timers[i].args.callback(timers[i].args.arg);
+	}
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+	for (int i=0; i<MAX_TIMERS; i++) {
+		if (timers[i].args.callback==NULL) {
+			timers[i].args=*args;
+			timers[i].running=0;
+			*handle=&timers[i];
+			return ESP_OK;
+		}
+	}
+	return ESP_FAIL;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t handle, uint64_t period_us) {
+	((host_timer_t*)handle)->running=1;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t handle) {
+	((host_timer_t*)handle)->running=0;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t handle) {
+	memset(handle, 0, sizeof(host_timer_t));
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+	return now_us;
+}
+
+/* FreeRTOS. Semaphores are queues without data, as in FreeRTOS itself. */
+
+struct host_queue_t;
+
+//What a task is doing, for host_wait_idle
+typedef struct {
+	int alive;
+	struct host_queue_t *wait_q; //queue the task waits on, or NULL if it's running
+	int wait_send; //1 if it waits for room in wait_q, 0 if for an item
+} task_state_t;
+
+#define MAX_TASKS 8
+
+static pthread_mutex_t state_mux=PTHREAD_MUTEX_INITIALIZER;
+static task_state_t task_state[MAX_TASKS];
+static __thread task_state_t *my_state; //NULL in the main thread
+static long wakeups;
+
+static void set_waiting(struct host_queue_t *q, int send) {
+	if (!my_state) return;
+	pthread_mutex_lock(&state_mux);
+	my_state->wait_q=q;
+	my_state->wait_send=send;
+	if (!q) wakeups++;
+	pthread_mutex_unlock(&state_mux);
+}
+
+typedef struct host_queue_t {
+	pthread_mutex_t mux;
+	pthread_cond_t cond;
+	int len, item_size;
+	int count, head;
+	uint8_t *data;
+} host_queue_t;
+
+QueueHandle_t xQueueCreate(int len, int item_size) {
+	host_queue_t *q=calloc(sizeof(host_queue_t), 1);
+	if (!q) return NULL;
+	pthread_mutex_init(&q->mux, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	q->len=len;
+	q->item_size=item_size;
+	if (item_size) q->data=malloc(len*item_size);
+	return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t wait) {
+	host_queue_t *q=(host_queue_t*)handle;
+	pthread_mutex_lock(&q->mux);
+	while (q->count==q->len) {
+		if (wait==0) {
+			pthread_mutex_unlock(&q->mux);
+			return pdFALSE;
+		}
+		set_waiting(q, 1);
+		pthread_cond_wait(&q->cond, &q->mux);
+		set_waiting(NULL, 0);
+	}
+	if (q->item_size) memcpy(&q->data[((q->head+q->count)%q->len)*q->item_size], item, q->item_size);
+	q->count++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mux);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t wait) {
+	host_queue_t *q=(host_queue_t*)handle;
+	pthread_mutex_lock(&q->mux);
+	while (q->count==0) {
+		if (wait==0) {
+			pthread_mutex_unlock(&q->mux);
+			return pdFALSE;
+		}
+		set_waiting(q, 0);
+		pthread_cond_wait(&q->cond, &q->mux);
+		set_waiting(NULL, 0);
+	}
+	if (q->item_size) memcpy(item, &q->data[q->head*q->item_size], q->item_size);
+	q->head=(q->head+1)%q->len;
+	q->count--;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mux);
+	return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t handle) {
+	host_queue_t *q=(host_queue_t*)handle;
+	pthread_mutex_destroy(&q->mux);
+	pthread_cond_destroy(&q->cond);
+	free(q->data);
+	free(q);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+	return xQueueCreate(1, 0);
+}
+
+//A mutex is a semaphore that starts out given; good enough as tilegfx doesn't take them recursively.
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+	SemaphoreHandle_t s=xSemaphoreCreateBinary();
+	if (s) xSemaphoreGive(s);
+	return s;
+}
+
+//Semaphores have an item size of 0, so nothing is copied from or to item.
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait) {
+	uint8_t item;
+	return xQueueReceive(s, &item, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+	uint8_t item=0;
+	return xQueueSend(s, &item, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s) {
+	vQueueDelete(s);
+}
+
+void host_wait_idle() {
+	while (1) {
+		//A task counts as idle if it waits for something that isn't there. If any task woke up while checking,
+		//it may have sent something to a task that was checked already, so check again.
+		pthread_mutex_lock(&state_mux);
+		long start_wakeups=wakeups;
+		task_state_t st[MAX_TASKS];
+		memcpy(st, task_state, sizeof(st));
+		pthread_mutex_unlock(&state_mux);
+		int idle=1;
+		for (int i=0; i<MAX_TASKS && idle; i++) {
+			if (!st[i].alive) continue;
+			if (!st[i].wait_q) {
+				idle=0;
+				break;
+			}
+			host_queue_t *q=st[i].wait_q;
+			pthread_mutex_lock(&q->mux);
+			if (st[i].wait_send?(q->count<q->len):(q->count>0)) idle=0;
+			pthread_mutex_unlock(&q->mux);
+		}
+		pthread_mutex_lock(&state_mux);
+		if (wakeups!=start_wakeups) idle=0;
+		pthread_mutex_unlock(&state_mux);
+		if (idle) return;
+		usleep(50);
+	}
+}
+
+typedef struct {
+	void (*fn)(void*);
+	void *arg;
+	task_state_t *state;
+} task_start_t;
+
+static int task_count; //its address is handed out as the task handle
+
+static void task_exit() {
+	pthread_mutex_lock(&state_mux);
+	my_state->alive=0;
+	pthread_mutex_unlock(&state_mux);
+}
+
+static void *task_tramp(void *arg) {
+	task_start_t s=*(task_start_t*)arg;
+	free(arg);
+	my_state=s.state;
+	s.fn(s.arg);
+	task_exit();
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void*), const char *name, uint32_t stack, void *arg, int prio,
+			TaskHandle_t *handle, int core) {
+	task_start_t *s=malloc(sizeof(task_start_t));
+	if (!s) return pdFALSE;
+	s->fn=fn;
+	s->arg=arg;
+	s->state=NULL;
+	pthread_mutex_lock(&state_mux);
+	for (int i=0; i<MAX_TASKS; i++) {
+		if (!task_state[i].alive) {
+			s->state=&task_state[i];
+			task_state[i]=(task_state_t){.alive=1};
+			break;
+		}
+	}
+	pthread_mutex_unlock(&state_mux);
+	if (!s->state) abort();
+	pthread_t th;
+	if (pthread_create(&th, NULL, task_tramp, s)!=0) {
+		s->state->alive=0;
+		free(s);
+		return pdFALSE;
+	}
+	pthread_detach(th);
+	task_count++;
+	if (handle) *handle=&task_count;
+	return pdTRUE;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	//Tasks only ever delete themselves in tilegfx.
+	if (task==NULL) {
+		task_exit();
+		pthread_exit(NULL);
+	}
+}
+
+int xPortGetCoreID() {
+	return 0;
+}
+
+/* appfs. Every mmap gets its own copy of the data, which is freed on munmap, so the address sanitizer catches
+use of a mapping after it is unmapped. */
+
+#define MAX_FILES 4
+#define MAX_MAPS 16
+
+typedef struct {
+	const char *name;
+	const uint8_t *data;
+	int len;
+} host_file_t;
+
+static host_file_t files[MAX_FILES];
+static void *maps[MAX_MAPS];
+int host_appfs_maps;
+
+void host_appfs_add(const char *name, const void *data, int len) {
+	for (int i=0; i<MAX_FILES; i++) {
+		if (files[i].name==NULL || strcmp(files[i].name, name)==0) {
+			files[i].name=name;
+			files[i].data=data;
+			files[i].len=len;
+			return;
+		}
+	}
+	abort();
+}
+
+appfs_handle_t appfsOpen(const char *filename) {
+	for (int i=0; i<MAX_FILES; i++) {
+		if (files[i].name && strcmp(files[i].name, filename)==0) return i;
+	}
+	return APPFS_INVALID_FD;
+}
+
+void appfsClose(appfs_handle_t handle) {
+}
+
+esp_err_t appfsMmap(appfs_handle_t fd, size_t offset, size_t len, const void** out_ptr,
+									spi_flash_mmap_memory_t memory, spi_flash_mmap_handle_t* out_handle) {
+	if (offset+len > files[fd].len) return ESP_ERR_INVALID_SIZE;
+	for (int i=0; i<MAX_MAPS; i++) {
+		if (maps[i]) continue;
+		maps[i]=malloc(len);
+		memcpy(maps[i], files[fd].data+offset, len);
+		*out_ptr=maps[i];
+		*out_handle=i;
+		host_appfs_maps++;
+		return ESP_OK;
+	}
+	return ESP_FAIL;
+}
+
+void appfsMunmap(spi_flash_mmap_handle_t handle) {
+	free(maps[handle]);
+	maps[handle]=NULL;
+	host_appfs_maps--;
+}
+
+esp_err_t appfsRead(appfs_handle_t fd, size_t start, void *buf, size_t len) {
+	if (start+len > files[fd].len) return ESP_ERR_INVALID_SIZE;
+	memcpy(buf, files[fd].data+start, len);
+	return ESP_OK;
+}
+
+void appfsEntryInfo(appfs_handle_t fd, const char **name, int *size) {
+	if (name) *name=files[fd].name;
+	if (size) *size=files[fd].len;
+}
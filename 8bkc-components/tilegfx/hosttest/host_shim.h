@@ -0,0 +1,28 @@
+/*
+Controls for the host stand-ins of the HAL, esp_timer, FreeRTOS and appfs, so tilegfx can run on a PC.
+*/
+#pragma once
+#include <stdint.h>
+#include "8bkc-hal.h"
+
+//What the OLED would show: everything sent with kchal_send_fb(_partial) ends up here.
+extern uint16_t host_screen[KC_SCREEN_W*KC_SCREEN_H];
+
+//Amount of bytes sent to the 'OLED' since the start
+extern long host_bytes_sent;
+
+//Sets the time esp_timer_get_time returns, in microseconds.
+void host_set_time(int64_t us);
+
+//Fires the periodic timers, as if a period passed. Tilegfx_flush waits for this, so call it before flushing.
+void host_vblank();
+
+//Waits until every task is blocked on a queue or semaphore that nothing is sent to, e.g. until the frame handed to
+//the sender task in double-buffer mode is on the 'OLED'.
+void host_wait_idle();
+
+//Makes data available as an appfs file. Data needs to stay around.
+void host_appfs_add(const char *name, const void *data, int len);
+
+//Amount of appfs mmaps that are not unmapped yet
+extern int host_appfs_maps;
@@ -0,0 +1,761 @@
+/*
+Host test for the tilegfx renderer. Renders a number of scenarios, each a few frames long, through the normal
+tilegfx API and checks what ends up on the 'OLED' against the checksums in a golden file. Scenarios that use a
+different render mode but should give the same output as another scenario are also checked against that; the
+random scenarios run for longer, to compare partial flushes with full ones over lots of different changes.
+Also benchmarks every scenario.
+
+Usage: render_test [-g golden.txt [-u]] [-b frames] [-p prefix] [scenario...]
+ -g: check output against the checksums in this file
+ -u: write the checksums of the current output to the golden file instead
+ -b: time rendering and flushing this many frames of every scenario
+ -p: write the last frame of every scenario as prefix_<scenario>.ppm, for inspection
+ If scenario names are given, only those are run.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "tilegfx.h"
+#include "tilegfx_appfs.h"
+#include "host_shim.h"
+#include "testutil.h"
+
+#define FRAMES 8
+#define NTILES 16
+#define FRAME_US 20000
+
+/* Test graphics. Every tile is a glyph in a color, on a background. The glyphs are asymmetric, so a tile that is
+flipped the wrong way shows up in the output. The art is made of palette indexes, so the same tiles can be used
+for the RGB565 and the indexed tilesets. */
+
+static const char *glyph[4][8]={
+	{"........", ".#####..", ".#......", ".####...", ".#......", ".#......", ".#......", "........"},
+	{"...#....", "..###...", ".#.#.#..", "...#....", "...#....", "...#....", "...##...", "........"},
+	{"..####..", ".#....#.", "#......#", "#...##.#", "#...##.#", "#......#", ".#....#.", "..####.."},
+	{"########", "##.....#", "#.#....#", "#..#...#", "#...#..#", "#......#", "#......#", "########"},
+};
+
+#define TRANS_IDX 0 //palette index used for transparent pixels
+static const uint16_t trans_rgb=0xF81F; //color of those, in RGB565 tilesets
+
+static uint16_t palette_rgb[16];
+
+static uint16_t rgb(int r, int g, int b) {
+	return swap16(((r>>3)<<11)|((g>>2)<<5)|(b>>3));
+}
+
+static void gen_palette(uint16_t *pal) {
+	pal[TRANS_IDX]=swap16(trans_rgb);
+	for (int i=1; i<16; i++) {
+		//dark backgrounds in 1-4, bright glyph colors after that
+		if (i<5) {
+			pal[i]=rgb(i*20, i*12, 40+i*25);
+		} else {
+			pal[i]=rgb((i*97)&255, (i*53+90)&255, (i*151+40)&255);
+		}
+	}
+}
+
+//Palette index of pixel (x, y) of tile t. Transparent tiles have TRANS_IDX as the background.
+static int tile_pixel(int t, int x, int y, int transparent) {
+	if (glyph[t%4][y][x]=='#') return 5+(t+(y>3))%11;
+	if (transparent) return TRANS_IDX;
+	return 1+(t/4+((x^y)&1))%4;
+}
+
+//Allocates a tileset. Tile data and animations are filled in by the caller.
+static tilegfx_tileset_t *alloc_tileset(int words) {
+	tilegfx_tileset_t *ts=calloc(sizeof(tilegfx_tileset_t)+words*2, 1);
+	if (!ts) {
+		perror("alloc_tileset");
+		exit(1);
+	}
+	return ts;
+}
+
+static tilegfx_tileset_t *make_rgb_tileset(int transparent, int masks) {
+	tilegfx_tileset_t *ts=alloc_tileset(NTILES*64);
+	uint16_t *px=(uint16_t*)ts->tile;
+	for (int t=0; t<NTILES; t++) {
+		for (int i=0; i<64; i++) px[t*64+i]=palette_rgb[tile_pixel(t, i%8, i/8, transparent)];
+	}
+	ts->trans_col=transparent?swap16(trans_rgb):-1;
+	ts->format=TILEGFX_FORMAT_RGB565;
+	if (transparent && masks) {
+		uint8_t *m=calloc(NTILES*8, 1);
+		for (int i=0; i<NTILES*64; i++) {
+			if (tile_pixel(i/64, i%8, (i/8)%8, 1)!=TRANS_IDX) m[i/8]|=1<<(i%8);
+		}
+		ts->opaque_masks=m;
+	}
+	return ts;
+}
+
+static tilegfx_tileset_t *make_indexed4_tileset(int transparent) {
+	tilegfx_tileset_t *ts=alloc_tileset(NTILES*16);
+	uint8_t *px=(uint8_t*)ts->tile;
+	for (int i=0; i<NTILES*64; i++) px[i/2]|=tile_pixel(i/64, i%8, (i/8)%8, transparent)<<((i&1)*4);
+	ts->trans_col=transparent?TRANS_IDX:-1;
+	ts->format=TILEGFX_FORMAT_INDEXED4;
+	ts->palette=malloc(16*2);
+	gen_palette(ts->palette);
+	return ts;
+}
+
+//Tile 4 animates through tiles 4, 5 and 6; tile 8 shows tile 8 for 100ms and tile 9 for 300ms.
+static const tilegfx_anim_frame_t anim_frames[]={
+	{600, 0xffff}, {200, 4}, {200, 5}, {200, 6},
+	{400, 0xffff}, {100, 8}, {300, 9},
+};
+
+static void add_animation(tilegfx_tileset_t *ts) {
+	uint16_t *off=malloc(NTILES*2);
+	for (int i=0; i<NTILES; i++) off[i]=0xffff;
+	off[4]=0;
+	off[8]=4;
+	ts->anim_offsets=off;
+	ts->anim_frames=anim_frames;
+	ts->anim_frame_count=sizeof(anim_frames)/sizeof(anim_frames[0]);
+}
+
+static tilegfx_tileset_t *ts_opaque, *ts_anim, *ts_trans, *ts_trans_nomask, *ts_trans_anim, *ts_idx_opaque, *ts_idx_trans;
+static tilegfx_map_t *map_bg, *map_anim, *map_fg, *map_fg_nomask, *map_small, *map_flip, *map_scroll, *map_scroll_orig;
+static tilegfx_map_t *map_idx_bg, *map_idx_fg, *map_edit, *map_edit_orig;
+static tilegfx_map_t *map_world, *map_world_c;
+static tilegfx_file_t *world_file;
+static const tilegfx_map_t *map_world_file;
+static tilegfx_sprite_table_t *sprites;
+static tilegfx_scroll_layer_t *scroll, *idx_scroll;
+
+static uint32_t rng_state;
+
+static int rng(int max) {
+	rng_state^=rng_state<<13;
+	rng_state^=rng_state>>17;
+	rng_state^=rng_state<<5;
+	return rng_state%max;
+}
+
+//Makes a map with random tiles. Empty is the chance (in 1/8ths) of an empty cell, flip enables random flip flags.
+static tilegfx_map_t *make_map(int w, int h, const tilegfx_tileset_t *ts, int empty, int flip) {
+	tilegfx_map_t *m=tilegfx_create_tilemap(w, h, ts);
+	for (int y=0; y<h; y++) {
+		for (int x=0; x<w; x++) {
+			if (rng(8)<empty) continue; //create_tilemap leaves cells empty
+			int t=rng(NTILES);
+			if (flip) t|=rng(8)<<13;
+			tilegfx_set_tile(m, x, y, t);
+		}
+	}
+	return m;
+}
+
+//Makes a big map that is mostly empty, with some patches of tiles.
+static tilegfx_map_t *make_world_map(int w, int h, const tilegfx_tileset_t *ts) {
+	tilegfx_map_t *m=tilegfx_create_tilemap(w, h, ts);
+	for (int i=0; i<60; i++) {
+		int px=rng(w), py=rng(h), pw=rng(12)+1, ph=rng(6)+1;
+		int t=rng(NTILES);
+		for (int y=py; y<py+ph && y<h; y++) {
+			for (int x=px; x<px+pw && x<w; x++) {
+				int tt=t;
+				if (rng(4)==0) {
+					tt=rng(NTILES);
+					tt|=rng(8)<<13;
+				}
+				tilegfx_set_tile(m, x, y, tt);
+			}
+		}
+	}
+	return m;
+}
+
+//Compresses a map the same way conv_png_tile does, except that chunks aren't deduplicated and literals are
+//always one tile long.
+static tilegfx_map_t *compress_map(const tilegfx_map_t *m) {
+	int cw=(m->w+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE;
+	int ch=(m->h+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE;
+	tilegfx_map_chunks_t *c=calloc(1, sizeof(tilegfx_map_chunks_t));
+	uint16_t *data=malloc(cw*ch*TILEGFX_CHUNK_MAX_WORDS*2);
+	uint32_t *index=malloc(cw*ch*sizeof(uint32_t));
+	int len=0;
+	for (int n=0; n<cw*ch; n++) {
+		uint16_t t[TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE];
+		for (int i=0; i<TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE; i++) {
+			int x=(n%cw)*TILEGFX_CHUNK_SIZE+i%TILEGFX_CHUNK_SIZE;
+			int y=(n/cw)*TILEGFX_CHUNK_SIZE+i/TILEGFX_CHUNK_SIZE;
+			t[i]=(x<m->w && y<m->h)?tilegfx_get_tile(m, x, y):0xffff;
+		}
+		index[n]=len;
+		for (int i=0; i<TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE; ) {
+			int run=1;
+			while (i+run<TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE && t[i+run]==t[i]) run++;
+			data[len++]=(run>1)?0x8000|run:1;
+			data[len++]=t[i];
+			i+=run;
+		}
+	}
+	c->data=data;
+	c->index=index;
+	tilegfx_map_t *r=malloc(sizeof(tilegfx_map_t));
+	r->w=m->w;
+	r->h=m->h;
+	r->gfx=m->gfx;
+	r->chunks=c;
+	return r;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	for (int i=0; i<4; i++) p[i]=v>>(i*8);
+}
+
+#define CHUNK_STRIDE 4096 //bytes between encoded chunks in the data file
+
+//Makes a tilegfx data file (see tilegfx_appfs.c) with an RGB565 tileset with opaque masks and a compressed map
+//using it. The encoded chunks are spread out, so the window they are read through needs to move around.
+static uint8_t *make_data_file(const tilegfx_tileset_t *ts, const tilegfx_map_t *map, int *len) {
+	int chunks=((map->w+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE)*((map->h+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE);
+	int entries=20, tileset=entries+2*40, tiles=tileset+72, masks=tiles+NTILES*128;
+	int mapo=masks+NTILES*8, index=mapo+16, data=index+chunks*4;
+	*len=data+chunks*CHUNK_STRIDE;
+	uint8_t *f=calloc(*len, 1);
+	put32(&f[0], 0x58464754);
+	put32(&f[4], 2);
+	put32(&f[8], 2);
+	put32(&f[12], data);
+	put32(&f[16], chunks*CHUNK_STRIDE);
+	strcpy((char*)&f[entries], "tiles");
+	put32(&f[entries+32], 0);
+	put32(&f[entries+36], tileset);
+	strcpy((char*)&f[entries+40], "world");
+	put32(&f[entries+72], 1);
+	put32(&f[entries+76], mapo);
+	put32(&f[tileset], ts->trans_col);
+	put32(&f[tileset+4], ts->format);
+	put32(&f[tileset+8], NTILES);
+	put32(&f[tileset+16], masks);
+	put32(&f[tileset+36], tiles);
+	memcpy(&f[tiles], ts->tile, NTILES*128);
+	memcpy(&f[masks], ts->opaque_masks, NTILES*8);
+	put32(&f[mapo], map->w);
+	put32(&f[mapo+4], map->h);
+	put32(&f[mapo+8], 0);
+	put32(&f[mapo+12], index);
+	for (int i=0; i<chunks; i++) {
+		put32(&f[index+i*4], i*CHUNK_STRIDE/2);
+		memcpy(&f[data+i*CHUNK_STRIDE], &map->chunks->data[map->chunks->index[i]], TILEGFX_CHUNK_MAX_WORDS*2);
+	}
+	return f;
+}
+
+static void gen_data() {
+	rng_state=0x2545F491;
+	gen_palette(palette_rgb);
+	ts_opaque=make_rgb_tileset(0, 0);
+	ts_anim=make_rgb_tileset(0, 0);
+	add_animation(ts_anim);
+	ts_trans=make_rgb_tileset(1, 1);
+	ts_trans_nomask=make_rgb_tileset(1, 0);
+	ts_trans_anim=make_rgb_tileset(1, 1);
+	add_animation(ts_trans_anim);
+	ts_idx_opaque=make_indexed4_tileset(0);
+	ts_idx_trans=make_indexed4_tileset(1);
+
+	map_bg=make_map(16, 12, ts_opaque, 0, 0);
+	map_anim=make_map(12, 9, ts_anim, 0, 0);
+	map_fg=make_map(12, 10, ts_trans, 3, 0);
+	map_fg_nomask=tilegfx_dup_tilemap(map_fg);
+	map_fg_nomask->gfx=ts_trans_nomask;
+	map_small=make_map(3, 2, ts_opaque, 0, 0);
+	map_flip=make_map(12, 10, ts_trans, 2, 1);
+	//Same layout in the indexed tilesets, so those should look like the RGB565 ones.
+	map_idx_bg=tilegfx_dup_tilemap(map_bg);
+	map_idx_bg->gfx=ts_idx_opaque;
+	map_idx_fg=tilegfx_dup_tilemap(map_fg);
+	map_idx_fg->gfx=ts_idx_trans;
+	sprites=tilegfx_create_sprite_table(24, ts_trans);
+	//The compressed map gets decompressed again, so this also checks both ways of getting at the tiles.
+	tilegfx_map_t *raw=make_world_map(100, 61, ts_trans);
+	map_world_c=compress_map(raw);
+	tilegfx_destroy_tilemap(raw);
+	map_world=tilegfx_dup_tilemap(map_world_c);
+	int len;
+	uint8_t *file=make_data_file(ts_trans, map_world_c, &len);
+	host_appfs_add("world.gfx", file, len);
+	world_file=tilegfx_file_open("world.gfx");
+	map_world_file=world_file?tilegfx_file_get_map(world_file, "world"):NULL;
+	if (!map_world_file) {
+		printf("Can't load world.gfx\n");
+		exit(1);
+	}
+	map_scroll_orig=make_map(20, 14, ts_trans_anim, 2, 1);
+	map_scroll=tilegfx_dup_tilemap(map_scroll_orig);
+	map_edit_orig=make_map(20, 14, ts_trans_anim, 2, 1);
+	map_edit=tilegfx_dup_tilemap(map_edit_orig);
+}
+
+//Positions the sprites for frame f. Sprites move around and partly off the edges of a w*h screen.
+static void move_sprites(int f, int w, int h) {
+	for (int i=0; i<sprites->count; i++) {
+		tilegfx_sprite_t *s=&sprites->sprite[i];
+		s->x=(i*37+f*(i%5-2))%(w+16)-8;
+		s->y=(i*23+f*(i%3+1))%(h+16)-8;
+		s->tile=(i%7==6)?0xffff:(i%NTILES)|(((i/3)%8)<<13);
+		s->flags=i&3;
+		s->priority=(i*7)%4;
+	}
+}
+
+/* Scenarios. Every one renders frame f of something; the harness flushes it. */
+
+static void sc_opaque(int f, int w, int h) {
+	tilegfx_tile_map_render(map_bg, f*3, f*2, NULL);
+}
+
+static void sc_transparent(int f, int w, int h) {
+	sc_opaque(f, w, h);
+	tilegfx_tile_map_render(map_fg, -f*5, f, NULL);
+}
+
+static void sc_transparent_nomask(int f, int w, int h) {
+	sc_opaque(f, w, h);
+	tilegfx_tile_map_render(map_fg_nomask, -f*5, f, NULL);
+}
+
+static void sc_animated(int f, int w, int h) {
+	tilegfx_tile_map_render(map_anim, f, 0, NULL);
+}
+
+static void sc_clipped(int f, int w, int h) {
+	tilegfx_fade(0, 0, 0, 0); //clear
+	tilegfx_rect_t r1={.x=f-5, .y=7, .w=w/2+3, .h=h/2+f};
+	tilegfx_tile_map_render(map_bg, f*3, 5, &r1);
+	tilegfx_rect_t r2={.x=w/2-f, .y=-3, .w=w, .h=h/2};
+	tilegfx_tile_map_render(map_fg, 3, -f*3, &r2);
+	tilegfx_rect_t r3={.x=11, .y=h-13+f, .w=29, .h=20};
+	tilegfx_tile_map_render(map_fg, f, f, &r3);
+}
+
+static void sc_wrapped(int f, int w, int h) {
+	tilegfx_tile_map_render(map_small, -1000-f*7, 5000+f*3, NULL);
+}
+
+static void sc_flipped(int f, int w, int h) {
+	sc_opaque(f, w, h);
+	tilegfx_tile_map_render(map_flip, f*2, -f, NULL);
+}
+
+static void sc_indexed(int f, int w, int h) {
+	//Change some colors every frame
+	ts_idx_trans->palette[5]=rgb(f*30, 255-f*30, 128);
+	tilegfx_tile_map_render(map_idx_bg, f*3, f*2, NULL);
+	tilegfx_tile_map_render(map_idx_fg, -f*5, f, NULL);
+}
+
+//Nothing moves; only the colors change: the foreground, which covers part of the screen, in frames 3 and 6, the
+//background in frame 4. Nothing changes in the other frames, so partial flushes need to send a lot less. If
+//scroll_bg is set, the background is drawn by a scroll layer, which has to notice the palette change by itself.
+static void palette_frame(int f, int w, int h, int scroll_bg) {
+	ts_idx_trans->palette[6]=rgb((f/3)*90, 80, 255-(f/3)*90);
+	ts_idx_opaque->palette[2]=(f/4)?rgb(200, 0, 0):rgb(40, 24, 90);
+	if (scroll_bg) {
+		if (f==0) {
+			if (idx_scroll) tilegfx_destroy_scroll_layer(idx_scroll);
+			idx_scroll=tilegfx_create_scroll_layer(map_idx_bg, NULL);
+		}
+		tilegfx_scroll_layer_render(idx_scroll, 5, 3);
+	} else {
+		tilegfx_tile_map_render(map_idx_bg, 5, 3, NULL);
+	}
+	tilegfx_rect_t r={.x=8, .y=8, .w=w/2, .h=h/2};
+	tilegfx_tile_map_render(map_idx_fg, 9, 2, &r);
+	//Tilesets are shared between scenarios. Drawing is done already, as this is not used in band or parallel mode.
+	gen_palette(ts_idx_trans->palette);
+	gen_palette(ts_idx_opaque->palette);
+}
+
+static void sc_palette(int f, int w, int h) {
+	palette_frame(f, w, h, 0);
+}
+
+static void sc_palette_scroll(int f, int w, int h) {
+	palette_frame(f, w, h, 1);
+}
+
+static void sc_indexed_as_rgb(int f, int w, int h) {
+	ts_idx_trans->palette[5]=palette_rgb[5];
+	tilegfx_tile_map_render(map_idx_bg, f*3, f*2, NULL);
+	tilegfx_tile_map_render(map_idx_fg, -f*5, f, NULL);
+}
+
+static void sc_sprites(int f, int w, int h) {
+	sc_opaque(f, w, h);
+	move_sprites(f, w, h);
+	tilegfx_sprite_table_render(sprites, 0, 0, NULL);
+}
+
+static void sc_layers(int f, int w, int h) {
+	static int16_t wave[256], strips[256];
+	for (int i=0; i<h; i++) {
+		wave[i]=(int)(sin((i+f*3)*0.3)*4);
+		strips[i]=-(i/16)*f*2;
+	}
+	tilegfx_layer_t l[3]={
+		{.map=map_bg, .offx=f, .offy=0, .line_offx=strips},
+		{.map=map_fg, .offx=f*2, .offy=-f, .line_offx=wave, .line_offy=wave},
+		{.map=map_flip, .offx=0, .offy=0},
+	};
+	tilegfx_layers_render(l, 3, NULL);
+}
+
+static void sc_fade(int f, int w, int h) {
+	sc_transparent(f, w, h);
+	tilegfx_fade(30, 60, 90, f*32);
+}
+
+static void sc_mix(int f, int w, int h) {
+	tilegfx_tile_map_render(map_anim, f*3, f*2, NULL);
+	tilegfx_tile_map_render(map_flip, -f*5, f, NULL);
+	tilegfx_rect_t r={.x=8, .y=8, .w=w-16, .h=h-16};
+	tilegfx_tile_map_render(map_fg, f, f, &r);
+	move_sprites(f, w, h);
+	tilegfx_sprite_table_render(sprites, 0, 0, NULL);
+}
+
+//Sets up frame f of the scroll scenarios: the map is changed a bit every frame. The camera moves a pixel or two,
+//stands still, or jumps; after the first 8 frames it keeps scrolling, as a game would.
+static void scroll_frame(int f, int w, int h, int *x, int *y, tilegfx_rect_t *r) {
+	static const int path[8][2]={{3, 2}, {4, 2}, {5, 3}, {5, 3}, {2, 6}, {95, -4}, {-107, -5}, {-106, -5}};
+	if (f==0) memcpy((void*)map_scroll->tiles, map_scroll_orig->tiles, map_scroll->w*map_scroll->h*2);
+	tilegfx_set_tile(map_scroll, (f*7)%20, (f*3)%14, (f%NTILES)|((f%8)<<13));
+	tilegfx_set_tile(map_scroll, (f*5+3)%20, (f+1)%14, 0xffff);
+	*x=(f<8)?path[f][0]:f;
+	*y=(f<8)?path[f][1]:f/3;
+	*r=(tilegfx_rect_t){.x=-3, .y=0, .w=w+3, .h=h}; //partly off-screen, to check the cropping
+}
+
+static void sc_scroll_ref(int f, int w, int h) {
+	int x, y;
+	tilegfx_rect_t r;
+	scroll_frame(f, w, h, &x, &y, &r);
+	tilegfx_fade(0, 0, 0, 0); //clear
+	tilegfx_tile_map_render(map_scroll, x, y, &r);
+	move_sprites(f, w, h);
+	tilegfx_sprite_table_render(sprites, 0, 0, NULL);
+}
+
+static void sc_scroll(int f, int w, int h) {
+	int x, y;
+	tilegfx_rect_t r;
+	scroll_frame(f, w, h, &x, &y, &r);
+	if (f==0) {
+		//The layer depends on the framebuffer size, so it's made anew for every run.
+		if (scroll) tilegfx_destroy_scroll_layer(scroll);
+		scroll=tilegfx_create_scroll_layer(map_scroll, &r);
+	}
+	tilegfx_scroll_layer_render(scroll, x, y);
+	move_sprites(f, w, h);
+	tilegfx_sprite_table_render(sprites, 0, 0, NULL);
+}
+
+static void world_frame(const tilegfx_map_t *world, int f, int w, int h) {
+	static int16_t wave[256];
+	for (int i=0; i<h; i++) wave[i]=(int)(sin((i+f)*0.2)*12);
+	tilegfx_tile_map_render(map_bg, f, f, NULL);
+	tilegfx_tile_map_render(world, f*23, -f*9, NULL);
+	tilegfx_layer_t l={.map=world, .offx=-f*17, .offy=200+f*5, .line_offx=wave};
+	tilegfx_rect_t r={.x=8, .y=h/2, .w=w-16, .h=h/2};
+	tilegfx_layers_render(&l, 1, &r);
+}
+
+static void sc_world(int f, int w, int h) {
+	world_frame(map_world, f, w, h);
+}
+
+static void sc_world_compressed(int f, int w, int h) {
+	world_frame(map_world_c, f, w, h);
+}
+
+static void sc_world_file(int f, int w, int h) {
+	world_frame(map_world_file, f, w, h);
+}
+
+//Random frames, to compare partial flushes with full ones. Every frame, things may stay the same as in the previous
+//frame or change: the background moves a bit, jumps or stays put, the other maps are rendered or not, at a different
+//position or with a different clipping rect, the map gets edited, the sprites move, and there are fades, palette
+//changes and pixels drawn into the framebuffer directly. The background covers the screen, as in double-res mode the
+//framebuffer doesn't keep its contents over a flush.
+static void sc_random(int f, int w, int h) {
+	static int bgx, bgy, fade;
+	static uint16_t col;
+	static struct {
+		int on, x, y;
+		tilegfx_rect_t r;
+	} lay[3];
+	tilegfx_map_t *const maps[3]={map_fg, map_flip, map_edit};
+	if (f==0) {
+		rng_state=0x7F4A7C15;
+		memcpy((void*)map_edit->tiles, map_edit_orig->tiles, map_edit->w*map_edit->h*2);
+		bgx=bgy=fade=0;
+		col=rgb(40, 24, 90);
+		for (int i=0; i<3; i++) {
+			lay[i].on=lay[i].x=lay[i].y=0;
+			lay[i].r=(tilegfx_rect_t){.x=0, .y=0, .w=w, .h=h};
+		}
+		move_sprites(0, w, h);
+	}
+
+	if (rng(16)==0) {
+		bgx+=rng(400)-200;
+		bgy+=rng(400)-200;
+	} else if (rng(4)==0) {
+		bgx+=rng(5)-2;
+		bgy+=rng(5)-2;
+	}
+	if (rng(8)==0) col=rgb(rng(256), rng(256), rng(256));
+	ts_idx_opaque->palette[2]=col;
+	tilegfx_tile_map_render(map_idx_bg, bgx, bgy, NULL);
+
+	for (int i=rng(4); i>0; i--) {
+		int t=rng(8)?(rng(NTILES)|(rng(8)<<13)):0xffff;
+		tilegfx_set_tile(map_edit, rng(map_edit->w), rng(map_edit->h), t);
+	}
+	for (int i=0; i<3; i++) {
+		if (rng(16)==0) lay[i].on=!lay[i].on;
+		if (!lay[i].on) continue;
+		int c=rng(10);
+		if (c==0) {
+			lay[i].x+=rng(9)-4;
+			lay[i].y+=rng(9)-4;
+		} else if (c==1) {
+			lay[i].r=(tilegfx_rect_t){.x=rng(w)-8, .y=rng(h)-8, .w=rng(w)+1, .h=rng(h)+1};
+		} else if (c==2) {
+			lay[i].r=(tilegfx_rect_t){.x=0, .y=0, .w=w, .h=h};
+		}
+		tilegfx_tile_map_render(maps[i], lay[i].x, lay[i].y, &lay[i].r);
+	}
+
+	if (rng(4)==0) move_sprites(rng(64), w, h);
+	tilegfx_sprite_table_render(sprites, 0, 0, NULL);
+
+	if (rng(6)==0) fade=rng(3)?rng(256):0;
+	if (fade) tilegfx_fade(30, 60, 90, fade);
+
+	if (rng(6)==0) {
+		tilegfx_rect_t r={.x=rng(w-8), .y=rng(h-8), .w=rng(8)+1, .h=rng(8)+1};
+		uint16_t *fb=tilegfx_get_fb();
+		uint16_t c=rng(0x10000);
+		for (int y=r.y; y<r.y+r.h; y++) {
+			for (int x=r.x; x<r.x+r.w; x++) fb[y*w+x]=c;
+		}
+		tilegfx_invalidate(&r);
+	}
+	gen_palette(ts_idx_opaque->palette); //shared with the other scenarios
+}
+
+typedef struct {
+	const char *name;
+	void (*frame)(int f, int w, int h);
+	int double_res;
+	int flags;
+	const char *same_as; //scenario that should give exactly the same output, or NULL
+	int tile_cache; //size of the tile cache, or 0 for none
+	int frames; //amount of frames to render, or 0 for FRAMES
+	int max_sent_pct; //with partial flush: max bytes sent to the OLED, in percent of what same_as sends; 0 for 100
+} scenario_t;
+
+static const scenario_t scenarios[]={
+	{"opaque", sc_opaque, 0, 0, NULL},
+	{"transparent", sc_transparent, 0, 0, NULL},
+	{"transparent_nomask", sc_transparent_nomask, 0, 0, "transparent"},
+	{"animated", sc_animated, 0, 0, NULL},
+	{"clipped", sc_clipped, 0, 0, NULL},
+	{"wrapped", sc_wrapped, 0, 0, NULL},
+	{"flipped", sc_flipped, 0, 0, NULL},
+	{"indexed", sc_indexed, 0, 0, NULL},
+	{"indexed_as_rgb", sc_indexed_as_rgb, 0, 0, "transparent"},
+	{"palette", sc_palette, 0, 0, NULL},
+	{"palette_partial", sc_palette, 0, TILEGFX_INIT_PARTIAL_FLUSH, "palette", 0, 0, 50},
+	{"palette_scroll", sc_palette_scroll, 0, 0, "palette"},
+	{"palette_scroll_partial", sc_palette_scroll, 0, TILEGFX_INIT_PARTIAL_FLUSH, "palette", 0, 0, 50},
+	{"sprites", sc_sprites, 0, 0, NULL},
+	{"layers", sc_layers, 0, 0, NULL},
+	{"fade", sc_fade, 0, 0, NULL},
+	{"mix", sc_mix, 0, 0, NULL},
+	{"mix_partial", sc_mix, 0, TILEGFX_INIT_PARTIAL_FLUSH, "mix"},
+	{"mix_band", sc_mix, 0, TILEGFX_INIT_BAND_RENDER, "mix"},
+	{"mix_parallel", sc_mix, 0, TILEGFX_INIT_PARALLEL, "mix"},
+	{"mix_dbuf", sc_mix, 0, TILEGFX_INIT_DOUBLE_BUFFER, "mix"},
+	{"mix_dbuf_partial", sc_mix, 0, TILEGFX_INIT_DOUBLE_BUFFER|TILEGFX_INIT_PARTIAL_FLUSH, "mix"},
+	{"scroll_ref", sc_scroll_ref, 0, 0, NULL},
+	{"scroll", sc_scroll, 0, 0, "scroll_ref"},
+	{"scroll_partial", sc_scroll, 0, TILEGFX_INIT_PARTIAL_FLUSH, "scroll_ref"},
+	{"scroll_band", sc_scroll, 0, TILEGFX_INIT_BAND_RENDER|TILEGFX_INIT_PARTIAL_FLUSH, "scroll_ref"},
+	{"world", sc_world, 0, 0, NULL},
+	{"world_compressed", sc_world_compressed, 0, 0, "world"},
+	{"world_band", sc_world_compressed, 0, TILEGFX_INIT_BAND_RENDER, "world"},
+	{"world_file", sc_world_file, 0, 0, "world"},
+	{"random", sc_random, 0, 0, NULL, 0, 200},
+	{"random_partial", sc_random, 0, TILEGFX_INIT_PARTIAL_FLUSH, "random", 0, 200, 80},
+	{"mix_tcache", sc_mix, 0, 0, "mix", 12},
+	{"indexed_tcache", sc_indexed, 0, 0, "indexed", 16},
+	{"layers_tcache", sc_layers, 0, 0, "layers", 64},
+	{"world_band_tcache", sc_world_compressed, 0, TILEGFX_INIT_BAND_RENDER, "world", 32},
+	{"dbl_opaque", sc_opaque, 1, 0, NULL},
+	{"dbl_transparent", sc_transparent, 1, 0, NULL},
+	{"dbl_layers", sc_layers, 1, 0, NULL},
+	{"dbl_mix", sc_mix, 1, 0, NULL},
+	{"dbl_mix_partial", sc_mix, 1, TILEGFX_INIT_PARTIAL_FLUSH, "dbl_mix"},
+	{"dbl_mix_band", sc_mix, 1, TILEGFX_INIT_BAND_RENDER, "dbl_mix"},
+	{"dbl_mix_parallel", sc_mix, 1, TILEGFX_INIT_PARALLEL, "dbl_mix"},
+	{"dbl_mix_dbuf_parallel", sc_mix, 1, TILEGFX_INIT_DOUBLE_BUFFER|TILEGFX_INIT_PARALLEL, "dbl_mix"},
+	{"dbl_mix_all", sc_mix, 1, TILEGFX_INIT_PARALLEL|TILEGFX_INIT_PARTIAL_FLUSH, "dbl_mix"},
+	{"dbl_scroll_ref", sc_scroll_ref, 1, 0, NULL},
+	{"dbl_scroll", sc_scroll, 1, 0, "dbl_scroll_ref"},
+	{"dbl_scroll_parallel", sc_scroll, 1, TILEGFX_INIT_PARALLEL|TILEGFX_INIT_PARTIAL_FLUSH, "dbl_scroll_ref"},
+	{"dbl_random", sc_random, 1, 0, NULL, 0, 200},
+	{"dbl_random_partial", sc_random, 1, TILEGFX_INIT_PARTIAL_FLUSH, "dbl_random", 0, 200, 80},
+	{"dbl_world", sc_world, 1, 0, NULL},
+	{"dbl_world_parallel", sc_world_compressed, 1, TILEGFX_INIT_PARALLEL, "dbl_world"},
+	{"dbl_world_file", sc_world_file, 1, TILEGFX_INIT_PARALLEL, "dbl_world"},
+	{"dbl_mix_par_tcache", sc_mix, 1, TILEGFX_INIT_PARALLEL, "dbl_mix", 24},
+	{"dbl_wfile_tcache", sc_world_file, 1, TILEGFX_INIT_PARALLEL, "dbl_world", 256},
+};
+
+#define NSCENARIOS (sizeof(scenarios)/sizeof(scenarios[0]))
+
+//Renders frames of a scenario. If check is set, returns a checksum over the checksums of the screen after every frame.
+//Afterwards, host_bytes_sent is the amount of bytes sent to the OLED.
+static uint32_t run_scenario(const scenario_t *s, int frames, int check) {
+	if (!tilegfx_init_custom(s->double_res, 50, s->flags)) {
+		printf("%s: tilegfx_init_custom failed\n", s->name);
+		exit(1);
+	}
+	if (s->tile_cache && !tilegfx_set_tile_cache(s->tile_cache)) {
+		printf("%s: tilegfx_set_tile_cache failed\n", s->name);
+		exit(1);
+	}
+	int w=s->double_res?KC_SCREEN_W*2:KC_SCREEN_W;
+	int h=s->double_res?KC_SCREEN_H*2:KC_SCREEN_H;
+	memset(host_screen, 0, sizeof(host_screen));
+	host_bytes_sent=0;
+	uint32_t *crc=calloc(check?frames:1, sizeof(uint32_t));
+	for (int f=0; f<frames; f++) {
+		host_set_time((int64_t)f*FRAME_US*7); //large steps, so animations change every frame
+		s->frame(f, w, h);
+		host_vblank();
+		tilegfx_flush();
+		host_wait_idle(); //in double-buffer mode, the frame is sent in the background
+		if (check) crc[f]=crc32((uint8_t*)host_screen, sizeof(host_screen));
+	}
+	tilegfx_deinit();
+	uint32_t ret=crc32((uint8_t*)crc, check?frames*sizeof(uint32_t):0);
+	free(crc);
+	return ret;
+}
+
+static int selected(const char *name, int argc, char **argv, int first) {
+	if (first>=argc) return 1;
+	for (int i=first; i<argc; i++) {
+		if (strcmp(argv[i], name)==0) return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *golden=NULL, *prefix=NULL;
+	int update=0, bench=0;
+	int i;
+	for (i=1; i<argc && argv[i][0]=='-'; i++) {
+		if (strcmp(argv[i], "-g")==0 && i+1<argc) {
+			golden=argv[++i];
+		} else if (strcmp(argv[i], "-u")==0) {
+			update=1;
+		} else if (strcmp(argv[i], "-b")==0 && i+1<argc) {
+			bench=atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-p")==0 && i+1<argc) {
+			prefix=argv[++i];
+		} else {
+			fprintf(stderr, "Usage: %s [-g golden.txt [-u]] [-b frames] [-p prefix] [scenario...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (update && !golden) {
+		fprintf(stderr, "-u needs a golden file to write to (-g)\n");
+		return 1;
+	}
+	int first_name=i;
+	gen_data();
+
+	FILE *gf=NULL;
+	if (update) {
+		gf=fopen(golden, "w");
+		if (!gf) {
+			perror(golden);
+			return 1;
+		}
+	}
+	int ok=1;
+	uint32_t result[NSCENARIOS];
+	long sent[NSCENARIOS];
+	for (int n=0; n<NSCENARIOS; n++) {
+		const scenario_t *s=&scenarios[n];
+		if (!selected(s->name, argc, argv, first_name)) continue;
+		uint32_t crc=run_scenario(s, s->frames?s->frames:FRAMES, 1);
+		result[n]=crc;
+		sent[n]=host_bytes_sent;
+		printf("%-20s %08x", s->name, crc);
+		if (prefix) write_ppm(prefix, s->name, host_screen, KC_SCREEN_W, KC_SCREEN_H);
+		if (s->same_as) {
+			for (int j=0; j<n; j++) {
+				if (strcmp(scenarios[j].name, s->same_as)==0 && selected(s->same_as, argc, argv, first_name) &&
+							result[j]!=crc) {
+					printf("  DIFFERS FROM %s", s->same_as);
+					ok=0;
+				}
+				//Partial flushes should never send more, and where it's set, a lot less.
+				int pct=s->max_sent_pct?s->max_sent_pct:100;
+				if (strcmp(scenarios[j].name, s->same_as)==0 && selected(s->same_as, argc, argv, first_name) &&
+							(s->flags&TILEGFX_INIT_PARTIAL_FLUSH) && sent[n]*100>sent[j]*pct) {
+					printf("  SENT %ld%% OF %s", sent[n]*100/sent[j], s->same_as);
+					ok=0;
+				}
+			}
+		}
+		uint32_t gcrc;
+		if (update) {
+			fprintf(gf, "%08x %s\n", crc, s->name);
+			printf("\n");
+		} else if (!golden) {
+			printf("\n");
+		} else if (!golden_lookup(golden, s->name, &gcrc)) {
+			printf("  NO GOLDEN\n");
+		} else if (gcrc!=crc) {
+			printf("  MISMATCH (golden %08x)\n", gcrc);
+			ok=0;
+		} else {
+			printf("  OK\n");
+		}
+	}
+	if (gf) fclose(gf);
+
+	if (bench) {
+		for (int n=0; n<NSCENARIOS; n++) {
+			const scenario_t *s=&scenarios[n];
+			if (!selected(s->name, argc, argv, first_name)) continue;
+			double t=now_ns();
+			run_scenario(s, bench, 0);
+			printf("%-20s %8.0f ns/frame\n", s->name, (now_ns()-t)/bench);
+		}
+	}
+	if (scroll) tilegfx_destroy_scroll_layer(scroll);
+	if (idx_scroll) tilegfx_destroy_scroll_layer(idx_scroll);
+	tilegfx_file_close(world_file);
+	if (host_appfs_maps!=0) {
+		printf("%d appfs mmaps left after closing the data file\n", host_appfs_maps);
+		ok=0;
+	}
+	return ok?0:1;
+}
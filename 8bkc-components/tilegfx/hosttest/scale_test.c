@@ -0,0 +1,166 @@
+/*
+Host test for the tilegfx downscaler. Scales a generated test image in both modes and checks the result against
+a straightforward per-channel implementation, and against the checksums in a golden file so changes in output
+don't go unnoticed. Also benchmarks the scaler against the per-channel implementation.
+
+Usage: scale_test [-g golden.txt [-u]] [-b frames] [-p prefix]
+ -g: check output against the checksums in this file
+ -u: write the checksums of the current output to the golden file instead
+ -b: time scaling this many frames
+ -p: write the test image and scaled results as prefix_*.ppm, for inspection
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tilegfx_scale.h"
+#include "testutil.h"
+
+#define W 80
+#define H 64
+
+static const char *mode_name[]={"subpixel", "box"};
+
+//Test image: gradients, hard edges, single-pixel lines and noise, in every channel.
+static void gen_image(uint16_t *img) {
+	uint32_t seed=0x1234567;
+	for (int y=0; y<H*2; y++) {
+		for (int x=0; x<W*2; x++) {
+			int r, g, b;
+			if (y<32) {
+				r=x*31/(W*2-1);
+				g=y*63/31;
+				b=31-r;
+			} else if (y<64) {
+				r=((x/3+y/5)&1)?31:0;
+				g=(x&1)?63:0;
+				b=(y&1)?31:0;
+			} else if (y<96) {
+				r=(x%7==0)?31:(x%7)*2;
+				g=(y%5==0)?0:63-(x&31);
+				b=(x==y)?31:(x^y)&31;
+			} else {
+				seed^=seed<<13;
+				seed^=seed>>17;
+				seed^=seed<<5;
+				r=seed&31;
+				g=(seed>>5)&63;
+				b=(seed>>11)&31;
+			}
+			img[y*W*2+x]=swap16((r<<11)|(g<<5)|b);
+		}
+	}
+}
+
+//Reference: average the lines, then mix the channels with their weights, rounding down.
+static void ref_scale(const uint16_t *in, uint16_t *out, int mode) {
+	for (int y=0; y<H; y++) {
+		for (int x=0; x<W; x++) {
+			int ch[2][3];
+			for (int i=0; i<2; i++) {
+				uint16_t a=swap16(in[(y*2)*W*2+x*2+i]);
+				uint16_t b=swap16(in[(y*2+1)*W*2+x*2+i]);
+				ch[i][0]=((a>>11)+(b>>11))/2;
+				ch[i][1]=(((a>>5)&63)+((b>>5)&63))/2;
+				ch[i][2]=((a&31)+(b&31))/2;
+			}
+			int r, g, b;
+			if (mode==TILEGFX_SCALE_BOX) {
+				r=(ch[0][0]+ch[1][0])/2;
+				b=(ch[0][2]+ch[1][2])/2;
+			} else {
+				r=(ch[0][0]+ch[1][0]*3)/4;
+				b=(ch[0][2]*3+ch[1][2])/4;
+			}
+			g=(ch[0][1]+ch[1][1])/2;
+			out[y*W+x]=swap16((r<<11)|(g<<5)|b);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *golden=NULL, *prefix=NULL;
+	int update=0, bench=0;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-g")==0 && i+1<argc) {
+			golden=argv[++i];
+		} else if (strcmp(argv[i], "-u")==0) {
+			update=1;
+		} else if (strcmp(argv[i], "-b")==0 && i+1<argc) {
+			bench=atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-p")==0 && i+1<argc) {
+			prefix=argv[++i];
+		} else {
+			fprintf(stderr, "Usage: %s [-g golden.txt [-u]] [-b frames] [-p prefix]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (update && !golden) {
+		fprintf(stderr, "-u needs a golden file to write to (-g)\n");
+		return 1;
+	}
+	//Scaler reads 32-bit words; make sure the buffers are aligned.
+	static uint32_t img_w[W*H*2], buf_w[W*H*2], ref_w[W*H/2];
+	uint16_t *img=(uint16_t*)img_w, *buf=(uint16_t*)buf_w, *ref=(uint16_t*)ref_w;
+	gen_image(img);
+	if (prefix) write_ppm(prefix, "input", img, W*2, H*2);
+
+	FILE *gf=NULL;
+	if (update) {
+		gf=fopen(golden, "w");
+		if (!gf) {
+			perror(golden);
+			return 1;
+		}
+	}
+	int ok=1;
+	for (int mode=0; mode<2; mode++) {
+		ref_scale(img, ref, mode);
+		//Scale in place, as tilegfx does
+		memcpy(buf, img, W*H*4*2);
+		tilegfx_scale_lines(buf, buf, W, H, mode);
+		uint32_t crc=crc32((uint8_t*)buf, W*H*2);
+		printf("%-10s %08x", mode_name[mode], crc);
+		if (memcmp(buf, ref, W*H*2)!=0) {
+			printf("  DIFFERS FROM REFERENCE");
+			ok=0;
+		}
+		if (prefix) write_ppm(prefix, mode_name[mode], buf, W, H);
+		uint32_t gcrc;
+		if (update) {
+			fprintf(gf, "%08x %s\n", crc, mode_name[mode]);
+			printf("\n");
+		} else if (!golden) {
+			printf("\n");
+		} else if (!golden_lookup(golden, mode_name[mode], &gcrc)) {
+			printf("  NO GOLDEN\n");
+		} else if (gcrc!=crc) {
+			printf("  MISMATCH (golden %08x)\n", gcrc);
+			ok=0;
+		} else {
+			printf("  OK\n");
+		}
+	}
+	if (gf) fclose(gf);
+
+	if (bench) {
+		for (int mode=0; mode<2; mode++) {
+			double t=now_ns();
+			for (int i=0; i<bench; i++) {
+				memcpy(buf, img, W*H*4*2);
+				tilegfx_scale_lines(buf, buf, W, H, mode);
+			}
+			double t2=now_ns();
+			for (int i=0; i<bench; i++) memcpy(buf, img, W*H*4*2);
+			double t3=now_ns();
+			//Don't count the time needed to restore the input.
+			printf("%-10s %8.0f ns/frame\n", mode_name[mode], ((t2-t)-(t3-t2))/bench);
+		}
+		for (int mode=0; mode<2; mode++) {
+			double t=now_ns();
+			for (int i=0; i<bench; i++) ref_scale(img, buf, mode);
+			printf("%-10s %8.0f ns/frame (per-channel reference)\n", mode_name[mode], (now_ns()-t)/bench);
+		}
+	}
+	return ok?0:1;
+}
@@ -0,0 +1,9 @@
+//Host stand-in for the parts of the 8bkc HAL tilegfx uses. Frames sent end up in host_screen; see host_shim.c.
+#pragma once
+#include <stdint.h>
+
+#define KC_SCREEN_W 80
+#define KC_SCREEN_H 64
+
+void kchal_send_fb(const uint16_t *fb);
+void kchal_send_fb_partial(const uint16_t *fb, int x, int y, int h, int w);
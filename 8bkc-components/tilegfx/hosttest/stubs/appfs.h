@@ -0,0 +1,23 @@
+//Host stand-in for the parts of appfs tilegfx uses. Files are buffers registered with host_appfs_add; see host_shim.c.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef int appfs_handle_t;
+typedef int spi_flash_mmap_handle_t;
+
+typedef enum {
+	SPI_FLASH_MMAP_DATA,
+	SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+#define APPFS_INVALID_FD -1
+
+appfs_handle_t appfsOpen(const char *filename);
+void appfsClose(appfs_handle_t handle);
+esp_err_t appfsMmap(appfs_handle_t fd, size_t offset, size_t len, const void** out_ptr,
+									spi_flash_mmap_memory_t memory, spi_flash_mmap_handle_t* out_handle);
+void appfsMunmap(spi_flash_mmap_handle_t handle);
+esp_err_t appfsRead(appfs_handle_t fd, size_t start, void *buf, size_t len);
+void appfsEntryInfo(appfs_handle_t fd, const char **name, int *size);
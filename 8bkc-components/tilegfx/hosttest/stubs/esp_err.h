@@ -0,0 +1,8 @@
+//Host stand-in for esp_err.h
+#pragma once
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_INVALID_SIZE 0x104
@@ -0,0 +1,14 @@
+//Host stand-in for the bits of FreeRTOS tilegfx uses, implemented on top of pthreads in host_shim.c.
+#pragma once
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xffffffff
+#define portNUM_PROCESSORS 2
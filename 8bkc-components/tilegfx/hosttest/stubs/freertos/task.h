@@ -0,0 +1,7 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void*), const char *name, uint32_t stack, void *arg, int prio,
+			TaskHandle_t *handle, int core);
+void vTaskDelete(TaskHandle_t task);
+int xPortGetCoreID();
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "testutil.h"
+
+uint32_t crc32(const uint8_t *buf, int len) {
+	uint32_t crc=0xffffffff;
+	for (int i=0; i<len; i++) {
+		crc^=buf[i];
+		for (int bit=0; bit<8; bit++) crc=(crc>>1)^(0xEDB88320&-(crc&1));
+	}
+	return ~crc;
+}
+
+int golden_lookup(const char *file, const char *name, uint32_t *crc) {
+	FILE *f=fopen(file, "r");
+	if (!f) return 0;
+	char line[128], n[64];
+	unsigned int c;
+	int found=0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%x %63s", &c, n)==2 && strcmp(n, name)==0) {
+			*crc=c;
+			found=1;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+void write_ppm(const char *prefix, const char *name, const uint16_t *img, int w, int h) {
+	char fn[256];
+	snprintf(fn, sizeof(fn), "%s_%s.ppm", prefix, name);
+	FILE *f=fopen(fn, "wb");
+	if (!f) {
+		perror(fn);
+		return;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", w, h);
+	for (int i=0; i<w*h; i++) {
+		uint16_t c=swap16(img[i]);
+		uint8_t rgb[3]={(c>>11)<<3, ((c>>5)&63)<<2, (c&31)<<3};
+		fwrite(rgb, 3, 1, f);
+	}
+	fclose(f);
+}
+
+double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9+ts.tv_nsec;
+}
@@ -0,0 +1,21 @@
+/*
+Helpers shared by the host tests: checksums, golden files, image output and timing.
+*/
+#pragma once
+#include <stdint.h>
+
+//Converts between the byte-swapped RGB565 tilegfx uses and normal RGB565
+static inline uint16_t swap16(uint16_t c) {
+	return (c<<8)|(c>>8);
+}
+
+uint32_t crc32(const uint8_t *buf, int len);
+
+//Looks up the checksum for name in a golden file with lines of '<crc, in hex> <name>'. Returns false if not found.
+int golden_lookup(const char *file, const char *name, uint32_t *crc);
+
+//Writes a w*h image of byte-swapped RGB565 pixels as prefix_name.ppm
+void write_ppm(const char *prefix, const char *name, const uint16_t *img, int w, int h);
+
+//Monotonic time, in nanoseconds
+double now_ns();
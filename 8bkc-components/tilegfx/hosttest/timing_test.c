@@ -0,0 +1,87 @@
+/*
+Host test for the tilegfx frame pacing. Plays a script of frames that are in time or late by a number of vblanks,
+and checks what tilegfx_skip_frame says and the missed vblanks tilegfx_get_frame_stats reports against what the
+game should see: late frames are skipped until caught up, but never more than max_frame_skip in a row, and being
+behind by more than that is given up on instead of caught up on later.
+
+Usage: timing_test
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tilegfx.h"
+#include "host_shim.h"
+
+typedef struct {
+	int max_skip;	//tilegfx_set_max_frame_skip for this frame
+	int late;		//vblanks that pass while the game runs its logic, before asking to skip
+	int skips;		//expected amount of times tilegfx_skip_frame returns true in a row
+	int missed;		//expected missed_vblanks after flushing the frame
+} frame_t;
+
+static const frame_t script[]={
+	{0, 0, 0, 0},	//in time
+	{0, 3, 0, 3},	//late; can't skip, so the game slows down...
+	{0, 0, 0, 0},	//...and is in time again for the next frame
+	{2, 2, 2, 0},	//late, and skips to catch up
+	{2, 1, 1, 0},	//stops skipping when caught up, before the limit
+	{2, 4, 2, 2},	//late by more than it can skip; the rest is caught up on in the next frame
+	{2, 0, 2, 0},
+	{2, 6, 2, 4},	//behind by 4 after skipping, which is more than can be caught up on...
+	{2, 0, 2, 0},	//...so only 2 of those are
+	{2, 0, 0, 0},	//in time again
+};
+
+#define NFRAMES (sizeof(script)/sizeof(script[0]))
+
+//Runs the script in the given render mode. Returns the amount of errors.
+static int run_script(int flags) {
+	int errors=0;
+	uint32_t total_missed=0, skipped=0;
+	if (!tilegfx_init_custom(0, 50, flags)) {
+		printf("flags %02x: tilegfx_init_custom failed\n", flags);
+		return 1;
+	}
+	for (int f=0; f<NFRAMES; f++) {
+		const frame_t *fr=&script[f];
+		tilegfx_set_max_frame_skip(fr->max_skip);
+		for (int i=0; i<fr->late; i++) host_vblank();
+		int skips=0;
+		while (tilegfx_skip_frame()) {
+			skips++;
+			if (skips>fr->max_skip) break; //no need to loop forever if broken
+		}
+		//The vblank of this frame itself happens while it's being sent.
+		host_vblank();
+		tilegfx_flush();
+		host_wait_idle();
+		tilegfx_frame_stats_t st;
+		tilegfx_get_frame_stats(&st);
+		total_missed+=fr->missed;
+		skipped+=fr->skips;
+		if (skips!=fr->skips || st.missed_vblanks!=fr->missed || st.total_missed_vblanks!=total_missed ||
+					st.skipped_frames!=skipped || st.frame!=f+1) {
+			printf("flags %02x frame %d: skipped %d, missed %d, total missed %d, skipped %d, frame %d; expected "
+					"%d, %d, %d, %d, %d\n", flags, f, skips, st.missed_vblanks, st.total_missed_vblanks,
+					st.skipped_frames, st.frame, fr->skips, fr->missed, total_missed, skipped, f+1);
+			errors++;
+		}
+	}
+	tilegfx_set_max_frame_skip(0);
+	tilegfx_deinit();
+	printf("flags %02x: %d frames, %d missed vblanks, %d skipped, %s\n", flags, (int)NFRAMES, total_missed,
+				skipped, errors?"FAIL":"OK");
+	return errors;
+}
+
+int main(int argc, char **argv) {
+	if (argc>1) {
+		fprintf(stderr, "Usage: %s\n", argv[0]);
+		return 1;
+	}
+	const int flag_sets[]={0, TILEGFX_INIT_DOUBLE_BUFFER, TILEGFX_INIT_BAND_RENDER};
+	int errors=0;
+	for (int i=0; i<sizeof(flag_sets)/sizeof(flag_sets[0]); i++) errors+=run_script(flag_sets[i]);
+	return errors?1:0;
+}
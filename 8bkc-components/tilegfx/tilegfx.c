@@ -3,9 +3,11 @@
 */
 
 #include "tilegfx.h"
+#include "tilegfx_scale.h"
 #include "8bkc-hal.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -13,36 +15,688 @@
 #include "esp_timer.h"
 
 
-static uint16_t *fb;
+static uint16_t *fb; //buffer currently rendered into; NULL in band mode
+static uint16_t *fbs[2]; //allocated buffers; the 2nd one is only used with TILEGFX_INIT_DOUBLE_BUFFER
 static tilegfx_rect_t fb_rect={0};
 static uint64_t anim_start_time;
+static int init_flags;
+static tilegfx_scale_mode_t scale_mode=TILEGFX_SCALE_SUBPIXEL;
+
+/*
+Render target. Normally this is the framebuffer, but in band mode it is a buffer holding a band of full-width lines
+of the framebuffer. Pixel (x, y) of the framebuffer is at buf[y*fb_rect.w+x], but only the pixels in rect are
+backed by memory: nothing outside of it may be written. The drawing functions get the target passed, as in
+parallel mode both cores draw at the same time, each into its own bands of the framebuffer.
+*/
+typedef struct {
+	uint16_t *buf;
+	tilegfx_rect_t rect;
+} render_target_t;
+
+static render_target_t target;
 
 //Set this to 1 to check all writes to the framebuffer. If a tile rendering function contains an error leading
 //to writes outside of the framebuffer, enabling this will cause an abort when that happens.
 #define DEBUG_WRITES 0
 
 #if !DEBUG_WRITES
-#define CHECK_OOB_WRITE(addr)
+#define CHECK_OOB_WRITE(tgt, addr)
 #else
-#define CHECK_OOB_WRITE(addr) do if (addr<fb || addr>=&fb[fb_rect.h*fb_rect.w]) abort(); while(0)
+#define CHECK_OOB_WRITE(tgt, addr) do if (addr<&tgt->buf[tgt->rect.y*fb_rect.w] || \
+			addr>=&tgt->buf[(tgt->rect.y+tgt->rect.h)*fb_rect.w]) abort(); while(0)
 #endif
 
+/*
+Damage tracking, for TILEGFX_INIT_PARTIAL_FLUSH. We keep a short list of rectangles, in framebuffer
+coordinates, that changed since the last flush. Rectangles that touch or overlap get merged; if the list
+is full, the new rectangle is merged with whatever rectangle grows the least because of it. On flush, only
+the damaged regions are sent to the OLED.
+
+To find out what changed, every tilemap render call in a frame gets a 'render slot', which remembers the
+parameters and the (animation-resolved) tiles drawn. If the next frame does the same render call, only the
+tiles that differ are marked as damaged; otherwise the entire destination rectangle is. The slot also keeps a hash
+of the palette of indexed tilesets, so changing the palette damages the entire render. Fades also take a
+render slot, so a fade that starts, stops or changes damages the entire framebuffer.
+
+Regions invalidated by the application stay damaged for one more frame, so whatever the application drew
+there also gets erased from the OLED if the next frame doesn't draw it again.
+*/
+#define MAX_DAMAGE_RECTS 8
+#define MAX_RENDER_SLOTS 8
+
+//Max amount of pixels sent per kchal_send_fb_partial call for a rectangle that is not full-width.
+#define PACK_BUF_PX (KC_SCREEN_W*8)
+
+typedef struct {
+	tilegfx_rect_t rect[MAX_DAMAGE_RECTS];
+	int count;
+} damage_list_t;
+
+typedef struct {
+	const void *key; //map or sprite table rendered; NULL for a fade
+	const tilegfx_tileset_t *gfx;
+	uint32_t pal_hash; //see palette_hash
+	int offx, offy; //For a fade: the color and the fade amount
+	tilegfx_rect_t dest;
+	uint16_t *cells; //Tiles rendered last time (with flip flags), after resolving animation. 0xffff is empty.
+	int valid;
+} render_slot_t;
+
+static damage_list_t damage; //damage for the frame being rendered
+static damage_list_t inval, prev_inval; //explicit invalidations, this and last frame
+static render_slot_t render_slot[MAX_RENDER_SLOTS];
+static int render_slot_count, prev_render_slot_count;
+static int slot_cells; //max amount of tile cells a render can cover, and thus the size of render_slot_t.cells
+static uint16_t *pack_buf;
+
+typedef struct {
+	uint16_t *buf;
+	int full; //send the entire buffer; ignore rects
+	damage_list_t rects; //in OLED coordinates
+	int quit; //tells sender task to exit
+} send_job_t;
+
+static TaskHandle_t sender_task_handle;
+static QueueHandle_t send_queue;
+static SemaphoreHandle_t send_done_sema;
+static void sender_task(void *arg);
+
+/*
+Band mode, for TILEGFX_INIT_BAND_RENDER. There is no framebuffer; render calls only do their damage tracking and
+get recorded in a display list. On flush, the frame is rendered one band of BAND_LINES lines at a time by
+replaying the list into a small buffer, which is then scaled down if needed and sent to the OLED. With
+TILEGFX_INIT_PARTIAL_FLUSH, bands without damage are skipped entirely.
+*/
+#define BAND_LINES 16
+#define MAX_RENDER_CMDS 16
+
+typedef enum {
+	CMD_MAP=0,
+	CMD_SPRITES,
+	CMD_FADE,
+	CMD_LAYERS,
+	CMD_SCROLL,
+} render_cmd_type_t;
+
+//Layered renders get their layers copied into a pool, as the array passed to tilegfx_layers_render may not
+//live until flush.
+#define MAX_POOL_LAYERS (TILEGFX_MAX_LAYERS*2)
+
+typedef struct {
+	render_cmd_type_t type;
+	const void *obj; //map, sprite table, scroll layer or the first of the layers in layer_pool
+	int offx, offy; //For a fade: the color and the fade amount. For layers: the amount of layers.
+	tilegfx_rect_t dest; //cropped to the framebuffer, except for layers
+} render_cmd_t;
+
+static render_cmd_t render_cmd[MAX_RENDER_CMDS];
+static int render_cmd_count;
+static tilegfx_layer_t layer_pool[MAX_POOL_LAYERS];
+static int layer_pool_count;
+static uint16_t *band_buf;
+
+//Render calls only get recorded in these modes; drawing happens on flush.
+#define RECORD_FLAGS (TILEGFX_INIT_BAND_RENDER|TILEGFX_INIT_PARALLEL)
+
+/*
+Parallel mode, for TILEGFX_INIT_PARALLEL. Render calls are recorded in the display list, as in band mode, but there
+is a framebuffer. On flush, the framebuffer is split into bands of BAND_LINES lines; this core replays the display
+list into the even bands while a worker task on the other core does the odd ones. In double_res mode, both then
+scale down half of the lines that need it.
+*/
+typedef enum {
+	PJOB_RENDER=0,
+	PJOB_SCALE,
+	PJOB_QUIT,
+} par_job_type_t;
+
+typedef struct {
+	par_job_type_t type;
+	uint16_t *buf;
+	int ys, ye; //for PJOB_SCALE: output lines to scale
+} par_job_t;
+
+static TaskHandle_t par_task_handle;
+static QueueHandle_t par_queue;
+static SemaphoreHandle_t par_done_sema;
+static int caches_frozen; //set while both cores draw: the animation and chunk caches can't be changed then
+static void par_task(void *arg);
+
+static void render_cmd_add(render_cmd_type_t type, const void *obj, int offx, int offy, const tilegfx_rect_t *dest) {
+	if (render_cmd_count>=MAX_RENDER_CMDS) {
+		printf("tilegfx: too many render calls in one frame, ignoring\n");
+		return;
+	}
+	render_cmd_t *c=&render_cmd[render_cmd_count++];
+	c->type=type;
+	c->obj=obj;
+	c->offx=offx;
+	c->offy=offy;
+	c->dest=*dest;
+}
+
+static inline int rect_area(const tilegfx_rect_t *r) {
+	return r->w*r->h;
+}
+
+//Makes a into the bounding box of a and b
+static void rect_union(tilegfx_rect_t *a, const tilegfx_rect_t *b) {
+	int x2=a->x+a->w, y2=a->y+a->h;
+	if (b->x+b->w>x2) x2=b->x+b->w;
+	if (b->y+b->h>y2) y2=b->y+b->h;
+	if (b->x<a->x) a->x=b->x;
+	if (b->y<a->y) a->y=b->y;
+	a->w=x2-a->x;
+	a->h=y2-a->y;
+}
+
+//Returns true if the rectangles overlap or are directly adjacent
+static int rect_touches(const tilegfx_rect_t *a, const tilegfx_rect_t *b) {
+	return (a->x<=b->x+b->w && b->x<=a->x+a->w && a->y<=b->y+b->h && b->y<=a->y+a->h);
+}
+
+//Crops r to the clip rectangle. Returns false if nothing is left.
+static int rect_clip(tilegfx_rect_t *r, const tilegfx_rect_t *clip) {
+	if (r->x<clip->x) {
+		r->w-=clip->x-r->x;
+		r->x=clip->x;
+	}
+	if (r->y<clip->y) {
+		r->h-=clip->y-r->y;
+		r->y=clip->y;
+	}
+	if (r->x+r->w>clip->x+clip->w) r->w=clip->x+clip->w-r->x;
+	if (r->y+r->h>clip->y+clip->h) r->h=clip->y+clip->h-r->y;
+	return (r->w>0 && r->h>0);
+}
+
+//Crops r to the framebuffer. Returns false if nothing is left.
+static int rect_crop_to_fb(tilegfx_rect_t *r) {
+	if (r->x<0) {
+		r->w+=r->x;
+		r->x=0;
+	}
+	if (r->y<0) {
+		r->h+=r->y;
+		r->y=0;
+	}
+	if (r->x+r->w>fb_rect.w) r->w=fb_rect.w-r->x;
+	if (r->y+r->h>fb_rect.h) r->h=fb_rect.h-r->y;
+	return (r->w>0 && r->h>0);
+}
+
+static void damage_list_add(damage_list_t *l, const tilegfx_rect_t *rect) {
+	tilegfx_rect_t r=*rect;
+	if (!rect_crop_to_fb(&r)) return;
+	//Merge with existing rects, as long as we find any that touch.
+	int i=0;
+	while (i<l->count) {
+		if (rect_touches(&l->rect[i], &r)) {
+			rect_union(&r, &l->rect[i]);
+			l->rect[i]=l->rect[--l->count];
+			i=0;
+		} else {
+			i++;
+		}
+	}
+	if (l->count<MAX_DAMAGE_RECTS) {
+		l->rect[l->count++]=r;
+		return;
+	}
+	//List is full. Merge with the rect that grows the least.
+	int best=0, best_growth=-1;
+	for (i=0; i<l->count; i++) {
+		tilegfx_rect_t u=l->rect[i];
+		rect_union(&u, &r);
+		int growth=rect_area(&u)-rect_area(&l->rect[i]);
+		if (best_growth<0 || growth<best_growth) {
+			best=i;
+			best_growth=growth;
+		}
+	}
+	rect_union(&l->rect[best], &r);
+}
+
+static void damage_add(const tilegfx_rect_t *rect) {
+	if (!(init_flags&TILEGFX_INIT_PARTIAL_FLUSH)) return;
+	damage_list_add(&damage, rect);
+}
+
+void tilegfx_invalidate(const tilegfx_rect_t *rect) {
+	if (!(init_flags&TILEGFX_INIT_PARTIAL_FLUSH)) return;
+	if (!rect) rect=&fb_rect;
+	damage_list_add(&damage, rect);
+	damage_list_add(&inval, rect);
+}
+
+//Returns a hash of the palette of an indexed tileset, or 0 if there is none.
+static uint32_t palette_hash(const tilegfx_tileset_t *gfx) {
+	if (!gfx || gfx->format==TILEGFX_FORMAT_RGB565 || !gfx->palette) return 0;
+	int n=(gfx->format==TILEGFX_FORMAT_INDEXED8)?256:16;
+	uint32_t h=2166136261U; //FNV-1a
+	for (int i=0; i<n; i++) h=(h^gfx->palette[i])*16777619U;
+	return h;
+}
+
+//Gets the render slot for the next render, and damages the destination if the render differs from the one in
+//the same slot last frame. Returns NULL if no slot is available (or damage tracking is off); the render is then
+//entirely damaged. If need_cells is true, the slot gets a cells array to compare tiles.
+static render_slot_t *render_slot_begin(const void *key, const tilegfx_tileset_t *gfx, int need_cells, 
+					int offx, int offy, const tilegfx_rect_t *dest) {
+	if (!(init_flags&TILEGFX_INIT_PARTIAL_FLUSH)) return NULL;
+	if (render_slot_count>=MAX_RENDER_SLOTS) {
+		damage_add(dest);
+		return NULL;
+	}
+	render_slot_t *s=&render_slot[render_slot_count++];
+	uint32_t pal_hash=palette_hash(gfx);
+	if (need_cells && !s->cells) {
+		s->cells=malloc(slot_cells*sizeof(uint16_t));
+		if (!s->cells) {
+			damage_add(dest);
+			return NULL;
+		}
+	}
+	if (!s->valid || s->key!=key || s->gfx!=gfx || s->pal_hash!=pal_hash || s->offx!=offx || s->offy!=offy || 
+			memcmp(&s->dest, dest, sizeof(tilegfx_rect_t))!=0) {
+		//Whatever was drawn in this slot last frame may be gone now, and the new render is all new.
+		if (s->valid) damage_add(&s->dest);
+		damage_add(dest);
+		s->key=key;
+		s->gfx=gfx;
+		s->pal_hash=pal_hash;
+		s->offx=offx;
+		s->offy=offy;
+		s->dest=*dest;
+		s->valid=0; //we don't know what's in the cells
+	}
+	return s;
+}
+
+//Compares a cell in a render slot to what is rendered now, and damages it if different.
+static inline void render_slot_cell(render_slot_t *s, int cell, int tile, int x, int y) {
+	if (s->valid && s->cells[cell]==tile) return;
+	s->cells[cell]=tile;
+	if (s->valid) {
+		tilegfx_rect_t r={.x=x, .y=y, .w=8, .h=8};
+		if (rect_clip(&r, &s->dest)) damage_add(&r);
+	}
+}
+
+//Renders that happened last frame but not this frame leave damage where they were drawn. The same goes
+//for application invalidations.
+static void damage_end_frame() {
+	for (int i=render_slot_count; i<prev_render_slot_count; i++) {
+		if (render_slot[i].valid) damage_add(&render_slot[i].dest);
+		render_slot[i].valid=0;
+	}
+	prev_render_slot_count=render_slot_count;
+	render_slot_count=0;
+	for (int i=0; i<prev_inval.count; i++) damage_add(&prev_inval.rect[i]);
+	prev_inval=inval;
+	inval.count=0;
+}
+
+
+//Returns the tile data of a tileset
+static inline const uint16_t *tile_data(const tilegfx_tileset_t *gfx) {
+	return gfx->tile_data?gfx->tile_data:gfx->tile;
+}
+
+//Returns the amount of 16-bit words of tile data per tile in a tileset
+static inline int tile_words(const tilegfx_tileset_t *gfx) {
+	if (gfx->format==TILEGFX_FORMAT_RGB565) return 64;
+	return (gfx->format==TILEGFX_FORMAT_INDEXED8)?32:16;
+}
+
+//Returns the opaque mask of a tile, or NULL if there is none and pixels need to be compared to trans_col.
+static inline const uint8_t *get_tile_mask(const tilegfx_tileset_t *gfx, int idx) {
+	if (gfx->trans_col==-1 || gfx->opaque_masks==NULL) return NULL;
+	return &gfx->opaque_masks[idx*8];
+}
+
+/*
+Tile cache. Tile data normally is in flash, which is read through the flash cache: a frame that draws many different
+tiles causes a lot of flash cache misses, more so if other things (like sound) are read from flash at the same time.
+With tilegfx_set_tile_cache, the tiles used last are copied into a pool in RAM. Entries are found using a hash table
+on tileset and tile index, and are kept in a list in order of use, so the one used longest ago can be re-used right
+away. While both cores draw, the cache is only read from; parallel_render loads the tiles in view beforehand.
+*/
+#define TC_NONE 0xffff //end of a list
+
+typedef struct {
+	const tilegfx_tileset_t *gfx; //NULL if unused
+	uint16_t idx;
+	uint16_t hash_next; //next entry in the same hash bucket
+	uint16_t prev, next; //use order, most recently used first
+	uint8_t has_mask;
+	uint8_t mask[8];
+	uint16_t data[64]; //tile data, in the format of the tileset
+} tile_cache_t;
+
+static tile_cache_t *tcache;
+static uint16_t *tc_bucket;
+static int tc_buckets; //power of 2
+static uint16_t tc_head=TC_NONE, tc_tail=TC_NONE;
+static uint32_t tc_hits, tc_misses; //this frame
+
+static inline int tc_hash(const tilegfx_tileset_t *gfx, int idx) {
+	return ((((uintptr_t)gfx)>>3)*31+idx)&(tc_buckets-1);
+}
+
+static void tc_unlink(int i) {
+	tile_cache_t *e=&tcache[i];
+	if (e->prev!=TC_NONE) tcache[e->prev].next=e->next; else tc_head=e->next;
+	if (e->next!=TC_NONE) tcache[e->next].prev=e->prev; else tc_tail=e->prev;
+}
+
+static void tc_link(int i, int front) {
+	tile_cache_t *e=&tcache[i];
+	if (front) {
+		e->prev=TC_NONE;
+		e->next=tc_head;
+		if (tc_head!=TC_NONE) tcache[tc_head].prev=i; else tc_tail=i;
+		tc_head=i;
+	} else {
+		e->next=TC_NONE;
+		e->prev=tc_tail;
+		if (tc_tail!=TC_NONE) tcache[tc_tail].next=i; else tc_head=i;
+		tc_tail=i;
+	}
+}
+
+static void tc_hash_remove(int i) {
+	uint16_t *p=&tc_bucket[tc_hash(tcache[i].gfx, tcache[i].idx)];
+	while (*p!=i) p=&tcache[*p].hash_next;
+	*p=tcache[i].hash_next;
+}
+
+static void tile_cache_free() {
+	free(tcache);
+	free(tc_bucket);
+	tcache=NULL;
+	tc_bucket=NULL;
+	tc_head=TC_NONE;
+	tc_tail=TC_NONE;
+}
+
+int tilegfx_set_tile_cache(int tiles) {
+	tile_cache_free();
+	if (tiles<=0) return 1;
+	if (tiles>=TC_NONE) tiles=TC_NONE-1;
+	tc_buckets=1;
+	while (tc_buckets<tiles) tc_buckets*=2;
+	tcache=malloc(tiles*sizeof(tile_cache_t));
+	tc_bucket=malloc(tc_buckets*sizeof(uint16_t));
+	if (!tcache || !tc_bucket) {
+		tile_cache_free();
+		return 0;
+	}
+	memset(tc_bucket, 0xff, tc_buckets*sizeof(uint16_t));
+	for (int i=0; i<tiles; i++) {
+		tcache[i].gfx=NULL;
+		tc_link(i, 0);
+	}
+	return 1;
+}
+
+//Returns the tile data of tile idx, in the format of the tileset, and sets mask to its opaque mask as
+//get_tile_mask does. These come from the tile cache if it's enabled.
+static const uint16_t *tile_src(const tilegfx_tileset_t *gfx, int idx, const uint8_t **mask) {
+	const uint16_t *src=&tile_data(gfx)[idx*tile_words(gfx)];
+	*mask=get_tile_mask(gfx, idx);
+	if (!tcache) return src;
+	uint16_t *bucket=&tc_bucket[tc_hash(gfx, idx)];
+	for (int i=*bucket; i!=TC_NONE; i=tcache[i].hash_next) {
+		tile_cache_t *e=&tcache[i];
+		if (e->gfx!=gfx || e->idx!=idx) continue;
+		if (!caches_frozen) {
+			tc_hits++;
+			if (tc_head!=i) {
+				tc_unlink(i);
+				tc_link(i, 1);
+			}
+		}
+		if (e->has_mask) *mask=e->mask;
+		return e->data;
+	}
+	if (caches_frozen) return src;
+	tc_misses++;
+	//Re-use the entry used longest ago, which is at the end of the list.
+	int i=tc_tail;
+	tile_cache_t *e=&tcache[i];
+	if (e->gfx) tc_hash_remove(i);
+	tc_unlink(i);
+	tc_link(i, 1);
+	e->gfx=gfx;
+	e->idx=idx;
+	e->hash_next=*bucket;
+	*bucket=i;
+	memcpy(e->data, src, tile_words(gfx)*2);
+	e->has_mask=(*mask!=NULL);
+	if (*mask) {
+		memcpy(e->mask, *mask, 8);
+		*mask=e->mask;
+	}
+	return e->data;
+}
+
+//Drops the tiles of a tileset from the cache
+static void tile_cache_forget(const tilegfx_tileset_t *gfx) {
+	if (!tcache) return;
+	for (int i=tc_head; i!=TC_NONE; ) {
+		int next=tcache[i].next;
+		if (tcache[i].gfx==gfx) {
+			tc_hash_remove(i);
+			tcache[i].gfx=NULL;
+			tc_unlink(i);
+			tc_link(i, 0);
+		}
+		i=next;
+	}
+}
+
+//Returns the pixels of a tile, in the framebuffer format. Tiles of indexed tilesets are expanded into buf (64
+//pixels). Mask is set to the opaque mask of the tile; for indexed tilesets with a transparent color but without
+//masks, the mask is generated into maskbuf (8 bytes), as the pixels can't be compared to trans_col.
+static const uint16_t *get_tile_pixels(const tilegfx_tileset_t *gfx, int idx, uint16_t *buf, uint8_t *maskbuf, const uint8_t **mask) {
+	const uint16_t *data=tile_src(gfx, idx, mask);
+	if (gfx->format==TILEGFX_FORMAT_RGB565) return data;
+	const uint16_t *pal=gfx->palette;
+	const uint8_t *src=(const uint8_t*)data;
+	if (gfx->format==TILEGFX_FORMAT_INDEXED8) {
+		for (int i=0; i<64; i++) buf[i]=pal[src[i]];
+	} else {
+		for (int i=0; i<32; i++) {
+			buf[i*2]=pal[src[i]&0xf];
+			buf[i*2+1]=pal[src[i]>>4];
+		}
+	}
+	if (gfx->trans_col!=-1 && *mask==NULL) {
+		for (int y=0; y<8; y++) {
+			int m=0;
+			for (int x=0; x<8; x++) {
+				int i=y*8+x;
+				int c=(gfx->format==TILEGFX_FORMAT_INDEXED8)?src[i]:(src[i/2]>>((i&1)*4))&0xf;
+				if (c!=gfx->trans_col) m|=(1<<x);
+			}
+			maskbuf[y]=m;
+		}
+		*mask=maskbuf;
+	}
+	return buf;
+}
+
+/*
+Flipped tiles. The flip flags in a tilemap entry (and the flip flags of sprites) are turned into a transform number
+0-7 (the entry shifted right by 13, so bit 2 is H, bit 1 is V and bit 0 is D). For every transform, xform_src
+contains the position in the source tile of each pixel of the transformed tile. As in Tiled, the diagonal flip
+is done first. The single flips are the common ones (a mirrored wall, a pipe turned on its side), so they have
+their own copy loops that don't need the table.
+*/
+#define XF_H 4
+#define XF_V 2
+#define XF_D 1
+
+static uint8_t xform_src[8][64];
+static uint8_t rev_bits[256]; //byte with the bits in reverse order, to flip a mask row horizontally
+
+static void xform_init() {
+	for (int i=0; i<256; i++) {
+		int r=0;
+		for (int b=0; b<8; b++) if (i&(1<<b)) r|=0x80>>b;
+		rev_bits[i]=r;
+	}
+	for (int xf=0; xf<8; xf++) {
+		for (int y=0; y<8; y++) {
+			for (int x=0; x<8; x++) {
+				//Undo the flips in reverse order to find the source pixel
+				int sx=(xf&XF_H)?7-x:x;
+				int sy=(xf&XF_V)?7-y:y;
+				xform_src[xf][y*8+x]=(xf&XF_D)?(sx*8+sy):(sy*8+sx);
+			}
+		}
+	}
+}
+
+//Scratch memory to expand and transform tiles in
+typedef struct {
+	uint16_t px[64];
+	uint16_t xpx[64];
+	uint8_t mask[8];
+	uint8_t xmask[8];
+} tile_scratch_t;
+
+//Returns the pixels of tile (a tilemap entry: index plus flip flags, after animation) in the framebuffer format,
+//transformed as needed. Mask is set to the opaque mask as in get_tile_pixels.
+static const uint16_t *get_tile(const tilegfx_tileset_t *gfx, int tile, tile_scratch_t *s, const uint8_t **mask) {
+	const uint16_t *px=get_tile_pixels(gfx, tile&TILEGFX_TILE_IDX_MASK, s->px, s->mask, mask);
+	int xf=tile>>13;
+	if (xf==0) return px;
+	const uint8_t *src=xform_src[xf];
+	if (xf==XF_V) {
+		//Just the row order changes
+		for (int y=0; y<8; y++) memcpy(&s->xpx[y*8], &px[(7-y)*8], 8*2);
+	} else if (xf==XF_H) {
+		for (int y=0; y<8; y++) {
+			const uint16_t *r=&px[y*8+7];
+			uint16_t *d=&s->xpx[y*8];
+			for (int x=0; x<8; x++) d[x]=r[-x];
+		}
+	} else if (xf==XF_D) {
+		//Transpose
+		for (int y=0; y<8; y++) {
+			for (int x=0; x<8; x++) s->xpx[y*8+x]=px[x*8+y];
+		}
+	} else {
+		for (int i=0; i<64; i++) s->xpx[i]=px[src[i]];
+	}
+	if (*mask) {
+		const uint8_t *m=*mask;
+		if (xf==XF_V) {
+			for (int y=0; y<8; y++) s->xmask[y]=m[7-y];
+		} else if (xf==XF_H) {
+			for (int y=0; y<8; y++) s->xmask[y]=rev_bits[m[y]];
+		} else {
+			for (int y=0; y<8; y++) {
+				int r=0;
+				for (int x=0; x<8; x++) {
+					int i=src[y*8+x];
+					r|=((m[i>>3]>>(i&7))&1)<<x;
+				}
+				s->xmask[y]=r;
+			}
+		}
+		*mask=s->xmask;
+	}
+	return s->xpx;
+}
+
+//Copies the pixels of a row of a tile that have their bit set in m, one run of opaque pixels at a time.
+static inline void copy_masked_row(const render_target_t *tgt, uint16_t *dest, const uint16_t *src, unsigned int m) {
+	while (m) {
+		int start=__builtin_ctz(m);
+		int len=__builtin_ctz(~(m>>start));
+		CHECK_OOB_WRITE(tgt, &dest[start]);
+		CHECK_OOB_WRITE(tgt, &dest[start+len-1]);
+		memcpy(&dest[start], &src[start], len*2);
+		m&=~(((1<<len)-1)<<start);
+	}
+}
 
-//Render a tile that is not clipped by the screen extremities
-static void render_tile_full(uint16_t *dest, const uint16_t *tile, int trans_col) {
+//Returns the palette index of pixel i (0-63) of a tile of an indexed tileset. Src is the tile data of the tile.
+static inline int get_tile_color_idx(const tilegfx_tileset_t *gfx, const uint16_t *src, int i) {
+	const uint8_t *s=(const uint8_t*)src;
+	if (gfx->format==TILEGFX_FORMAT_INDEXED8) return s[i];
+	return (s[i/2]>>((i&1)*4))&0xf;
+}
+
+//Returns the pixels of one row of a tile (a tilemap entry: index plus flip flags, after animation), transformed
+//as needed, for rendering line by line. Pixels may end up in buf (8 pixels). M is set to a bitmask of the pixels
+//in the row that are not transparent.
+static const uint16_t *get_tile_row(const tilegfx_tileset_t *gfx, int tile, int row, uint16_t *buf, unsigned int *m) {
+	int idx=tile&TILEGFX_TILE_IDX_MASK;
+	const uint8_t *src=&xform_src[tile>>13][row*8];
+	//Without H or D flip, the row comes from a single source row, in order.
+	int straight=!(tile&(TILEGFX_TILE_FLIP_H|TILEGFX_TILE_FLIP_D));
+	const uint16_t *px=buf;
+	const uint8_t *om;
+	const uint16_t *t=tile_src(gfx, idx, &om);
+	if (gfx->format==TILEGFX_FORMAT_RGB565) {
+		if (straight) {
+			px=&t[src[0]];
+		} else {
+			for (int i=0; i<8; i++) buf[i]=t[src[i]];
+		}
+	} else {
+		for (int i=0; i<8; i++) buf[i]=gfx->palette[get_tile_color_idx(gfx, t, src[i])];
+	}
+
+	unsigned int r=0;
+	if (gfx->trans_col==-1) {
+		r=0xff;
+	} else if (om) {
+		if (straight) {
+			r=om[src[0]>>3];
+		} else {
+			for (int i=0; i<8; i++) r|=((om[src[i]>>3]>>(src[i]&7))&1)<<i;
+		}
+	} else if (gfx->format==TILEGFX_FORMAT_RGB565) {
+		for (int i=0; i<8; i++) if (px[i]!=gfx->trans_col) r|=(1<<i);
+	} else {
+		for (int i=0; i<8; i++) if (get_tile_color_idx(gfx, t, src[i])!=gfx->trans_col) r|=(1<<i);
+	}
+	*m=r;
+	return px;
+}
+
+//Render a tile that is not clipped by the screen extremities. Mask is the opaque mask of the tile, if any.
+static void render_tile_full(const render_target_t *tgt, uint16_t *dest, const uint16_t *tile, int trans_col, const uint8_t *mask) {
+	if (mask) {
+		uint64_t m;
+		memcpy(&m, mask, 8);
+		if (m==0) return; //fully transparent
+		if (m==~0ULL) trans_col=-1; //fully opaque
+	}
 	if (trans_col==-1) {
 		for (int y=0; y<8; y++) {
-			CHECK_OOB_WRITE(&dest[0]);
-			CHECK_OOB_WRITE(&dest[7]);
+			CHECK_OOB_WRITE(tgt, &dest[0]);
+			CHECK_OOB_WRITE(tgt, &dest[7]);
 			memcpy(dest, tile, 8*2);
 			tile+=8;
 			dest+=fb_rect.w;
 		}
+	} else if (mask) {
+		for (int y=0; y<8; y++) {
+			copy_masked_row(tgt, dest, tile, mask[y]);
+			tile+=8;
+			dest+=fb_rect.w;
+		}
 	} else {
 		for (int y=0; y<8; y++) {
 			for (int x=0; x<8; x++) {
 				if (tile[x]!=trans_col) {
-					CHECK_OOB_WRITE(&dest[x]);
+					CHECK_OOB_WRITE(tgt, &dest[x]);
 					dest[x]=tile[x];
 				}
 			}
@@ -55,12 +709,28 @@ static void render_tile_full(uint16_t *dest, const uint16_t *tile, int trans_col
 //Render a tile that is / may be clipped by the screen extremities
 //Argument clip is the clipping region in screen coordinates. Xstart/Ystart indicates the upper left corner of
 //the tile; this may be outside of the clipping region.
-static void render_tile_part(uint16_t *dest, const uint16_t *tile, int xstart, int ystart, const tilegfx_rect_t *clip, int trans_col) {
-	for (int y=0; y<8; y++) {
-		if (y+ystart>=clip->y && y+ystart<clip->y+clip->h) {
-			for (int x=0; x<8; x++) {
-				if (x+xstart>=clip->x && x+xstart<clip->x+clip->w && tile[x]!=trans_col) {
-					CHECK_OOB_WRITE(&dest[x]);
+static void render_tile_part(const render_target_t *tgt, uint16_t *dest, const uint16_t *tile, int xstart, int ystart, const tilegfx_rect_t *clip, int trans_col, const uint8_t *mask) {
+	//Figure out which rows and columns of the tile are visible
+	int c0=0, c1=8, r0=0, r1=8;
+	if (xstart<clip->x) c0=clip->x-xstart;
+	if (xstart+8>clip->x+clip->w) c1=clip->x+clip->w-xstart;
+	if (ystart<clip->y) r0=clip->y-ystart;
+	if (ystart+8>clip->y+clip->h) r1=clip->y+clip->h-ystart;
+	if (c0>=c1 || r0>=r1) return;
+	unsigned int colmask=((1<<c1)-1)&~((1<<c0)-1);
+	tile+=r0*8;
+	dest+=r0*fb_rect.w;
+	for (int y=r0; y<r1; y++) {
+		if (mask) {
+			copy_masked_row(tgt, dest, tile, mask[y]&colmask);
+		} else if (trans_col==-1) {
+			CHECK_OOB_WRITE(tgt, &dest[c0]);
+			CHECK_OOB_WRITE(tgt, &dest[c1-1]);
+			memcpy(&dest[c0], &tile[c0], (c1-c0)*2);
+		} else {
+			for (int x=c0; x<c1; x++) {
+				if (tile[x]!=trans_col) {
+					CHECK_OOB_WRITE(tgt, &dest[x]);
 					dest[x]=tile[x];
 				}
 			}
@@ -70,19 +740,323 @@ static void render_tile_part(uint16_t *dest, const uint16_t *tile, int xstart, i
 	}
 }
 
-static int get_tile_idx(const tilegfx_map_t *tiles, int idx) {
-	if (tiles->gfx->anim_offsets==NULL) return idx;
-	int off=tiles->gfx->anim_offsets[idx];
-	if (off==0xffff) return idx;
-	const tilegfx_anim_frame_t *f=&tiles->gfx->anim_frames[off];
-	uint64_t t_ms=(esp_timer_get_time()-anim_start_time)/1000;
+/*
+Animation. Resolving which frame an animated tile shows needs the current time and a walk over the frames of
+its animation. Instead of doing that for every animated tile drawn, it's done once per frame for every animation
+in a tileset, into a remap table indexed the same as anim_frames: for the first entry of every animation, it
+contains the tile the animation currently shows. The tables for the last few tilesets used are kept around.
+*/
+#define MAX_ANIM_CACHES 4
+
+typedef struct {
+	const tilegfx_tileset_t *gfx;
+	uint32_t frame; //frame_no the remap table was resolved for
+	int valid;
+	uint16_t *remap;
+	int len; //allocated length of remap
+} anim_cache_t;
+
+static anim_cache_t anim_cache[MAX_ANIM_CACHES];
+static uint32_t frame_no; //increases every tilegfx_flush
+
+static uint64_t anim_time_ms() {
+	return (esp_timer_get_time()-anim_start_time)/1000;
+}
+
+//Returns the tile an animation shows at time t_ms. f is the first entry of the animation.
+static int anim_resolve(const tilegfx_anim_frame_t *f, uint64_t t_ms) {
+	if (f->delay_ms==0) return f[1].tile;
 	t_ms=t_ms%f->delay_ms; //first frame is total cycle len
-	while(t_ms) {
-		f++;
-		if (t_ms < f->delay_ms) return f->tile;
+	f++;
+	while (t_ms >= f->delay_ms) {
 		t_ms-=f->delay_ms;
+		f++;
+	}
+	return f->tile;
+}
+
+//Returns the remap table for the animations in the tileset, resolved for the current frame. Returns NULL if the
+//tileset does not have the information needed for that, or if out of memory.
+static const uint16_t *get_anim_remap(const tilegfx_tileset_t *gfx) {
+	if (gfx->anim_offsets==NULL || gfx->anim_frame_count==0) return NULL;
+	anim_cache_t *c=NULL;
+	for (int i=0; i<MAX_ANIM_CACHES; i++) {
+		if (anim_cache[i].gfx==gfx) {
+			c=&anim_cache[i];
+			break;
+		}
+		//Otherwise, re-use the entry that was used the longest time ago.
+		if (!c || !anim_cache[i].valid || (c->valid && frame_no-anim_cache[i].frame > frame_no-c->frame)) {
+			c=&anim_cache[i];
+		}
+	}
+	if (caches_frozen) {
+		//Only use what already was resolved; the other core may be reading the caches.
+		return (c->gfx==gfx && c->valid && c->frame==frame_no)?c->remap:NULL;
+	}
+	if (c->gfx!=gfx) {
+		c->gfx=gfx;
+		c->valid=0;
+	}
+	if (c->valid && c->frame==frame_no) return c->remap;
+	if (c->len<gfx->anim_frame_count) {
+		uint16_t *r=realloc(c->remap, gfx->anim_frame_count*sizeof(uint16_t));
+		if (!r) return NULL;
+		c->remap=r;
+		c->len=gfx->anim_frame_count;
+	}
+	uint64_t t_ms=anim_time_ms();
+	const tilegfx_anim_frame_t *f=gfx->anim_frames;
+	for (int i=0; i<gfx->anim_frame_count; i++) {
+		if (f[i].tile==0xffff) c->remap[i]=anim_resolve(&f[i], t_ms);
+	}
+	c->frame=frame_no;
+	c->valid=1;
+	return c->remap;
+}
+
+//Returns the tile to draw for tile idx. Remap is what get_anim_remap returned for the tileset.
+static inline int get_tile_idx(const tilegfx_tileset_t *gfx, const uint16_t *remap, int idx) {
+	if (gfx->anim_offsets==NULL) return idx;
+	int off=gfx->anim_offsets[idx];
+	if (off==0xffff) return idx;
+	if (remap) return remap[off];
+	return anim_resolve(&gfx->anim_frames[off], anim_time_ms());
+}
+
+/*
+Compressed maps. Their tiles are stored as separately run-length encoded chunks (see tilegfx_map_chunks_t); the
+chunks that are needed are decoded into a small cache, so when scrolling through a map only the chunks that come
+into view are decoded. Code walking over the tiles of a map does that using a chunk cursor, which remembers the
+chunk it last looked at: tiles next to each other are in the same chunk most of the time. After a frame is sent,
+the chunks around the ones that were rendered are decoded as well, so scrolling into them costs nothing.
+*/
+#define CHUNK_TILES (TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE)
+#define CHUNK_CACHE_SLOTS 32 //enough for the chunks on and around a double-size framebuffer
+#define MAX_PREFETCH 8
+
+typedef struct {
+	const tilegfx_map_t *map; //NULL if unused
+	uint32_t offset; //of the encoded chunk. Chunks with the same tiles can share encoded data, and thus an entry.
+	uint32_t used; //chunk_clock value when last used
+	uint16_t tiles[CHUNK_TILES];
+} chunk_cache_t;
+
+typedef struct {
+	int chunk; //chunk tiles points to, or -1 for none yet
+	const uint16_t *tiles;
+	uint16_t scratch[CHUNK_TILES]; //for chunks that can't be put in the cache
+} chunk_cursor_t;
+
+//A render of a compressed map, to prefetch the chunks around
+typedef struct {
+	const tilegfx_map_t *map;
+	int offx, offy;
+	tilegfx_rect_t dest;
+} prefetch_t;
+
+static chunk_cache_t *chunk_cache; //allocated when the first compressed map is used
+static uint32_t chunk_clock;
+static uint32_t chunk_frame_start; //chunk_clock when the frame started; entries used later are in view
+static prefetch_t prefetch[MAX_PREFETCH];
+static int prefetch_count;
+
+static void chunk_decode(const tilegfx_map_t *map, uint32_t offset, uint16_t *tiles) {
+	const tilegfx_map_chunks_t *c=map->chunks;
+	uint16_t buf[TILEGFX_CHUNK_MAX_WORDS];
+	const uint16_t *p;
+	if (c->data) {
+		p=&c->data[offset];
+	} else {
+		c->read(c, offset, buf, TILEGFX_CHUNK_MAX_WORDS);
+		p=buf;
+	}
+	const uint16_t *end=p+TILEGFX_CHUNK_MAX_WORDS;
+	int i=0;
+	while (i<CHUNK_TILES && p<end) {
+		int len=*p&0x7fff;
+		int rep=*p&0x8000;
+		p++;
+		if (len==0 || len>CHUNK_TILES-i || p+(rep?1:len)>end) break; //corrupt data
+		if (rep) {
+			for (int j=0; j<len; j++) tiles[i++]=*p;
+			p++;
+		} else {
+			memcpy(&tiles[i], p, len*2);
+			i+=len;
+			p+=len;
+		}
+	}
+	while (i<CHUNK_TILES) tiles[i++]=0xffff;
+}
+
+//Returns the tiles of chunk n of a compressed map. The returned pointer is only valid until the next call. If
+//scratch is NULL, this only makes sure the chunk is in the cache without evicting chunks that are in view, and
+//returns NULL if that is not possible.
+static const uint16_t *get_chunk(const tilegfx_map_t *map, int n, uint16_t *scratch) {
+	uint32_t offset=map->chunks->index[n];
+	chunk_cache_t *c=NULL;
+	if (chunk_cache) {
+		for (int i=0; i<CHUNK_CACHE_SLOTS; i++) {
+			if (chunk_cache[i].map==map && chunk_cache[i].offset==offset) {
+				if (!caches_frozen) chunk_cache[i].used=++chunk_clock;
+				return chunk_cache[i].tiles;
+			}
+			//Otherwise, re-use the entry that was used the longest time ago.
+			if (!c || !chunk_cache[i].map || (c->map && chunk_cache[i].used < c->used)) c=&chunk_cache[i];
+		}
+	} else if (!caches_frozen) {
+		chunk_cache=calloc(CHUNK_CACHE_SLOTS, sizeof(chunk_cache_t));
+		if (chunk_cache) c=&chunk_cache[0];
+	}
+	if (!scratch && (!c || (c->map && c->used>chunk_frame_start))) return NULL;
+	if (caches_frozen || !c) {
+		//Can't change the cache; decode into the scratch buffer instead.
+		chunk_decode(map, offset, scratch);
+		return scratch;
+	}
+	chunk_decode(map, offset, c->tiles);
+	c->map=map;
+	c->offset=offset;
+	c->used=++chunk_clock;
+	return c->tiles;
+}
+
+//Forgets the cached chunks of a map, e.g. because it is freed.
+static void chunk_cache_forget(const tilegfx_map_t *map) {
+	if (chunk_cache) {
+		for (int i=0; i<CHUNK_CACHE_SLOTS; i++) {
+			if (chunk_cache[i].map==map) chunk_cache[i].map=NULL;
+		}
+	}
+	for (int i=0; i<prefetch_count; i++) {
+		if (prefetch[i].map==map) prefetch[i].map=NULL;
+	}
+}
+
+static inline void chunk_cursor_init(chunk_cursor_t *cur) {
+	cur->chunk=-1;
+	cur->tiles=NULL;
+}
+
+static inline int chunk_no(const tilegfx_map_t *map, int x, int y) {
+	return (y/TILEGFX_CHUNK_SIZE)*((map->w+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE)+x/TILEGFX_CHUNK_SIZE;
+}
+
+//Returns the tile at x,y of a map, which can be either a normal or a compressed one. X and y need to be inside the map.
+static inline int map_cell(const tilegfx_map_t *map, int x, int y, chunk_cursor_t *cur) {
+	if (!map->chunks) return map->tiles[y*map->w+x];
+	int n=chunk_no(map, x, y);
+	if (n!=cur->chunk) {
+		cur->tiles=get_chunk(map, n, cur->scratch);
+		cur->chunk=n;
+	}
+	return cur->tiles[(y%TILEGFX_CHUNK_SIZE)*TILEGFX_CHUNK_SIZE+x%TILEGFX_CHUNK_SIZE];
+}
+
+static inline int wrap(int v, int max) {
+	v%=max;
+	return (v<0)?v+max:v;
+}
+
+//Loads the chunks a render of a compressed map at offx, offy into dest needs into the cache. If margin is not 0,
+//the chunks up to margin tiles around it are loaded as well, but only as far as that doesn't evict chunks in view.
+static void chunk_prefetch(const tilegfx_map_t *map, int offx, int offy, const tilegfx_rect_t *dest, int margin) {
+	if (!map->chunks) return;
+	uint16_t scratch[CHUNK_TILES];
+	int last=-1;
+	int tx=offx>>3, ty=offy>>3; //>> rounds down for negative offsets as well
+	for (int y=ty-margin; y<=((offy+dest->h-1)>>3)+margin; y++) {
+		for (int x=tx-margin; x<=((offx+dest->w-1)>>3)+margin; x++) {
+			int n=chunk_no(map, wrap(x, map->w), wrap(y, map->h));
+			if (n==last) continue;
+			last=n;
+			if (!get_chunk(map, n, margin?NULL:scratch)) return; //cache full
+		}
+	}
+}
+
+static void prefetch_add(const tilegfx_map_t *map, int offx, int offy, const tilegfx_rect_t *dest) {
+	if (!map->chunks || prefetch_count==MAX_PREFETCH) return;
+	prefetch_t *p=&prefetch[prefetch_count++];
+	p->map=map;
+	p->offx=offx;
+	p->offy=offy;
+	p->dest=*dest;
+}
+
+//Decodes the chunks around the compressed maps rendered this frame. Called when the frame is done.
+static void prefetch_chunks() {
+	for (int i=0; i<prefetch_count; i++) {
+		const prefetch_t *p=&prefetch[i];
+		if (p->map) chunk_prefetch(p->map, p->offx, p->offy, &p->dest, TILEGFX_CHUNK_SIZE);
+	}
+	prefetch_count=0;
+	chunk_frame_start=chunk_clock;
+}
+
+uint16_t tilegfx_get_compressed_tile(const tilegfx_map_t *map, int x, int y) {
+	chunk_cursor_t cur;
+	chunk_cursor_init(&cur);
+	return map_cell(map, x, y, &cur);
+}
+
+//Draws the part of a tilemap render that falls in the render target (if draw is true) and compares the tiles
+//to the ones in the render slot (if slot is not NULL). Dest needs to be cropped to the framebuffer, and offx/offy
+//need to be inside the tilemap.
+static void map_draw(const render_target_t *tgt, const tilegfx_map_t *tiles, int offx, int offy, const tilegfx_rect_t *dest, render_slot_t *slot, int draw) {
+	tilegfx_rect_t clip=*dest;
+	if (draw && !rect_clip(&clip, &tgt->rect)) draw=0;
+	if (!draw && !slot) return;
+
+	//Embiggen rendering field to start at the edges of all corner tiles.
+	//We'll cut off the bits outside of dest when we get there.
+	int sx=dest->x-(offx&7);
+	int sy=dest->y-(offy&7);
+	int ex=sx+((dest->w+(offx&7)+7)&~7);
+	int ey=sy+((dest->h+(offy&7)+7)&~7);
+
+	int cell=0;
+	const uint16_t *remap=get_anim_remap(tiles->gfx);
+	tile_scratch_t scratch;
+	chunk_cursor_t cur;
+	chunk_cursor_init(&cur);
+
+	//x and y are the real onscreen coords that may fall outside the framebuffer.
+	int tileposy=offy/8;
+	uint16_t *p=draw?tgt->buf+(fb_rect.w*sy)+sx:NULL;
+	for (int y=sy; y<ey; y+=8) {
+		//Rows of tiles outside of the render target only need to be looked at for the render slot.
+		int row_draw=(draw && y+8>clip.y && y<clip.y+clip.h);
+		if (row_draw || slot) {
+			int tileposx=offx/8;
+			uint16_t *pp=p;
+			for (int x=sx; x<ex; x+=8) {
+				int tileno=map_cell(tiles, tileposx, tileposy, &cur);
+				if (tileno!=0xffff) {
+					//Resolve the animation, keeping the flip flags
+					int flags=tileno&~TILEGFX_TILE_IDX_MASK;
+					tileno=get_tile_idx(tiles->gfx, remap, tileno&TILEGFX_TILE_IDX_MASK)|flags;
+				}
+				if (tileno!=0xffff && row_draw) {
+					const uint8_t *mask;
+					const uint16_t *px=get_tile(tiles->gfx, tileno, &scratch, &mask);
+					if (x < clip.x || y < clip.y || x+7 >= clip.x+clip.w || y+7 >= clip.y+clip.h) {
+						render_tile_part(tgt, pp, px, x, y, &clip, tiles->gfx->trans_col, mask);
+					} else {
+						render_tile_full(tgt, pp, px, tiles->gfx->trans_col, mask);
+					}
+				}
+				if (slot) render_slot_cell(slot, cell++, tileno, x, y);
+				tileposx++;
+				if (tileposx >= tiles->w) tileposx=0; //wraparound
+				if (draw) pp+=8; //we filled these 8 columns
+			}
+		}
+		tileposy++; //skip to next row
+		if (tileposy >= tiles->h) tileposy=0; //wraparound
+		if (draw) p+=fb_rect.w*8; //we filled these 8 lines
 	}
-	return(idx); //should never happen
 }
 
 void tilegfx_tile_map_render(const tilegfx_map_t *tiles, int offx, int offy, const tilegfx_rect_t *rdest) {
@@ -117,47 +1091,500 @@ void tilegfx_tile_map_render(const tilegfx_map_t *tiles, int offx, int offy, con
 	if (offx<0) offx+=tiles->w*8;
 	if (offy<0) offy+=tiles->h*8;
 
-	//Embiggen rendering field to start at the edges of all corner tiles.
-	//We'll cut off the bits outside of dest when we get there.
-	int sx=dest->x-(offx&7);
-	int sy=dest->y-(offy&7);
-	int ex=sx+((dest->w+(offx&7)+7)&~7);
-	int ey=sy+((dest->h+(offy&7)+7)&~7);
+	prefetch_add(tiles, offx, offy, dest);
+	render_slot_t *slot=render_slot_begin(tiles, tiles->gfx, 1, offx, offy, dest);
+	if (init_flags&RECORD_FLAGS) {
+		//Only compare the tiles now; drawing happens on flush.
+		map_draw(NULL, tiles, offx, offy, dest, slot, 0);
+		render_cmd_add(CMD_MAP, tiles, offx, offy, dest);
+	} else {
+		map_draw(&target, tiles, offx, offy, dest, slot, 1);
+	}
+	if (slot) slot->valid=1;
+}
 
-	//x and y are the real onscreen coords that may fall outside the framebuffer.
-	int tileposy=((offy/8)*tiles->w);
-	uint16_t *p=fb+(fb_rect.w*sy)+sx;
-	for (int y=sy; y<ey; y+=8) {
-		int tileposx=offx/8;
-		uint16_t *pp=p;
-		for (int x=sx; x<ex; x+=8) {
-			int tileno=tiles->tiles[tileposx+tileposy];
-			if (tileno!=0xffff) {
-				if (x < dest->x || y < dest->y || x+7 >= dest->x+dest->w || y+7 >= dest->y+dest->h) {
-					render_tile_part(pp, &tiles->gfx->tile[get_tile_idx(tiles, tileno)*64], 
-								x, y, dest, tiles->gfx->trans_col);
-				} else {
-					render_tile_full(pp, &tiles->gfx->tile[get_tile_idx(tiles, tileno)*64], tiles->gfx->trans_col);
+/*
+Layered renders. Instead of drawing every layer in its entirety before going on to the next, all layers are drawn
+one line at a time, back to front, so every line of the render target is only pulled into the cache once. That
+also makes it easy to give every line its own offsets. A line of a layer is drawn as a sequence of (parts of) tile
+rows, using the bitmask of opaque pixels in the tile row to copy runs of pixels.
+*/
+
+//Draws line y of the render target for a layer. Line is the line number relative to dest, clip is dest clipped to
+//the render target.
+static void layer_draw_line(const render_target_t *tgt, const tilegfx_layer_t *l, int line, int y, const tilegfx_rect_t *dest, const tilegfx_rect_t *clip) {
+	const tilegfx_map_t *map=l->map;
+	int mw=map->w*8, mh=map->h*8;
+	int mx=l->offx+(clip->x-dest->x);
+	int my=l->offy+line;
+	if (l->line_offx) mx+=l->line_offx[line];
+	if (l->line_offy) my+=l->line_offy[line];
+	mx%=mw;
+	my%=mh;
+	if (mx<0) mx+=mw;
+	if (my<0) my+=mh;
+
+	//Looked up per line rather than per render: with many layers, the caches for earlier layers may be evicted.
+	const uint16_t *remap=get_anim_remap(map->gfx);
+	chunk_cursor_t cur;
+	chunk_cursor_init(&cur);
+	uint16_t *d=&tgt->buf[y*fb_rect.w+clip->x];
+	uint16_t buf[8];
+	int left=clip->w;
+	while (left>0) {
+		int col=mx&7;
+		int n=8-col;
+		if (n>left) n=left;
+		int tileno=map_cell(map, mx/8, my/8, &cur);
+		if (tileno!=0xffff) {
+			tileno=get_tile_idx(map->gfx, remap, tileno&TILEGFX_TILE_IDX_MASK)|(tileno&~TILEGFX_TILE_IDX_MASK);
+			unsigned int m;
+			const uint16_t *px=get_tile_row(map->gfx, tileno, my&7, buf, &m);
+			//d[0] is column col of the tile
+			copy_masked_row(tgt, d-col, px, m&(((1<<n)-1)<<col));
+		}
+		d+=n;
+		left-=n;
+		mx+=n;
+		if (mx>=mw) mx=0; //wraparound
+	}
+}
+
+//Draws the part of a layered render that falls in the render target. Dest does not need to be cropped.
+static void layers_draw(const render_target_t *tgt, const tilegfx_layer_t *layers, int count, const tilegfx_rect_t *dest) {
+	tilegfx_rect_t clip=*dest;
+	if (!rect_clip(&clip, &tgt->rect)) return;
+	for (int y=clip.y; y<clip.y+clip.h; y++) {
+		for (int i=0; i<count; i++) {
+			if (layers[i].map) layer_draw_line(tgt, &layers[i], y-dest->y, y, dest, &clip);
+		}
+	}
+}
+
+void tilegfx_layers_render(const tilegfx_layer_t *layers, int count, const tilegfx_rect_t *dest) {
+	if (count>TILEGFX_MAX_LAYERS) {
+		printf("tilegfx: too many layers, only rendering %d\n", TILEGFX_MAX_LAYERS);
+		count=TILEGFX_MAX_LAYERS;
+	}
+	tilegfx_rect_t d=dest?*dest:fb_rect;
+	tilegfx_rect_t crop=d;
+	if (!rect_crop_to_fb(&crop)) return;
+	//Line offsets tend to change every frame, so there's no point in comparing anything: the entire render
+	//is damaged. The slot makes sure the area gets sent when the render goes away.
+	render_slot_t *slot=render_slot_begin(layers, NULL, 0, count, 0, &crop);
+	if (slot) slot->valid=1;
+	damage_add(&crop);
+	for (int i=0; i<count; i++) {
+		if (layers[i].map) prefetch_add(layers[i].map, layers[i].offx+crop.x-d.x, layers[i].offy+crop.y-d.y, &crop);
+	}
+	if (init_flags&RECORD_FLAGS) {
+		if (layer_pool_count+count>MAX_POOL_LAYERS) {
+			printf("tilegfx: too many layers in one frame, ignoring\n");
+			return;
+		}
+		tilegfx_layer_t *l=&layer_pool[layer_pool_count];
+		memcpy(l, layers, count*sizeof(tilegfx_layer_t));
+		layer_pool_count+=count;
+		render_cmd_add(CMD_LAYERS, l, count, 0, &d);
+	} else {
+		layers_draw(&target, layers, count, &d);
+	}
+}
+
+/*
+Scroll layers. A scroll layer keeps what it showed last frame in a buffer of its own, a tile bigger than the
+destination in both directions. The buffer wraps around: tile (x, y) of the (endlessly repeating) map is always drawn
+at cell (x%cw, y%ch), so the tiles that stay in view when the view moves don't move in the buffer, and only the cells
+that scrolled into view need to be drawn. Cells whose tile changed, because of an animation or a change to the map,
+are redrawn as well, and everything is redrawn when the palette changes. The visible part of the buffer is then
+copied to the render target, in at most two runs per line. The framebuffer can't be used for this: sprites and fades
+are drawn into it, it is scaled down in place in double_res mode, and there may be two of them or none at all.
+*/
+typedef struct {
+	int x, y; //position in the map, not wrapped around, of the tile in this cell
+	int tile; //tile with flip flags, after animation; -1 if the cell needs to be drawn
+} scroll_cell_t;
+
+typedef struct {
+	tilegfx_rect_t dest; //cropped to the framebuffer
+	int cropx, cropy; //amount cropped off the left and top of the destination
+	const tilegfx_map_t *map; //map and tileset the buffer was drawn from
+	const tilegfx_tileset_t *gfx;
+	uint32_t pal_hash; //see palette_hash
+	int cw, ch; //size of the buffer, in tiles
+	uint16_t *buf; //cw*8 by ch*8 pixels
+	scroll_cell_t *cell;
+} scroll_priv_t;
+
+tilegfx_scroll_layer_t *tilegfx_create_scroll_layer(const tilegfx_map_t *map, const tilegfx_rect_t *dest) {
+	tilegfx_rect_t d=dest?*dest:fb_rect;
+	tilegfx_rect_t crop=d;
+	if (!rect_crop_to_fb(&crop)) return NULL;
+	tilegfx_scroll_layer_t *l=calloc(sizeof(tilegfx_scroll_layer_t), 1);
+	if (!l) return NULL;
+	scroll_priv_t *priv=calloc(sizeof(scroll_priv_t), 1);
+	l->priv=priv;
+	if (!priv) goto err;
+	l->map=map;
+	priv->dest=crop;
+	priv->cropx=crop.x-d.x;
+	priv->cropy=crop.y-d.y;
+	priv->cw=(crop.w+7)/8+1;
+	priv->ch=(crop.h+7)/8+1;
+	priv->buf=malloc(priv->cw*priv->ch*64*2);
+	priv->cell=malloc(priv->cw*priv->ch*sizeof(scroll_cell_t));
+	if (!priv->buf || !priv->cell) goto err;
+	tilegfx_scroll_layer_invalidate(l);
+	return l;
+err:
+	tilegfx_destroy_scroll_layer(l);
+	return NULL;
+}
+
+void tilegfx_destroy_scroll_layer(tilegfx_scroll_layer_t *l) {
+	scroll_priv_t *priv=(scroll_priv_t*)l->priv;
+	if (priv) {
+		free(priv->buf);
+		free(priv->cell);
+		free(priv);
+	}
+	free(l);
+}
+
+void tilegfx_scroll_layer_invalidate(tilegfx_scroll_layer_t *l) {
+	scroll_priv_t *priv=(scroll_priv_t*)l->priv;
+	for (int i=0; i<priv->cw*priv->ch; i++) priv->cell[i].tile=-1;
+}
+
+//Draws a tile (a tilemap entry: index plus flip flags, after animation) into a cell of a scroll layer buffer.
+//Transparent pixels and empty tiles end up black.
+static void scroll_draw_cell(uint16_t *d, int stride, const tilegfx_tileset_t *gfx, int tile) {
+	uint16_t buf[8];
+	for (int y=0; y<8; y++) {
+		if (tile==0xffff) {
+			memset(d, 0, 8*2);
+		} else {
+			unsigned int m;
+			const uint16_t *px=get_tile_row(gfx, tile, y, buf, &m);
+			if (m==0xff) {
+				memcpy(d, px, 8*2);
+			} else {
+				for (int x=0; x<8; x++) d[x]=((m>>x)&1)?px[x]:0;
+			}
+		}
+		d+=stride;
+	}
+}
+
+//Copies the part of a scroll layer at offx, offy that falls in the render target from its buffer.
+static void scroll_draw(const render_target_t *tgt, const scroll_priv_t *p, int offx, int offy) {
+	tilegfx_rect_t clip=p->dest;
+	if (!rect_clip(&clip, &tgt->rect)) return;
+	int bw=p->cw*8, bh=p->ch*8;
+	int bx=wrap(offx+clip.x-p->dest.x, bw);
+	int by=wrap(offy+clip.y-p->dest.y, bh);
+	int n=bw-bx; //pixels until the buffer wraps around
+	if (n>clip.w) n=clip.w;
+	for (int y=clip.y; y<clip.y+clip.h; y++) {
+		const uint16_t *s=&p->buf[by*bw];
+		uint16_t *d=&tgt->buf[y*fb_rect.w+clip.x];
+		CHECK_OOB_WRITE(tgt, &d[0]);
+		CHECK_OOB_WRITE(tgt, &d[clip.w-1]);
+		memcpy(d, &s[bx], n*2);
+		if (n<clip.w) memcpy(&d[n], s, (clip.w-n)*2);
+		by++;
+		if (by==bh) by=0;
+	}
+}
+
+void tilegfx_scroll_layer_render(tilegfx_scroll_layer_t *l, int offx, int offy) {
+	scroll_priv_t *p=(scroll_priv_t*)l->priv;
+	const tilegfx_map_t *map=l->map;
+	uint32_t pal_hash=palette_hash(map->gfx);
+	if (map!=p->map || map->gfx!=p->gfx || pal_hash!=p->pal_hash) {
+		tilegfx_scroll_layer_invalidate(l);
+		p->map=map;
+		p->gfx=map->gfx;
+		p->pal_hash=pal_hash;
+	}
+	offx+=p->cropx;
+	offy+=p->cropy;
+	int mx=wrap(offx, map->w*8), my=wrap(offy, map->h*8);
+	prefetch_add(map, mx, my, &p->dest);
+	//The slot only damages the destination if the offset changed. If not, only the cells redrawn below changed.
+	render_slot_t *slot=render_slot_begin(l, map->gfx, 0, mx, my, &p->dest);
+	int damage_cells=(slot && slot->valid);
+
+	const uint16_t *remap=get_anim_remap(map->gfx);
+	chunk_cursor_t cur;
+	chunk_cursor_init(&cur);
+	int bw=p->cw*8;
+	int tx0=offx>>3, tx1=(offx+p->dest.w-1)>>3; //>> rounds down for negative offsets as well
+	for (int ty=offy>>3; ty<=(offy+p->dest.h-1)>>3; ty++) {
+		int cy=wrap(ty, p->ch);
+		int mapy=wrap(ty, map->h);
+		int cx=wrap(tx0, p->cw);
+		int mapx=wrap(tx0, map->w);
+		for (int tx=tx0; tx<=tx1; tx++) {
+			int tile=map_cell(map, mapx, mapy, &cur);
+			if (tile!=0xffff) {
+				tile=get_tile_idx(map->gfx, remap, tile&TILEGFX_TILE_IDX_MASK)|(tile&~TILEGFX_TILE_IDX_MASK);
+			}
+			scroll_cell_t *c=&p->cell[cy*p->cw+cx];
+			if (c->tile!=tile || c->x!=tx || c->y!=ty) {
+				c->x=tx;
+				c->y=ty;
+				c->tile=tile;
+				scroll_draw_cell(&p->buf[cy*8*bw+cx*8], bw, map->gfx, tile);
+				if (damage_cells) {
+					tilegfx_rect_t r={.x=p->dest.x+tx*8-offx, .y=p->dest.y+ty*8-offy, .w=8, .h=8};
+					if (rect_clip(&r, &p->dest)) damage_add(&r);
 				}
 			}
-			tileposx++;
-			if (tileposx >= tiles->w) tileposx=0; //wraparound
-			pp+=8; //we filled these 8 columns
+			cx++;
+			if (cx==p->cw) cx=0;
+			mapx++;
+			if (mapx==map->w) mapx=0; //wraparound
+		}
+	}
+
+	if (init_flags&RECORD_FLAGS) {
+		//The buffer is up to date already; only the copy happens on flush.
+		render_cmd_add(CMD_SCROLL, p, offx, offy, &p->dest);
+	} else {
+		scroll_draw(&target, p, offx, offy);
+	}
+	if (slot) slot->valid=1;
+}
+
+/*
+Sprites. Every sprite table keeps the order in which its sprites were drawn (sorted by priority) and what
+every sprite looked like when it was last drawn; the order is re-sorted every render, which is cheap as it
+normally does not change much. The last state is used for damage tracking: a sprite that changes damages
+both its old and new location.
+*/
+typedef struct {
+	int x, y; //onscreen position
+	int tile; //tile with flip flags, after animation; 0xffff if not drawn
+	int flags;
+	int priority;
+} sprite_state_t;
+
+typedef struct {
+	uint16_t *order;
+	sprite_state_t *last;
+} sprite_priv_t;
+
+tilegfx_sprite_table_t *tilegfx_create_sprite_table(int count, const tilegfx_tileset_t *gfx) {
+	tilegfx_sprite_table_t *t=calloc(sizeof(tilegfx_sprite_table_t), 1);
+	if (!t) return NULL;
+	sprite_priv_t *priv=calloc(sizeof(sprite_priv_t), 1);
+	t->priv=priv;
+	if (!priv) goto err;
+	t->sprite=calloc(sizeof(tilegfx_sprite_t), count);
+	priv->order=malloc(count*sizeof(uint16_t));
+	priv->last=malloc(count*sizeof(sprite_state_t));
+	if (!t->sprite || !priv->order || !priv->last) goto err;
+	t->gfx=gfx;
+	t->count=count;
+	for (int i=0; i<count; i++) {
+		t->sprite[i].tile=0xffff;
+		priv->order[i]=i;
+		priv->last[i].tile=0xffff;
+	}
+	return t;
+err:
+	tilegfx_destroy_sprite_table(t);
+	return NULL;
+}
+
+void tilegfx_destroy_sprite_table(tilegfx_sprite_table_t *t) {
+	sprite_priv_t *priv=(sprite_priv_t*)t->priv;
+	if (priv) {
+		free(priv->order);
+		free(priv->last);
+		free(priv);
+	}
+	free(t->sprite);
+	free(t);
+}
+
+//Draw a sprite tile with its upper left corner at (x, y), clipped by clip. Clip must be inside the render target.
+static void render_sprite(const render_target_t *tgt, const uint16_t *tile, int x, int y, const tilegfx_rect_t *clip, int trans_col, const uint8_t *mask) {
+	//Figure out which rows and columns of the tile are visible
+	int c0=0, c1=8, r0=0, r1=8;
+	if (x<clip->x) c0=clip->x-x;
+	if (x+8>clip->x+clip->w) c1=clip->x+clip->w-x;
+	if (y<clip->y) r0=clip->y-y;
+	if (y+8>clip->y+clip->h) r1=clip->y+clip->h-y;
+	if (c0>=c1 || r0>=r1) return;
+	unsigned int colmask=((1<<c1)-1)&~((1<<c0)-1);
+	for (int r=r0; r<r1; r++) {
+		const uint16_t *src=&tile[r*8];
+		uint16_t *d=&tgt->buf[(y+r)*fb_rect.w+x+c0]; //d[0] is column c0
+		CHECK_OOB_WRITE(tgt, &d[0]);
+		CHECK_OOB_WRITE(tgt, &d[c1-c0-1]);
+		if (trans_col==-1) {
+			memcpy(d, &src[c0], (c1-c0)*2);
+		} else if (mask) {
+			copy_masked_row(tgt, d-c0, src, mask[r]&colmask);
+		} else {
+			//Copy runs of opaque pixels
+			int c=c0;
+			while (c<c1) {
+				if (src[c]==trans_col) {
+					c++;
+					continue;
+				}
+				int start=c;
+				while (c<c1 && src[c]!=trans_col) c++;
+				memcpy(&d[start-c0], &src[start], (c-start)*2);
+			}
+		}
+	}
+}
+
+//Draws the sprites as they were at the last tilegfx_sprite_table_render call, in order, clipped to clip and the
+//render target.
+static void sprites_draw(const render_target_t *tgt, const tilegfx_sprite_table_t *t, const tilegfx_rect_t *clip) {
+	sprite_priv_t *priv=(sprite_priv_t*)t->priv;
+	tilegfx_rect_t c=*clip;
+	if (!rect_clip(&c, &tgt->rect)) return;
+	tile_scratch_t scratch;
+	for (int i=0; i<t->count; i++) {
+		const sprite_state_t *s=&priv->last[priv->order[i]];
+		if (s->tile==0xffff) continue;
+		int tile=s->tile;
+		if (s->flags&TILEGFX_SPRITE_FLIP_H) tile^=TILEGFX_TILE_FLIP_H;
+		if (s->flags&TILEGFX_SPRITE_FLIP_V) tile^=TILEGFX_TILE_FLIP_V;
+		const uint8_t *mask;
+		const uint16_t *px=get_tile(t->gfx, tile, &scratch, &mask);
+		render_sprite(tgt, px, s->x, s->y, &c, t->gfx->trans_col, mask);
+	}
+}
+
+void tilegfx_sprite_table_render(const tilegfx_sprite_table_t *t, int offx, int offy, const tilegfx_rect_t *dest) {
+	sprite_priv_t *priv=(sprite_priv_t*)t->priv;
+	tilegfx_rect_t clip=dest?*dest:fb_rect;
+	if (!rect_crop_to_fb(&clip)) return;
+	render_slot_t *slot=render_slot_begin(t, t->gfx, 0, offx, offy, &clip);
+	//Onscreen position of sprite coordinate (0,0)
+	int basex=(dest?dest->x:0)-offx;
+	int basey=(dest?dest->y:0)-offy;
+
+	const uint16_t *remap=get_anim_remap(t->gfx);
+
+	//Insertion sort the draw order on priority, keeping sprites of the same priority in table order.
+	uint16_t *order=priv->order;
+	for (int i=1; i<t->count; i++) {
+		int o=order[i];
+		int key=(t->sprite[o].priority<<16)+o;
+		int j=i-1;
+		while (j>=0 && (t->sprite[order[j]].priority<<16)+order[j]>key) {
+			order[j+1]=order[j];
+			j--;
+		}
+		order[j+1]=o;
+	}
+
+	for (int i=0; i<t->count; i++) {
+		int n=order[i];
+		const tilegfx_sprite_t *sp=&t->sprite[n];
+		sprite_state_t now={
+			.x=sp->x+basex,
+			.y=sp->y+basey,
+			.tile=(sp->tile==0xffff)?0xffff:
+					get_tile_idx(t->gfx, remap, sp->tile&TILEGFX_TILE_IDX_MASK)|(sp->tile&~TILEGFX_TILE_IDX_MASK),
+			.flags=sp->flags,
+			.priority=sp->priority
+		};
+		sprite_state_t *last=&priv->last[n];
+		if (slot && slot->valid && memcmp(&now, last, sizeof(now))!=0) {
+			tilegfx_rect_t r={.x=last->x, .y=last->y, .w=8, .h=8};
+			if (last->tile!=0xffff && rect_clip(&r, &clip)) damage_add(&r);
+			r=(tilegfx_rect_t){.x=now.x, .y=now.y, .w=8, .h=8};
+			if (now.tile!=0xffff && rect_clip(&r, &clip)) damage_add(&r);
 		}
-		tileposy+=tiles->w; //skip to next row
-		if (tileposy >= tiles->h*tiles->w) tileposy-=tiles->h*tiles->w; //wraparound
-		p+=fb_rect.w*8; //we filled these 8 lines
+		*last=now;
+	}
+	if (slot) slot->valid=1;
+	if (init_flags&RECORD_FLAGS) {
+		render_cmd_add(CMD_SPRITES, t, 0, 0, &clip);
+	} else {
+		sprites_draw(&target, t, &clip);
 	}
 }
 
 esp_timer_handle_t vbl_timer=NULL;
 SemaphoreHandle_t vbl_sema=NULL;
 
+/*
+Frame pacing. The vblank timer counts vblanks; every frame, flushed or skipped, uses up one of them. Flush waits
+until the vblank of its frame has happened. If that already happened a while ago, the game is running behind:
+tilegfx_skip_frame then tells it to skip rendering frames until it caught up, up to max_frame_skip frames. Any
+vblanks we're behind beyond that are given up on, which makes the game slow down instead.
+*/
+static volatile uint32_t vbl_count; //vblanks since init
+static uint32_t vbl_used; //vblanks used up by flushed or skipped frames
+static int max_frame_skip;
+static int frame_skips; //frames skipped in a row
+static int64_t flush_return_time;
+static tilegfx_frame_stats_t stats;
+
 static void vbl_cb(void *arg) {
+	vbl_count++;
 	xSemaphoreGive(vbl_sema);
 }
 
+void tilegfx_set_max_frame_skip(int max_skip) {
+	max_frame_skip=max_skip;
+}
+
+int tilegfx_skip_frame() {
+	if (frame_skips>=max_frame_skip) return 0;
+	//The vblank this frame should be shown at already passed if we're behind.
+	if ((int32_t)(vbl_count-vbl_used)<1) return 0;
+	vbl_used++;
+	frame_skips++;
+	stats.skipped_frames++;
+	return 1;
+}
+
+void tilegfx_get_frame_stats(tilegfx_frame_stats_t *s) {
+	*s=stats;
+}
+
+//Waits for the vblank of the frame just flushed and updates the stats. Start is when the flush started.
+static void flush_wait_vblank(int64_t start) {
+	int64_t now=esp_timer_get_time();
+	vbl_used++;
+	int behind=(int32_t)(vbl_count-vbl_used);
+	stats.missed_vblanks=(behind>0)?behind:0;
+	stats.total_missed_vblanks+=stats.missed_vblanks;
+	if (behind>max_frame_skip) vbl_used=vbl_count-max_frame_skip; //can't catch up on these
+	while ((int32_t)(vbl_count-vbl_used)<0) xSemaphoreTake(vbl_sema, portMAX_DELAY);
+	stats.frame++;
+	stats.render_us=start-flush_return_time;
+	stats.flush_us=now-start;
+	flush_return_time=esp_timer_get_time();
+	stats.wait_us=flush_return_time-now;
+	stats.tile_cache_hits=tc_hits;
+	stats.tile_cache_misses=tc_misses;
+	tc_hits=0;
+	tc_misses=0;
+	frame_skips=0;
+	frame_no++;
+}
+
 int tilegfx_init(int doublesize, int hz) {
+	return tilegfx_init_custom(doublesize, hz, 0);
+}
+
+int tilegfx_init_custom(int doublesize, int hz, int flags) {
+	xform_init();
+	//Band mode has no framebuffer to double-buffer or to render into in parallel.
+	if (flags&TILEGFX_INIT_BAND_RENDER) flags&=~(TILEGFX_INIT_DOUBLE_BUFFER|TILEGFX_INIT_PARALLEL);
+	init_flags=flags;
 	if (doublesize) {
 		fb_rect.w=KC_SCREEN_W*2;
 		fb_rect.h=KC_SCREEN_H*2;
@@ -165,8 +1592,54 @@ int tilegfx_init(int doublesize, int hz) {
 		fb_rect.w=KC_SCREEN_W;
 		fb_rect.h=KC_SCREEN_H;
 	}
-	fb=malloc(fb_rect.w*fb_rect.h*2);
-	if (!fb) goto err;
+	if (flags&TILEGFX_INIT_BAND_RENDER) {
+		band_buf=malloc(fb_rect.w*BAND_LINES*2);
+		if (!band_buf) goto err;
+	} else {
+		fbs[0]=malloc(fb_rect.w*fb_rect.h*2);
+		if (!fbs[0]) goto err;
+		fb=fbs[0];
+		target.buf=fb;
+		target.rect=fb_rect;
+	}
+	if (flags&TILEGFX_INIT_DOUBLE_BUFFER) {
+		fbs[1]=malloc(fb_rect.w*fb_rect.h*2);
+		if (!fbs[1]) goto err;
+		send_done_sema=xSemaphoreCreateBinary();
+		if (!send_done_sema) goto err;
+		xSemaphoreGive(send_done_sema); //nothing is being sent yet
+		send_queue=xQueueCreate(1, sizeof(send_job_t));
+		if (!send_queue) goto err;
+		//Run the sender on the core we're not on, if there is one.
+		int core=(portNUM_PROCESSORS>1)?!xPortGetCoreID():0;
+		int r=xTaskCreatePinnedToCore(sender_task, "tilegfx_send", 2048, NULL, 5, &sender_task_handle, core);
+		if (!r) goto err;
+	}
+	if (flags&TILEGFX_INIT_PARALLEL) {
+		par_done_sema=xSemaphoreCreateBinary();
+		if (!par_done_sema) goto err;
+		par_queue=xQueueCreate(1, sizeof(par_job_t));
+		if (!par_queue) goto err;
+		int core=(portNUM_PROCESSORS>1)?!xPortGetCoreID():0;
+		int r=xTaskCreatePinnedToCore(par_task, "tilegfx_par", 4096, NULL, 5, &par_task_handle, core);
+		if (!r) goto err;
+	}
+	render_cmd_count=0;
+	layer_pool_count=0;
+	if (flags&TILEGFX_INIT_PARTIAL_FLUSH) {
+		//A render can cover one more tile than fits in the fb in each direction, because of the offset.
+		slot_cells=(fb_rect.w/8+1)*(fb_rect.h/8+1);
+		if (!(flags&TILEGFX_INIT_BAND_RENDER)) {
+			pack_buf=malloc(PACK_BUF_PX*2);
+			if (!pack_buf) goto err;
+		}
+		damage.count=0;
+		inval.count=0;
+		prev_inval.count=0;
+		render_slot_count=0;
+		prev_render_slot_count=0;
+		damage_add(&fb_rect); //first flush needs to send everything
+	}
 	vbl_sema=xSemaphoreCreateBinary();
 	if (!vbl_sema) goto err;
 	const esp_timer_create_args_t args={
@@ -177,8 +1650,14 @@ int tilegfx_init(int doublesize, int hz) {
 	};
 	esp_err_t err=esp_timer_create(&args, &vbl_timer);
 	if (err!=ESP_OK) goto err;
+	vbl_count=0;
+	vbl_used=0;
+	frame_skips=0;
+	memset(&stats, 0, sizeof(stats));
+	flush_return_time=esp_timer_get_time();
 	esp_timer_start_periodic(vbl_timer, 1000000/hz);
 	anim_start_time=0;
+	frame_no=0;
 	return 1;
 err:
 	tilegfx_deinit();
@@ -186,10 +1665,44 @@ err:
 }
 
 void tilegfx_deinit() {
-	if (fb) {
-		free(fb);
-		fb=NULL;
+	if (sender_task_handle) {
+		//Wait for the last frame to be sent, then tell the sender to quit and wait for that.
+		send_job_t job={.quit=1};
+		xSemaphoreTake(send_done_sema, portMAX_DELAY);
+		xQueueSend(send_queue, &job, portMAX_DELAY);
+		xSemaphoreTake(send_done_sema, portMAX_DELAY);
+		sender_task_handle=NULL;
+	}
+	if (send_queue) {
+		vQueueDelete(send_queue);
+		send_queue=NULL;
 	}
+	if (send_done_sema) {
+		vSemaphoreDelete(send_done_sema);
+		send_done_sema=NULL;
+	}
+	if (par_task_handle) {
+		par_job_t job={.type=PJOB_QUIT};
+		xQueueSend(par_queue, &job, portMAX_DELAY);
+		xSemaphoreTake(par_done_sema, portMAX_DELAY);
+		par_task_handle=NULL;
+	}
+	if (par_queue) {
+		vQueueDelete(par_queue);
+		par_queue=NULL;
+	}
+	if (par_done_sema) {
+		vSemaphoreDelete(par_done_sema);
+		par_done_sema=NULL;
+	}
+	for (int i=0; i<2; i++) {
+		free(fbs[i]);
+		fbs[i]=NULL;
+	}
+	fb=NULL;
+	free(band_buf);
+	band_buf=NULL;
+	target.buf=NULL;
 	if (vbl_timer) {
 		esp_timer_delete(vbl_timer);
 		vbl_timer=NULL;
@@ -198,49 +1711,52 @@ void tilegfx_deinit() {
 		vSemaphoreDelete(vbl_sema);
 		vbl_sema=NULL;
 	}
+	for (int i=0; i<MAX_RENDER_SLOTS; i++) {
+		free(render_slot[i].cells);
+		render_slot[i].cells=NULL;
+		render_slot[i].valid=0;
+	}
+	free(pack_buf);
+	pack_buf=NULL;
+	for (int i=0; i<MAX_ANIM_CACHES; i++) {
+		free(anim_cache[i].remap);
+		memset(&anim_cache[i], 0, sizeof(anim_cache_t));
+	}
+	free(chunk_cache);
+	chunk_cache=NULL;
+	prefetch_count=0;
+	tile_cache_free();
 }
 
-//32-bit pixel:
-// p1              p2
-// rrrrrggggggbbbbbrrrrrggggggbbbbb
-//We try to do subpixel rendering, and to this effect, for the subpixel itself:
-//r=r1*0.75+r2*0.25
-//g=g1*0.5+g2*0.5
-//b=b1*0.25+b2*0.75
-//Obviously, we also have to average the two lines of pixels together to keep the aspect ratio.
-
-//rrrr.0ggg.gg0b.bbb0
-//To take the lsb off, and with 0xf7be
-
-//Takes the double-sized fb, scales it back to something that can actually be rendered.
-void undo_x2_scaling() {
-	uint32_t *fbw=(uint32_t*)fb; //fb but accessed 2 16-bit pixels at a time
-	uint16_t *fbp=fb;
-	for (int y=0; y<KC_SCREEN_H; y++) {
-		for (int x=0; x<KC_SCREEN_W; x++) {
-			uint32_t p=fbw[0];
-			uint32_t p2=fbw[KC_SCREEN_W]; //one line down
-			//Colors are stored with the bytes swapped. We need to swap them back.
-			p=((p&0xFF00FF00)>>8)|((p&0x00ff00ff)<<8);
-			p2=((p2&0xFF00FF00)>>8)|((p2&0x00ff00ff)<<8);
-			p=((p&0xf7bef7be)>>1)+((p2&0xf7bef7be)>>1); //average both pixels
-			
-			//It's possible to do this using some code doing bitshifts and parallel
-			//multiplies and stuff to get the most speed out of the CPU. This is not
-			//that code. Pray to the GCC gods that this gets optimized into anything sane.
-			int r=(((p>>27)&0x1F)*3+((p>>11)&0x1f)*1)/4;
-			int g=(((p>>21)&0x3F)+((p>>5)&0x3F))/2;
-			int b=(((p>>16)&0x1F)*1+((p>>0)&0x1f)*3)/4;
-			uint16_t c=(r<<11)+(g<<5)+(b<<0);
-			CHECK_OOB_WRITE(fbp);
-			*fbp++=(c<<8)|(c>>8);
-			fbw++;
-		}
-		fbw+=KC_SCREEN_W; //skip the next line; we already read that.
+//Takes the double-sized buffer buf, scales it back to something that can actually be rendered. Only does
+//output lines ys up to (not including) ye. Lines are processed top to bottom, in place: the output
+//for a line never overwrites input lines that are still needed.
+static void undo_x2_scaling(uint16_t *buf, int ys, int ye) {
+	tilegfx_scale_lines(&buf[ys*KC_SCREEN_W*4], &buf[ys*KC_SCREEN_W], KC_SCREEN_W, ye-ys, scale_mode);
+}
+
+//Scales down output lines ys up to ye of the double-sized framebuffer in buf. In parallel mode, the worker does
+//the lower half of the lines. To not overwrite input lines we still need, it scales them in place, at the start
+//of its input lines; those are only moved to their final spot when both are done.
+static void scale_fb(uint16_t *buf, int ys, int ye) {
+	if (!par_task_handle || ye-ys<2) {
+		undo_x2_scaling(buf, ys, ye);
+		return;
 	}
+	int mid=(ys+ye)/2;
+	par_job_t job={.type=PJOB_SCALE, .buf=buf, .ys=mid, .ye=ye};
+	xQueueSend(par_queue, &job, portMAX_DELAY);
+	undo_x2_scaling(buf, ys, mid);
+	xSemaphoreTake(par_done_sema, portMAX_DELAY);
+	memmove(&buf[mid*KC_SCREEN_W], &buf[mid*KC_SCREEN_W*4], (ye-mid)*KC_SCREEN_W*2);
 }
 
-void tilegfx_fade(uint8_t r, uint8_t g, uint8_t b, uint8_t pct) {
+void tilegfx_set_scale_mode(tilegfx_scale_mode_t mode) {
+	scale_mode=mode;
+}
+
+//Fades the pixels in the render target.
+static void fade_draw(const render_target_t *tgt, uint8_t r, uint8_t g, uint8_t b, uint8_t pct) {
 	//Pre-calculate mixed r, g, b components. rr, rg, rb already will be in the fb format
 	//and can be ORed to be directly written into the fb. pct = 255 for transparent, 0 for only the rgb values given
 	uint16_t rr[32], rg[64], rb[32];
@@ -257,20 +1773,260 @@ void tilegfx_fade(uint8_t r, uint8_t g, uint8_t b, uint8_t pct) {
 		rb[i]=(c>>8)|(c<<8);
 	}
 
-	//Precalculation done. Do actual fade.
-	for (int i=0; i<fb_rect.w*fb_rect.h; i++) {
-		uint16_t c=fb[i];
+	//Precalculation done. Do actual fade. The render target always consists of full-width lines.
+	uint16_t *p=&tgt->buf[tgt->rect.y*fb_rect.w];
+	for (int i=0; i<fb_rect.w*tgt->rect.h; i++) {
+		uint16_t c=p[i];
 		c=(c<<8)|(c>>8);
-		fb[i]=rr[c>>11]|rg[(c>>5)&0x3f]|rb[c&0x1f];
+		p[i]=rr[c>>11]|rg[(c>>5)&0x3f]|rb[c&0x1f];
+	}
+}
+
+void tilegfx_fade(uint8_t r, uint8_t g, uint8_t b, uint8_t pct) {
+	render_slot_t *slot=render_slot_begin(NULL, NULL, 0, (r<<16)|(g<<8)|b, pct, &fb_rect);
+	if (slot) slot->valid=1;
+	if (init_flags&RECORD_FLAGS) {
+		render_cmd_add(CMD_FADE, NULL, (r<<16)|(g<<8)|b, pct, &fb_rect);
+	} else {
+		fade_draw(&target, r, g, b, pct);
+	}
+}
+
+//Sends a rectangle of a (native resolution) framebuffer to the OLED.
+static void send_rect(const uint16_t *buf, const tilegfx_rect_t *r) {
+	if (r->w==KC_SCREEN_W) {
+		//Full-width lines are contiguous in the fb already.
+		kchal_send_fb_partial(&buf[r->y*KC_SCREEN_W], 0, r->y, r->h, r->w);
+		return;
 	}
+	//Copy the rectangle into a contiguous buffer, a bunch of lines at a time.
+	int lines=PACK_BUF_PX/r->w;
+	for (int y=r->y; y<r->y+r->h; y+=lines) {
+		int h=lines;
+		if (y+h>r->y+r->h) h=r->y+r->h-y;
+		for (int i=0; i<h; i++) {
+			memcpy(&pack_buf[i*r->w], &buf[(y+i)*KC_SCREEN_W+r->x], r->w*2);
+		}
+		kchal_send_fb_partial(pack_buf, r->x, y, h, r->w);
+	}
+}
+
+static void send_job(const send_job_t *job) {
+	if (job->full) {
+		kchal_send_fb(job->buf);
+	} else {
+		for (int i=0; i<job->rects.count; i++) send_rect(job->buf, &job->rects.rect[i]);
+	}
+}
+
+//With TILEGFX_INIT_DOUBLE_BUFFER, this task sends finished frames to the OLED while the next one is rendered.
+static void sender_task(void *arg) {
+	send_job_t job;
+	while(1) {
+		xQueueReceive(send_queue, &job, portMAX_DELAY);
+		if (job.quit) break;
+		send_job(&job);
+		xSemaphoreGive(send_done_sema);
+	}
+	xSemaphoreGive(send_done_sema);
+	vTaskDelete(NULL);
+}
+
+//Scales down the damaged region and figures out what to send.
+static void prepare_damage_job(send_job_t *job) {
+	damage_end_frame();
+	job->full=0;
+	job->rects.count=0;
+	if (damage.count==0) return;
+	//Convert to OLED coordinates, and find out how many lines need scaling and how much we need to send.
+	int scale=(fb_rect.w==KC_SCREEN_W)?1:2;
+	int ys=KC_SCREEN_H, ye=0, area=0;
+	for (int i=0; i<damage.count; i++) {
+		tilegfx_rect_t *r=&damage.rect[i];
+		if (scale==2) {
+			int x2=(r->x+r->w+1)/2, y2=(r->y+r->h+1)/2;
+			r->x/=2;
+			r->y/=2;
+			r->w=x2-r->x;
+			r->h=y2-r->y;
+		}
+		if (r->y<ys) ys=r->y;
+		if (r->y+r->h>ye) ye=r->y+r->h;
+		area+=rect_area(r);
+	}
+	//If most of the screen changed, sending everything in one go is cheaper. Everything then needs to be scaled.
+	int full=(area>=(KC_SCREEN_W*KC_SCREEN_H*3)/4);
+	if (full) {
+		ys=0;
+		ye=KC_SCREEN_H;
+	}
+	if (scale==2) scale_fb(fb, ys, ye);
+	if (full) {
+		job->full=1;
+	} else {
+		job->rects=damage;
+	}
+	damage.count=0;
+}
+
+//Returns true if any damage falls inside r
+static int damage_in(const tilegfx_rect_t *r) {
+	for (int i=0; i<damage.count; i++) {
+		tilegfx_rect_t d=damage.rect[i];
+		if (rect_clip(&d, r)) return 1;
+	}
+	return 0;
+}
+
+//Replays the display list into the render target
+static void replay_cmds(const render_target_t *tgt) {
+	for (int i=0; i<render_cmd_count; i++) {
+		const render_cmd_t *c=&render_cmd[i];
+		if (c->type==CMD_MAP) {
+			map_draw(tgt, (const tilegfx_map_t*)c->obj, c->offx, c->offy, &c->dest, NULL, 1);
+		} else if (c->type==CMD_SPRITES) {
+			sprites_draw(tgt, (const tilegfx_sprite_table_t*)c->obj, &c->dest);
+		} else if (c->type==CMD_LAYERS) {
+			layers_draw(tgt, (const tilegfx_layer_t*)c->obj, c->offx, &c->dest);
+		} else if (c->type==CMD_SCROLL) {
+			scroll_draw(tgt, (const scroll_priv_t*)c->obj, c->offx, c->offy);
+		} else {
+			fade_draw(tgt, c->offx>>16, c->offx>>8, c->offx, c->offy);
+		}
+	}
+}
+
+//Renders the frame in band mode by replaying the display list for every band, and sends the bands to the OLED.
+static void band_flush() {
+	int scale=(fb_rect.w==KC_SCREEN_W)?1:2;
+	if (init_flags&TILEGFX_INIT_PARTIAL_FLUSH) damage_end_frame();
+	for (int y=0; y<fb_rect.h; y+=BAND_LINES) {
+		tilegfx_rect_t band={.x=0, .y=y, .w=fb_rect.w, .h=BAND_LINES};
+		if (!rect_crop_to_fb(&band)) break;
+		if ((init_flags&TILEGFX_INIT_PARTIAL_FLUSH) && !damage_in(&band)) continue;
+		target.buf=band_buf-y*fb_rect.w;
+		target.rect=band;
+		//Whatever isn't drawn over is black, as the buffer doesn't hold the previous frame.
+		memset(band_buf, 0, band.w*band.h*2);
+		replay_cmds(&target);
+		if (scale==2) undo_x2_scaling(band_buf, 0, band.h/2);
+		kchal_send_fb_partial(band_buf, 0, y/scale, band.h/scale, KC_SCREEN_W);
+	}
+	render_cmd_count=0;
+	layer_pool_count=0;
+	damage.count=0;
+}
+
+//Replays the display list into every other band of the framebuffer buf, starting with band first.
+static void render_bands(uint16_t *buf, int first) {
+	for (int y=first*BAND_LINES; y<fb_rect.h; y+=BAND_LINES*2) {
+		render_target_t t={.buf=buf, .rect={.x=0, .y=y, .w=fb_rect.w, .h=BAND_LINES}};
+		rect_crop_to_fb(&t.rect);
+		replay_cmds(&t);
+	}
+}
+
+//Worker for parallel mode, running on the other core.
+static void par_task(void *arg) {
+	par_job_t job;
+	while(1) {
+		xQueueReceive(par_queue, &job, portMAX_DELAY);
+		if (job.type==PJOB_QUIT) break;
+		if (job.type==PJOB_RENDER) {
+			render_bands(job.buf, 1);
+		} else {
+			//See scale_fb
+			uint16_t *p=&job.buf[job.ys*KC_SCREEN_W*4];
+			tilegfx_scale_lines(p, p, KC_SCREEN_W, job.ye-job.ys, scale_mode);
+		}
+		xSemaphoreGive(par_done_sema);
+	}
+	xSemaphoreGive(par_done_sema);
+	vTaskDelete(NULL);
+}
+
+//Loads the tiles a render of a map at offx, offy into dest shows into the tile cache.
+static void tile_cache_fill(const tilegfx_map_t *map, int offx, int offy, const tilegfx_rect_t *dest) {
+	if (!tcache) return;
+	const uint16_t *remap=get_anim_remap(map->gfx);
+	chunk_cursor_t cur;
+	chunk_cursor_init(&cur);
+	const uint8_t *mask;
+	for (int y=offy>>3; y<=(offy+dest->h-1)>>3; y++) {
+		for (int x=offx>>3; x<=(offx+dest->w-1)>>3; x++) {
+			int t=map_cell(map, wrap(x, map->w), wrap(y, map->h), &cur);
+			if (t!=0xffff) tile_src(map->gfx, get_tile_idx(map->gfx, remap, t&TILEGFX_TILE_IDX_MASK), &mask);
+		}
+	}
+}
+
+//Renders the display list into the framebuffer on both cores.
+static void parallel_render() {
+	//Resolve the animations, decode the visible chunks of compressed maps and load the visible tiles into the tile
+	//cache beforehand, as the caches can't be updated while both cores are drawing. Anything only visible because
+	//of per-line offsets is decoded or read from flash while drawing.
+	for (int i=0; i<render_cmd_count; i++) {
+		const render_cmd_t *c=&render_cmd[i];
+		if (c->type==CMD_MAP) {
+			const tilegfx_map_t *map=(const tilegfx_map_t*)c->obj;
+			get_anim_remap(map->gfx);
+			chunk_prefetch(map, c->offx, c->offy, &c->dest, 0);
+			tile_cache_fill(map, c->offx, c->offy, &c->dest);
+		} else if (c->type==CMD_LAYERS) {
+			const tilegfx_layer_t *l=(const tilegfx_layer_t*)c->obj;
+			tilegfx_rect_t clip=c->dest;
+			if (!rect_clip(&clip, &fb_rect)) continue;
+			for (int j=0; j<c->offx; j++) {
+				if (!l[j].map) continue;
+				get_anim_remap(l[j].map->gfx);
+				chunk_prefetch(l[j].map, l[j].offx+clip.x-c->dest.x, l[j].offy+clip.y-c->dest.y, &clip, 0);
+				tile_cache_fill(l[j].map, l[j].offx+clip.x-c->dest.x, l[j].offy+clip.y-c->dest.y, &clip);
+			}
+		} else if (c->type==CMD_SPRITES && tcache) {
+			const tilegfx_sprite_table_t *t=(const tilegfx_sprite_table_t*)c->obj;
+			const sprite_priv_t *priv=(const sprite_priv_t*)t->priv;
+			const uint8_t *mask;
+			for (int j=0; j<t->count; j++) {
+				if (priv->last[j].tile!=0xffff) tile_src(t->gfx, priv->last[j].tile&TILEGFX_TILE_IDX_MASK, &mask);
+			}
+		}
+	}
+	caches_frozen=1;
+	par_job_t job={.type=PJOB_RENDER, .buf=fb};
+	xQueueSend(par_queue, &job, portMAX_DELAY);
+	render_bands(fb, 0);
+	xSemaphoreTake(par_done_sema, portMAX_DELAY);
+	caches_frozen=0;
+	render_cmd_count=0;
+	layer_pool_count=0;
 }
 
 void tilegfx_flush() {
-	if (fb_rect.w!=KC_SCREEN_W) {
-		undo_x2_scaling();
+	int64_t start=esp_timer_get_time();
+	send_job_t job={.buf=fb, .full=1, .quit=0};
+	if (init_flags&TILEGFX_INIT_BAND_RENDER) {
+		band_flush();
+		prefetch_chunks();
+		flush_wait_vblank(start);
+		return;
+	}
+	if (init_flags&TILEGFX_INIT_PARALLEL) parallel_render();
+	if (init_flags&TILEGFX_INIT_PARTIAL_FLUSH) {
+		prepare_damage_job(&job);
+	} else if (fb_rect.w!=KC_SCREEN_W) {
+		scale_fb(fb, 0, KC_SCREEN_H);
 	}
-	kchal_send_fb(fb);
-	xSemaphoreTake(vbl_sema, portMAX_DELAY);
+	if (sender_task_handle) {
+		//Wait until the other buffer is sent, hand this one to the sender and continue in the other one.
+		xSemaphoreTake(send_done_sema, portMAX_DELAY);
+		xQueueSend(send_queue, &job, portMAX_DELAY);
+		fb=(fb==fbs[0])?fbs[1]:fbs[0];
+		target.buf=fb;
+	} else {
+		send_job(&job);
+	}
+	prefetch_chunks();
+	flush_wait_vblank(start);
 }
 
 tilegfx_map_t *tilegfx_create_tilemap(int w, int h, const tilegfx_tileset_t *tiles) {
@@ -279,19 +2035,40 @@ tilegfx_map_t *tilegfx_create_tilemap(int w, int h, const tilegfx_tileset_t *til
 	ret->w=w;
 	ret->h=h;
 	ret->gfx=tiles;
+	ret->chunks=NULL;
 	memset((void*)ret->tiles, 0xff, h*w*2);
 	return ret;
 }
 
 
 void tilegfx_destroy_tilemap(tilegfx_map_t *map) {
+	chunk_cache_forget(map);
 	free(map);
 }
 
+void tilegfx_forget_tileset(const tilegfx_tileset_t *gfx) {
+	tile_cache_forget(gfx);
+	for (int i=0; i<MAX_ANIM_CACHES; i++) {
+		if (anim_cache[i].gfx==gfx) {
+			anim_cache[i].gfx=NULL;
+			anim_cache[i].valid=0;
+		}
+	}
+}
+
 tilegfx_map_t *tilegfx_dup_tilemap(const tilegfx_map_t *orig) {
 	tilegfx_map_t *ret=tilegfx_create_tilemap(orig->w, orig->h, orig->gfx);
 	if (!ret) return NULL;
-	memcpy((void*)ret->tiles, orig->tiles, ret->h*ret->w*2);
+	if (orig->chunks) {
+		uint16_t *t=(uint16_t*)ret->tiles;
+		chunk_cursor_t cur;
+		chunk_cursor_init(&cur);
+		for (int y=0; y<ret->h; y++) {
+			for (int x=0; x<ret->w; x++) *t++=map_cell(orig, x, y, &cur);
+		}
+	} else {
+		memcpy((void*)ret->tiles, orig->tiles, ret->h*ret->w*2);
+	}
 	return ret;
 }
 
@@ -17,18 +17,72 @@ typedef struct {
 	uint16_t tile;		/*!< Tile index for frame. 0xffff on 0th frame of a seq. */
 } tilegfx_anim_frame_t;
 
+/**
+ * @brief Ways the graphics data of a tileset can be stored
+ */
+typedef enum {
+	TILEGFX_FORMAT_RGB565=0,	/*!< 64 RGB565 pixels per tile */
+	TILEGFX_FORMAT_INDEXED8,	/*!< 64 bytes per tile; every byte is an index into the palette */
+	TILEGFX_FORMAT_INDEXED4,	/*!< 32 bytes per tile; every byte holds two palette indexes, the first pixel in the lower nibble */
+} tilegfx_format_t;
+
+#define TILEGFX_COLLISION_FLAGS 8	/*!< Amount of collision flags a tile can have */
+
 /**
  * @brief Structure describing a set of tiles, usable in a tilemap.
  */
 typedef struct {
-	int trans_col;					/*!< transparent color, or -1 if none */
+	int trans_col;					/*!< transparent color, or -1 if none. For indexed formats, this is a palette index. */
+	const uint8_t *opaque_masks;	/*!< Optional, only used if trans_col is not -1: 8 bytes per tile, one per row, with */
+									/*!< bit n set if pixel n of the row is not transparent. NULL to check every pixel. */
 	const uint16_t *anim_offsets;	/*!< Array of offsets into the animation frames array. Indexed by tile index. */
 									/*!< If a tile is animated, it will have an offset number in this array at its  */
 									/*!< index. That offset is 0xffff if no animation. */
 	const tilegfx_anim_frame_t *anim_frames; /*< Pointer to array describing the various animations in the tileset */
-	const uint16_t tile[];			/*!< Raw tile data. Each tile is 64 16-bit words worth of graphics data. */
+	int anim_frame_count;			/*!< Amount of entries in anim_frames. If 0, animations are resolved for every tile */
+									/*!< rendered instead of once per frame. */
+	tilegfx_format_t format;		/*!< Format of the tile data */
+	uint16_t *palette;				/*!< For indexed formats: the colors of the palette indexes, in RAM: 256 entries */
+									/*!< for TILEGFX_FORMAT_INDEXED8, 16 for TILEGFX_FORMAT_INDEXED4. Can be modified */
+									/*!< at runtime to change the colors of all tiles at once; with */
+									/*!< TILEGFX_INIT_PARTIAL_FLUSH, renders using the tileset are then sent entirely. */
+	const uint16_t *tile_data;		/*!< If not NULL, the tile data is here instead of in tile[]. Used for tilesets */
+									/*!< loaded from a file. */
+	const uint32_t *collision[TILEGFX_COLLISION_FLAGS]; /*!< Optional: for every collision flag, a bitset of the */
+									/*!< tiles that have it (tile n is bit n%32 of word n/32), or NULL if no tile */
+									/*!< has it. See tilegfx_collision.h. */
+	const uint16_t tile[];			/*!< Raw tile data. For TILEGFX_FORMAT_RGB565, each tile is 64 16-bit words worth */
+									/*!< of graphics data; for indexed formats, it is 32 or 16 words per tile. */
 } tilegfx_tileset_t;
 
+#define TILEGFX_TILE_FLIP_H (1<<15)	/*!< Set in a tilemap entry to mirror the tile horizontally */
+#define TILEGFX_TILE_FLIP_V (1<<14)	/*!< Set in a tilemap entry to mirror the tile vertically */
+#define TILEGFX_TILE_FLIP_D (1<<13)	/*!< Set in a tilemap entry to mirror the tile diagonally (swap x and y); this is */
+									/*!< done before the other flips. FLIP_D|FLIP_H rotates the tile 90 degrees clockwise. */
+#define TILEGFX_TILE_IDX_MASK 0x1fff	/*!< Bits of a tilemap entry that contain the tile index */
+
+#define TILEGFX_CHUNK_SIZE 8			/*!< Width and height, in tiles, of a chunk of a compressed tilemap */
+#define TILEGFX_CHUNK_MAX_WORDS (TILEGFX_CHUNK_SIZE*TILEGFX_CHUNK_SIZE*2) /*!< Max length of an encoded chunk */
+
+/**
+ * @brief Compressed tiles of a tilemap
+ *
+ * The map is cut into chunks of TILEGFX_CHUNK_SIZE x TILEGFX_CHUNK_SIZE tiles, left to right and top to bottom,
+ * with chunks on the right and bottom edge padded with 0xffff. Every chunk is run-length encoded on its own, row
+ * by row, as a sequence of runs: a word with a count in the lower 15 bits and bit 15 set is followed by one tile
+ * entry that is repeated count times; a word with bit 15 clear is followed by count literal tile entries. An
+ * encoded chunk is never longer than TILEGFX_CHUNK_MAX_WORDS.
+ */
+typedef struct tilegfx_map_chunks_t tilegfx_map_chunks_t;
+struct tilegfx_map_chunks_t {
+	const uint32_t *index;			/*!< Offset of every chunk in the encoded data, in words */
+	const uint16_t *data;			/*!< Encoded chunks, or NULL if they are fetched using read */
+	void (*read)(const tilegfx_map_chunks_t *chunks, uint32_t offset, uint16_t *buf, int len);
+									/*!< If data is NULL: called to copy len words of encoded chunks, starting at */
+									/*!< word offset, into buf. Can be asked for words past the end of the last */
+									/*!< chunk, and can be called from both CPU cores at the same time. */
+};
+
 /**
  * @brief Structure describing a tilemap
  */
@@ -36,9 +90,37 @@ typedef struct {
 	int h;							/*!< Height of the tilemap, in tiles */
 	int w;							/*!< Width of the tilemap, in tiles */
 	const tilegfx_tileset_t *gfx;	/*!< Pointer to the tileset used in the map */
-	const uint16_t tiles[];			/*!< Array of the tiles in the map. Values can be 0xffff for no tile. */
+	const tilegfx_map_chunks_t *chunks;	/*!< For compressed maps, the compressed tiles; tiles[] is empty then. NULL */
+									/*!< for normal maps. */
+	const uint16_t tiles[];			/*!< Array of the tiles in the map: tile index ORed with TILEGFX_TILE_FLIP_* flags. */
+									/*!< Values can be 0xffff for no tile. */
 } tilegfx_map_t;
 
+#define TILEGFX_SPRITE_FLIP_H (1<<0) /*!< Mirror the sprite horizontally */
+#define TILEGFX_SPRITE_FLIP_V (1<<1) /*!< Mirror the sprite vertically */
+
+/**
+ * @brief Structure describing one sprite
+ */
+typedef struct {
+	int16_t x;			/*!< X position of the upper left corner of the sprite */
+	int16_t y;			/*!< Y position of the upper left corner of the sprite */
+	uint16_t tile;		/*!< Tile index in the tileset of the sprite table, optionally ORed with TILEGFX_TILE_FLIP_* */
+						/*!< flags, or 0xffff to not draw this sprite */
+	uint8_t priority;	/*!< Sprites with a higher priority are drawn over sprites with a lower priority */
+	uint8_t flags;		/*!< Bitmap of TILEGFX_SPRITE_* flags */
+} tilegfx_sprite_t;
+
+/**
+ * @brief Structure describing a table of sprites
+ */
+typedef struct {
+	const tilegfx_tileset_t *gfx;	/*!< Tileset the sprite tiles come from */
+	int count;						/*!< Amount of sprites in the table */
+	tilegfx_sprite_t *sprite;		/*!< Array of count sprites. Modify these to move or change sprites. */
+	void *priv;						/*!< Internal state, do not modify */
+} tilegfx_sprite_table_t;
+
 /**
  * @brief Structure describing a rectangle
  */
@@ -62,6 +144,78 @@ typedef struct {
  */
 int tilegfx_init(int double_res, int hz);
 
+#define TILEGFX_INIT_PARTIAL_FLUSH (1<<0) /*!< Only send the regions of the framebuffer that changed to the OLED */
+#define TILEGFX_INIT_DOUBLE_BUFFER (1<<1) /*!< Send frames to the OLED in the background, while rendering the next one */
+#define TILEGFX_INIT_BAND_RENDER (1<<2) /*!< Don't allocate a framebuffer; render and send the frame in bands on flush */
+#define TILEGFX_INIT_PARALLEL (1<<3) /*!< Render the frame on flush, using both CPU cores */
+
+/**
+ * @brief Initialize tilegfx system in a custom fashion
+ *
+ * Same as tilegfx_init but takes flags to get custom behaviour.
+ *
+ * With TILEGFX_INIT_PARTIAL_FLUSH, tilegfx keeps track of which regions of the framebuffer changed since
+ * the previous frame, and tilegfx_flush only sends those to the OLED. Tilemap renders are compared to
+ * the same render (as in: the render call made at the same point in the sequence of calls) in the previous
+ * frame; if the map, offset and destination rectangle are the same, only the tiles that changed are marked
+ * as damaged. If the palette of an indexed tileset changed, the entire render is. If you change the framebuffer
+ * in any other way (e.g. by poking pixels into the buffer returned by tilegfx_get_fb()), you need to tell
+ * tilegfx using tilegfx_invalidate().
+ *
+ * With TILEGFX_INIT_DOUBLE_BUFFER, tilegfx allocates two framebuffers. tilegfx_flush hands the finished one
+ * to a task on the other CPU core, which sends it to the OLED, and returns immediately so the next frame can
+ * be rendered into the other buffer. This needs twice the framebuffer memory, and as the buffers alternate,
+ * every frame needs to be rendered in its entirety: the buffer does not contain the previous frame.
+ *
+ * With TILEGFX_INIT_BAND_RENDER, there is no framebuffer at all, which saves a lot of memory (especially in
+ * double_res mode, where the framebuffer takes 40K). Instead, render calls are recorded, and tilegfx_flush
+ * renders the frame a band of 16 lines at a time into a small buffer and sends each band to the OLED. This has
+ * a few consequences: tilemaps are read on flush, so they should not be modified between rendering and flushing,
+ * tilegfx_get_fb() returns NULL, every frame needs to be rendered in its entirety (anything not drawn is black),
+ * and at most 16 render calls can be done per frame. TILEGFX_INIT_DOUBLE_BUFFER is ignored in this mode.
+ *
+ * With TILEGFX_INIT_PARALLEL, render calls are also recorded and only executed on tilegfx_flush, but into
+ * the framebuffer: half of it is rendered by a task on the other CPU core. In double_res mode, scaling down the
+ * framebuffer is split over both cores as well. As with TILEGFX_INIT_BAND_RENDER, tilemaps should not be modified
+ * between rendering and flushing and at most 16 render calls can be done per frame. Anything drawn directly into
+ * the framebuffer ends up below whatever the render calls of that frame draw. This flag is ignored in combination
+ * with TILEGFX_INIT_BAND_RENDER.
+ *
+ * @param double_res See tilegfx_init
+ * @param hz See tilegfx_init
+ * @param flags Bitmap of TILEGFX_INIT_* flags
+ * @return True if succesful, false if out of memory.
+ */
+int tilegfx_init_custom(int double_res, int hz, int flags);
+
+/**
+ * @brief Mark a region of the framebuffer as changed
+ *
+ * Only needed when tilegfx is initialized with TILEGFX_INIT_PARTIAL_FLUSH: this makes sure the region is
+ * sent to the OLED on the next tilegfx_flush call.
+ *
+ * @param rect Region that changed, in framebuffer coordinates, or NULL to mark the entire framebuffer
+ */
+void tilegfx_invalidate(const tilegfx_rect_t *rect);
+
+/**
+ * @brief How the double-resolution framebuffer is scaled down to the OLED
+ */
+typedef enum {
+	TILEGFX_SCALE_SUBPIXEL=0,	/*!< Mix the pixels taking the position of the OLED subpixels into account (default) */
+	TILEGFX_SCALE_BOX,			/*!< Plain average of every block of 2x2 pixels */
+} tilegfx_scale_mode_t;
+
+/**
+ * @brief Set how the framebuffer is scaled down in double_res mode
+ *
+ * Subpixel scaling makes graphics look sharper than the OLED resolution, but can cause colored fringes on
+ * sharp edges; box scaling does not. Has no effect if tilegfx is not in double_res mode.
+ *
+ * @param mode Scaling mode
+ */
+void tilegfx_set_scale_mode(tilegfx_scale_mode_t mode);
+
 /**
  * @brief Render the OLED framebuffer to the actual OLED display
  *
@@ -70,6 +224,78 @@ int tilegfx_init(int double_res, int hz);
  */
 void tilegfx_flush();
 
+/**
+ * @brief Timing information about the last frame, as returned by tilegfx_get_frame_stats
+ */
+typedef struct {
+	uint32_t frame;					/*!< Amount of frames flushed since tilegfx was initialized */
+	uint32_t render_us;				/*!< Time between the previous tilegfx_flush returning and the last one being */
+									/*!< called: the time the game took for logic and rendering */
+	uint32_t flush_us;				/*!< Time the last tilegfx_flush took to finish and send the frame */
+	uint32_t wait_us;				/*!< Time the last tilegfx_flush waited for the vblank */
+	uint32_t missed_vblanks;		/*!< Amount of vblanks the last frame was late for. 0 if it was in time. */
+	uint32_t total_missed_vblanks;	/*!< Sum of missed_vblanks of all frames since tilegfx was initialized */
+	uint32_t skipped_frames;		/*!< Amount of times tilegfx_skip_frame returned true since initialization */
+	uint32_t tile_cache_hits;		/*!< Amount of times the last frame found a tile in the tile cache */
+	uint32_t tile_cache_misses;		/*!< Amount of times the last frame had to load a tile into the tile cache */
+} tilegfx_frame_stats_t;
+
+/**
+ * @brief Get timing information about the last frame
+ *
+ * Use this to find out where the time per frame goes, and whether the game keeps up with the refresh rate
+ * passed to tilegfx_init.
+ *
+ * @param stats Filled with the timing information
+ */
+void tilegfx_get_frame_stats(tilegfx_frame_stats_t *stats);
+
+/**
+ * @brief Keep the tiles used last in RAM
+ *
+ * Tile data normally is read from flash, through the flash cache. If a frame draws lots of different tiles, or
+ * other things like sound are read from flash as well, misses in the flash cache can slow down rendering. The tile
+ * cache keeps a copy of the tiles used last in RAM, evicting the one used longest ago when it is full. Use the
+ * tile_cache_hits and tile_cache_misses returned by tilegfx_get_frame_stats to find a good size: after the first
+ * frame, a cache that is big enough mostly gets hits. The cache is freed by tilegfx_deinit, so call this after
+ * tilegfx_init.
+ *
+ * @param tiles Amount of tiles to keep in the cache, or 0 to turn it off. Every tile takes about 150 bytes.
+ * @return True if succeeded, false if out of memory; the cache is turned off then.
+ */
+int tilegfx_set_tile_cache(int tiles);
+
+/**
+ * @brief Forget everything cached about a tileset
+ *
+ * Tilegfx caches things like the tiles and the animation state of tilesets that are rendered. Call this before
+ * freeing or re-using the memory of a tileset you made yourself. Not needed for tilesets of tilegfx data files.
+ *
+ * @param gfx Tileset
+ */
+void tilegfx_forget_tileset(const tilegfx_tileset_t *gfx);
+
+/**
+ * @brief Set how many frames in a row tilegfx_skip_frame can tell the game to skip
+ *
+ * By default, this is 0: if a frame takes too long, the game slows down. With a higher value, the game can
+ * keep its speed by skipping the rendering of frames when running behind; see tilegfx_skip_frame.
+ *
+ * @param max_skip Maximum amount of frames to skip in a row
+ */
+void tilegfx_set_max_frame_skip(int max_skip);
+
+/**
+ * @brief Check if the rendering of this frame should be skipped to catch up
+ *
+ * Call this every frame, after running the game logic and before rendering. If it returns true, the game is
+ * running behind: don't render the frame and don't call tilegfx_flush, but continue with the logic of the next
+ * frame. Always returns false unless enabled using tilegfx_set_max_frame_skip.
+ *
+ * @return True if this frame should not be rendered
+ */
+int tilegfx_skip_frame();
+
 /**
  * @brief De-initialize tilegfx
  *
@@ -93,6 +319,98 @@ void tilegfx_deinit();
  */
 void tilegfx_tile_map_render(const tilegfx_map_t *tiles, int offx, int offy, const tilegfx_rect_t *dest);
 
+/**
+ * @brief Structure describing one layer of a layered render
+ */
+typedef struct {
+	const tilegfx_map_t *map;	/*!< Tilemap to render in this layer, or NULL to skip the layer */
+	int offx;					/*!< X-offset in the tilemap, as in tilegfx_tile_map_render */
+	int offy;					/*!< Y-offset in the tilemap, as in tilegfx_tile_map_render */
+	const int16_t *line_offx;	/*!< NULL, or an array with an X-offset for every line of the destination rectangle, */
+								/*!< added to offx for that line */
+	const int16_t *line_offy;	/*!< NULL, or an array with an Y-offset for every line of the destination rectangle, */
+								/*!< added to offy for that line */
+} tilegfx_layer_t;
+
+#define TILEGFX_MAX_LAYERS 8 /*!< Maximum amount of layers in a tilegfx_layers_render call */
+
+/**
+ * @brief Render multiple tilemaps over each other, with optional per-line offsets
+ *
+ * This has the same result as calling tilegfx_tile_map_render for every layer, back to front, except that every
+ * line of the destination can have its own offsets in every layer. This allows for raster effects, like parallax
+ * scrolling strips, wavy water or a status bar that does not scroll with the rest. The layers are rendered line
+ * by line, all layers at once, instead of layer by layer.
+ *
+ * With TILEGFX_INIT_PARTIAL_FLUSH, the entire destination rectangle is sent every frame. With
+ * TILEGFX_INIT_BAND_RENDER, the layers array is copied, but the tilemaps and line offset arrays are only read
+ * on flush, so they need to stay the same until then; in this mode, at most 16 layers can be rendered per frame.
+ *
+ * @param layers Array of layers, the first one being the one at the back
+ * @param count Amount of layers, up to TILEGFX_MAX_LAYERS
+ * @param dest Rectangle, in the coordinates of the OLED framebuffer, to render to, or NULL for the entire
+ *             framebuffer. The line offset arrays have an entry for every line of this rectangle.
+ */
+void tilegfx_layers_render(const tilegfx_layer_t *layers, int count, const tilegfx_rect_t *dest);
+
+/**
+ * @brief Structure describing a scroll layer
+ */
+typedef struct {
+	const tilegfx_map_t *map;	/*!< Tilemap shown in the layer. Can be changed; the layer is redrawn entirely then. */
+	void *priv;					/*!< Internal state, do not modify */
+} tilegfx_scroll_layer_t;
+
+/**
+ * @brief Create a scroll layer
+ *
+ * A scroll layer renders a tilemap like tilegfx_tile_map_render does, but remembers what it rendered last time in
+ * a buffer of its own. When the offset changes by a few pixels, only the tiles that scrolled into view are drawn;
+ * the rest is copied from the buffer. Tiles that changed because of an animation or a change to the tilemap are
+ * redrawn as well. This makes it a good fit for the background of a scrolling game, rendered first every frame.
+ * Transparent pixels and empty tiles in the tilemap are drawn black.
+ *
+ * The buffer is about as big as the destination rectangle, plus one row and column of tiles. Create scroll layers
+ * after tilegfx_init.
+ *
+ * @param map Tilemap to show
+ * @param dest Rectangle, in the coordinates of the OLED framebuffer, the layer is rendered to, or NULL for the
+ *             entire framebuffer
+ * @return The scroll layer, or NULL if out of memory or if dest is entirely outside of the framebuffer
+ */
+tilegfx_scroll_layer_t *tilegfx_create_scroll_layer(const tilegfx_map_t *map, const tilegfx_rect_t *dest);
+
+/**
+ * @brief Free a scroll layer created with tilegfx_create_scroll_layer
+ *
+ * @param layer Scroll layer to free
+ */
+void tilegfx_destroy_scroll_layer(tilegfx_scroll_layer_t *layer);
+
+/**
+ * @brief Render a scroll layer to screen
+ *
+ * Has the same result as clearing the destination rectangle of the layer to black and calling
+ * tilegfx_tile_map_render with the same offsets. Render a scroll layer at most once per frame. With
+ * TILEGFX_INIT_BAND_RENDER or TILEGFX_INIT_PARALLEL, the tilemap is read when this is called and only the copy
+ * to the framebuffer happens on flush.
+ *
+ * @param layer Scroll layer to render
+ * @param offx X-offset in the tilemap, as in tilegfx_tile_map_render
+ * @param offy Y-offset in the tilemap
+ */
+void tilegfx_scroll_layer_render(tilegfx_scroll_layer_t *layer, int offx, int offy);
+
+/**
+ * @brief Redraw all tiles of a scroll layer on its next render
+ *
+ * Changes to the tilemap and to the palette of an indexed tileset are picked up automatically, but changes to the
+ * tile data aren't: call this after changing the tile data of the tileset of the layer.
+ *
+ * @param layer Scroll layer
+ */
+void tilegfx_scroll_layer_invalidate(tilegfx_scroll_layer_t *layer);
+
 /**
  * @brief 'Fade' the framebuffer to a certain color.
  *
@@ -124,7 +442,8 @@ tilegfx_map_t *tilegfx_create_tilemap(int w, int h, const tilegfx_tileset_t *til
 /**
  * @brief Create an editable copy of a tilemap
  *
- * Use this to duplicate a tilemap located into flash into one located into RAM.
+ * Use this to duplicate a tilemap located into flash into one located into RAM. Compressed maps are
+ * decompressed in the copy.
  *
  * @param orig Tilemap to duplicate
  * @return Duplicated tilemap, or NULL if out of memory
@@ -143,29 +462,76 @@ void tilegfx_destroy_tilemap(tilegfx_map_t *map);
 /**
  * @brief Set tile position in RAM-allocated map to the specific tile in its associated tileset
  *
+ * Compressed maps can't be modified; use tilegfx_dup_tilemap() to get a modifiable copy.
+ *
  * @param map Tilemap to modify
  * @param x X-position of tile to change
  * @param y Y-position of tile to change
- * @param tile Tile index to change to (or 0xffff for completely transparent)
+ * @param tile Tile index to change to, optionally ORed with TILEGFX_TILE_FLIP_* flags (or 0xffff for completely transparent)
  */
 static inline void tilegfx_set_tile(tilegfx_map_t *map, int x, int y, uint16_t tile) {
+	if (map->chunks) return;
 	//Cast to non-const... kind-of yucky but this is the least invasive way to do this.
 	uint16_t *t=(uint16_t*)&map->tiles[x+y*map->w];
 	*t=tile;
 }
 
+/**
+ * @brief Get tile in specified tile position of a compressed tilemap
+ *
+ * Use tilegfx_get_tile() instead; it calls this for compressed maps.
+ */
+uint16_t tilegfx_get_compressed_tile(const tilegfx_map_t *map, int x, int y);
+
 /**
  * @brief Get tile in specified tile position of tilemap
  *
  * @param map Tilemap to read
  * @param x X-position of tile
  * @param y Y-position of tile
- * @return tile Tile index in tileset (or 0xffff for completely transparent)
+ * @return tile Tile index in tileset ORed with TILEGFX_TILE_FLIP_* flags (or 0xffff for completely transparent)
  */
 static inline uint16_t tilegfx_get_tile(const tilegfx_map_t *map, int x, int y) {
+	if (map->chunks) return tilegfx_get_compressed_tile(map, x, y);
 	return map->tiles[x+y*map->w];
 }
 
+/**
+ * @brief Create a sprite table
+ *
+ * A sprite is an 8x8 tile that can be drawn at any position in the framebuffer, with transparency and
+ * optionally mirrored. Sprites are kept in a table; all sprites in a table are drawn in one go, sorted
+ * by priority. Bigger objects can be composed of multiple sprites.
+ *
+ * @param count Amount of sprites in the table
+ * @param gfx Tileset to take the sprite tiles from. Animated tiles are animated as in tilemaps.
+ * @return The sprite table, with all sprites set to tile 0xffff (not drawn), or NULL if out of memory
+ */
+tilegfx_sprite_table_t *tilegfx_create_sprite_table(int count, const tilegfx_tileset_t *gfx);
+
+/**
+ * @brief Free a sprite table created with tilegfx_create_sprite_table
+ *
+ * @param table Sprite table to free
+ */
+void tilegfx_destroy_sprite_table(tilegfx_sprite_table_t *table);
+
+/**
+ * @brief Render all sprites in a sprite table to screen
+ *
+ * Normally, you'd call this after rendering all tilemaps, so the sprites are drawn on top of them.
+ * Sprites are clipped to the destination rectangle. Sprites with the same priority are drawn in
+ * the order they have in the table.
+ *
+ * @param table Sprite table to render
+ * @param offx X-offset: a sprite at this X position is drawn at the left side of the destination rect.
+ *             Pass the same offset as to tilegfx_tile_map_render to make sprites move with the map.
+ * @param offy Y-offset
+ * @param dest Rectangle, in the coordinates of the OLED framebuffer, to limit rendering to. If this parameter
+ *             is NULL, the sprites are clipped to the entire framebuffer.
+ */
+void tilegfx_sprite_table_render(const tilegfx_sprite_table_t *table, int offx, int offy, const tilegfx_rect_t *dest);
+
 /**
  * @brief Get internal framebuffer
  *
@@ -176,6 +542,14 @@ static inline uint16_t tilegfx_get_tile(const tilegfx_map_t *map, int x, int y)
  * will be resized to 80x64!
  *
  * Pixels here are in big-endian RGB565 format (same as what's sent to the OLED).
+ *
+ * If tilegfx is initialized with TILEGFX_INIT_DOUBLE_BUFFER, every tilegfx_flush call switches to the
+ * other buffer, so call this again after every flush.
+ *
+ * If tilegfx is initialized with TILEGFX_INIT_PARTIAL_FLUSH, call tilegfx_invalidate() for every region
+ * you modify directly.
+ *
+ * If tilegfx is initialized with TILEGFX_INIT_BAND_RENDER, there is no framebuffer and this returns NULL.
  */
 uint16_t *tilegfx_get_fb();
 
@@ -0,0 +1,283 @@
+/*
+ Loading tilegfx tilesets and maps from data files in appfs.
+
+ A data file consists of everything needed for the tilesets and maps, followed by the encoded chunks of all maps.
+ The first part is memory-mapped when the file is opened and used in place. The chunk data can be a lot bigger
+ than what can be memory-mapped at once, so it is read through a window that is mapped on demand: the chunks
+ in view tend to be close together in the file, so the window doesn't need to move often. As decoded chunks are
+ cached by tilegfx, the window is only used when a chunk comes into view.
+
+ File format. Everything is little-endian and 32-bit, and all offsets are from the start of the file.
+ Header:
+   magic (TGFX_MAGIC), version (TGFX_VERSION), amount of entries, offset of chunk data, length of chunk data
+ Entries, one for every tileset and map:
+   32-byte zero-padded name, type (ENTRY_TILESET or ENTRY_MAP), offset of the tileset or map
+ Tileset:
+   trans_col, format, tile count, anim_frame_count, offset of opaque_masks, offset of anim_offsets, offset
+   of anim_frames, offset of palette, amount of palette entries, offset of tile data, offsets of the
+   collision bitsets for all TILEGFX_COLLISION_FLAGS flags. Offsets are 0 if the tileset does not have that part.
+ Map:
+   width, height, entry number of the tileset, offset of chunk index. The chunk index is as described at
+   tilegfx_map_chunks_t, with offsets in words from the start of the chunk data.
+*/
+
+#include "tilegfx_appfs.h"
+#include "appfs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define TGFX_MAGIC 0x58464754 //'TGFX'
+#define TGFX_VERSION 2
+#define ENTRY_TILESET 0
+#define ENTRY_MAP 1
+
+#define WINDOW_ALIGN 0x10000 //appfs sectors and MMU pages are 64K
+#define WINDOW_SIZE (WINDOW_ALIGN*2) //so an encoded chunk always fits if the window starts at its page
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t data_off;
+	uint32_t data_len;
+} file_header_t;
+
+typedef struct {
+	char name[32];
+	uint32_t type;
+	uint32_t offset;
+} file_entry_t;
+
+typedef struct {
+	int32_t trans_col;
+	uint32_t format;
+	uint32_t tile_count;
+	uint32_t anim_frame_count;
+	uint32_t opaque_masks;
+	uint32_t anim_offsets;
+	uint32_t anim_frames;
+	uint32_t palette;
+	uint32_t palette_len;
+	uint32_t tiles;
+	uint32_t collision[TILEGFX_COLLISION_FLAGS];
+} file_tileset_t;
+
+typedef struct {
+	uint32_t w;
+	uint32_t h;
+	uint32_t tileset;
+	uint32_t index;
+} file_map_t;
+
+//The chunks of a map loaded from a file. Chunks comes first, so the read callback can get to the file.
+typedef struct {
+	tilegfx_map_chunks_t chunks;
+	tilegfx_file_t *file;
+} file_chunks_t;
+
+struct tilegfx_file_t {
+	appfs_handle_t fd;
+	int size;
+	const uint8_t *meta; //the file up to the chunk data
+	spi_flash_mmap_handle_t meta_handle;
+	const file_header_t *hdr;
+	const file_entry_t *entry;
+	void **obj; //for every entry, the tileset or map loaded from it, or NULL
+	SemaphoreHandle_t win_lock; //tilegfx can read chunks from both cores
+	const uint8_t *win; //mapped window into the file, or NULL
+	spi_flash_mmap_handle_t win_handle;
+	uint32_t win_start, win_len;
+};
+
+//Returns a pointer to len bytes at offset off in the mapped part of the file, or NULL if that's outside of it.
+static const void *meta_ptr(tilegfx_file_t *f, uint32_t off, uint32_t len) {
+	if (off==0 || off>f->hdr->data_off || len>f->hdr->data_off-off) return NULL;
+	return f->meta+off;
+}
+
+static void read_chunks(const tilegfx_map_chunks_t *chunks, uint32_t offset, uint16_t *buf, int len) {
+	tilegfx_file_t *f=((const file_chunks_t*)chunks)->file;
+	uint32_t start=f->hdr->data_off+offset*2;
+	uint32_t end=start+len*2;
+	if (end>f->hdr->data_off+f->hdr->data_len) end=f->hdr->data_off+f->hdr->data_len;
+	int got=0;
+	xSemaphoreTake(f->win_lock, portMAX_DELAY);
+	if (start<end && (!f->win || start<f->win_start || end>f->win_start+f->win_len)) {
+		if (f->win) appfsMunmap(f->win_handle);
+		f->win_start=start&~(WINDOW_ALIGN-1);
+		f->win_len=f->size-f->win_start;
+		if (f->win_len>WINDOW_SIZE) f->win_len=WINDOW_SIZE;
+		const void *p;
+		if (appfsMmap(f->fd, f->win_start, f->win_len, &p, SPI_FLASH_MMAP_DATA, &f->win_handle)==ESP_OK) {
+			f->win=p;
+		} else {
+			printf("tilegfx: can't map chunk data at %d\n", (int)start);
+			f->win=NULL;
+		}
+	}
+	if (start<end && f->win) {
+		got=end-start;
+		memcpy(buf, f->win+(start-f->win_start), got);
+	}
+	xSemaphoreGive(f->win_lock);
+	//A zero word ends the chunk; tilegfx fills the rest with empty tiles.
+	memset((uint8_t*)buf+got, 0, len*2-got);
+}
+
+tilegfx_file_t *tilegfx_file_open(const char *name) {
+	appfs_handle_t fd=appfsOpen(name);
+	if (fd==APPFS_INVALID_FD) return NULL;
+	tilegfx_file_t *f=calloc(1, sizeof(tilegfx_file_t));
+	if (!f) return NULL;
+	f->fd=fd;
+	appfsEntryInfo(fd, NULL, &f->size);
+	//Read the header first, to find out how much to map.
+	file_header_t hdr;
+	if (f->size<sizeof(hdr) || appfsRead(fd, 0, &hdr, sizeof(hdr))!=ESP_OK) goto err;
+	if (hdr.magic!=TGFX_MAGIC || hdr.version!=TGFX_VERSION) {
+		printf("tilegfx: %s is not a tilegfx data file\n", name);
+		goto err;
+	}
+	if (hdr.data_off<sizeof(hdr) || hdr.data_off>f->size || hdr.data_len>f->size-hdr.data_off ||
+			hdr.entry_count>(hdr.data_off-sizeof(hdr))/sizeof(file_entry_t)) {
+		printf("tilegfx: %s is corrupted\n", name);
+		goto err;
+	}
+	const void *p;
+	if (appfsMmap(fd, 0, hdr.data_off, &p, SPI_FLASH_MMAP_DATA, &f->meta_handle)!=ESP_OK) goto err;
+	f->meta=p;
+	f->hdr=(const file_header_t*)f->meta;
+	f->entry=(const file_entry_t*)(f->meta+sizeof(file_header_t));
+	f->obj=calloc(hdr.entry_count, sizeof(void*));
+	f->win_lock=xSemaphoreCreateMutex();
+	if (!f->obj || !f->win_lock) goto err;
+	return f;
+err:
+	tilegfx_file_close(f);
+	return NULL;
+}
+
+//Returns the index of the entry with the given name and type, or -1
+static int find_entry(tilegfx_file_t *f, const char *name, int type) {
+	for (int i=0; i<f->hdr->entry_count; i++) {
+		if (f->entry[i].type==type && strncmp(f->entry[i].name, name, sizeof(f->entry[i].name))==0) return i;
+	}
+	return -1;
+}
+
+static const tilegfx_tileset_t *load_tileset(tilegfx_file_t *f, int e) {
+	if (f->obj[e]) return f->obj[e];
+	const file_tileset_t *t=meta_ptr(f, f->entry[e].offset, sizeof(file_tileset_t));
+	if (!t || t->format>TILEGFX_FORMAT_INDEXED4 || t->tile_count>TILEGFX_TILE_IDX_MASK ||
+			t->anim_frame_count>0x10000) goto corrupt;
+	int tile_words=(t->format==TILEGFX_FORMAT_RGB565)?64:(t->format==TILEGFX_FORMAT_INDEXED8)?32:16;
+	tilegfx_tileset_t *ts=calloc(1, sizeof(tilegfx_tileset_t));
+	if (!ts) return NULL;
+	ts->trans_col=t->trans_col;
+	ts->format=t->format;
+	ts->anim_frame_count=t->anim_frame_count;
+	ts->tile_data=meta_ptr(f, t->tiles, t->tile_count*tile_words*2);
+	if (t->opaque_masks) ts->opaque_masks=meta_ptr(f, t->opaque_masks, t->tile_count*8);
+	if (t->anim_offsets) ts->anim_offsets=meta_ptr(f, t->anim_offsets, t->tile_count*2);
+	if (t->anim_frames) ts->anim_frames=meta_ptr(f, t->anim_frames, t->anim_frame_count*sizeof(tilegfx_anim_frame_t));
+	int coll_ok=1;
+	for (int i=0; i<TILEGFX_COLLISION_FLAGS; i++) {
+		if (!t->collision[i]) continue;
+		ts->collision[i]=meta_ptr(f, t->collision[i], ((t->tile_count+31)/32)*4);
+		if (!ts->collision[i]) coll_ok=0;
+	}
+	if (!ts->tile_data || (t->opaque_masks && !ts->opaque_masks) || (t->anim_offsets && !ts->anim_offsets) ||
+			(t->anim_frames && !ts->anim_frames) || !coll_ok) {
+		free(ts);
+		goto corrupt;
+	}
+	if (t->format!=TILEGFX_FORMAT_RGB565) {
+		//The palette lives in RAM, so it can be changed. It always gets all entries the format can refer to.
+		int entries=(t->format==TILEGFX_FORMAT_INDEXED8)?256:16;
+		const uint16_t *pal=meta_ptr(f, t->palette, t->palette_len*2);
+		if (!pal || t->palette_len>entries) {
+			free(ts);
+			goto corrupt;
+		}
+		ts->palette=calloc(entries, 2);
+		if (!ts->palette) {
+			free(ts);
+			return NULL;
+		}
+		memcpy(ts->palette, pal, t->palette_len*2);
+	}
+	f->obj[e]=ts;
+	return ts;
+corrupt:
+	printf("tilegfx: tileset %.32s is corrupted\n", f->entry[e].name);
+	return NULL;
+}
+
+const tilegfx_tileset_t *tilegfx_file_get_tileset(tilegfx_file_t *f, const char *name) {
+	int e=find_entry(f, name, ENTRY_TILESET);
+	if (e<0) return NULL;
+	return load_tileset(f, e);
+}
+
+const tilegfx_map_t *tilegfx_file_get_map(tilegfx_file_t *f, const char *name) {
+	int e=find_entry(f, name, ENTRY_MAP);
+	if (e<0) return NULL;
+	if (f->obj[e]) return f->obj[e];
+	const file_map_t *m=meta_ptr(f, f->entry[e].offset, sizeof(file_map_t));
+	if (!m || m->w==0 || m->h==0 || m->w>0x10000 || m->h>0x10000 || m->tileset>=f->hdr->entry_count ||
+			f->entry[m->tileset].type!=ENTRY_TILESET) {
+		printf("tilegfx: map %s is corrupted\n", name);
+		return NULL;
+	}
+	int chunks=((m->w+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE)*((m->h+TILEGFX_CHUNK_SIZE-1)/TILEGFX_CHUNK_SIZE);
+	const uint32_t *index=meta_ptr(f, m->index, chunks*4);
+	if (!index) {
+		printf("tilegfx: map %s is corrupted\n", name);
+		return NULL;
+	}
+	const tilegfx_tileset_t *gfx=load_tileset(f, m->tileset);
+	if (!gfx) return NULL;
+	tilegfx_map_t *map=calloc(1, sizeof(tilegfx_map_t));
+	file_chunks_t *c=calloc(1, sizeof(file_chunks_t));
+	if (!map || !c) {
+		free(map);
+		free(c);
+		return NULL;
+	}
+	c->chunks.index=index;
+	c->chunks.read=read_chunks;
+	c->file=f;
+	map->w=m->w;
+	map->h=m->h;
+	map->gfx=gfx;
+	map->chunks=&c->chunks;
+	f->obj[e]=map;
+	return map;
+}
+
+void tilegfx_file_close(tilegfx_file_t *f) {
+	if (f->obj) {
+		for (int i=0; i<f->hdr->entry_count; i++) {
+			if (!f->obj[i]) continue;
+			if (f->entry[i].type==ENTRY_MAP) {
+				tilegfx_map_t *map=f->obj[i];
+				free((void*)map->chunks);
+				tilegfx_destroy_tilemap(map); //also drops its cached chunks
+			} else {
+				tilegfx_tileset_t *ts=f->obj[i];
+				tilegfx_forget_tileset(ts);
+				free(ts->palette);
+				free(ts);
+			}
+		}
+		free(f->obj);
+	}
+	if (f->win) appfsMunmap(f->win_handle);
+	if (f->meta) appfsMunmap(f->meta_handle);
+	if (f->win_lock) vSemaphoreDelete(f->win_lock);
+	appfsClose(f->fd);
+	free(f);
+}
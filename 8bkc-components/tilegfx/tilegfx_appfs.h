@@ -0,0 +1,64 @@
+/*
+Loading tilesets and tilemaps from a data file in appfs, as written by 'conv_png_tile -a'. This allows graphics
+and levels to be shipped separately from the app, and worlds that are bigger than would fit in the app image.
+*/
+#pragma once
+#include "tilegfx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An opened tilegfx data file
+ */
+typedef struct tilegfx_file_t tilegfx_file_t;
+
+/**
+ * @brief Open a tilegfx data file stored in appfs
+ *
+ * Everything in the file except the tiles of the maps is memory-mapped, so opening a file does not take much
+ * RAM. The tiles of the maps are read in chunks when they come into view.
+ *
+ * @param name Name of the file in appfs
+ * @return The opened file, or NULL if it does not exist, isn't a tilegfx data file or if out of memory
+ */
+tilegfx_file_t *tilegfx_file_open(const char *name);
+
+/**
+ * @brief Get a tileset from a tilegfx data file
+ *
+ * Tile data is used directly from flash; only the palette of an indexed tileset is copied into RAM.
+ *
+ * @param f File to get the tileset from
+ * @param name Name of the tileset: the name of the tileset in Tiled, as used in the C file conv_png_tile
+ *             would otherwise generate. E.g. 'tiles' for tileset_tiles.
+ * @return The tileset, or NULL if it's not in the file or if out of memory. Valid until the file is closed.
+ */
+const tilegfx_tileset_t *tilegfx_file_get_tileset(tilegfx_file_t *f, const char *name);
+
+/**
+ * @brief Get a tilemap from a tilegfx data file
+ *
+ * Maps in data files are always compressed, so they can't be modified; use tilegfx_dup_tilemap() to get a
+ * modifiable copy. Their tileset is loaded from the same file as well.
+ *
+ * @param f File to get the map from
+ * @param name Name of the map: the name of the .tmx file and the layer, as used in the C file conv_png_tile
+ *             would otherwise generate. E.g. 'level1_bg' for map_level1_bg.
+ * @return The map, or NULL if it's not in the file or if out of memory. Valid until the file is closed.
+ */
+const tilegfx_map_t *tilegfx_file_get_map(tilegfx_file_t *f, const char *name);
+
+/**
+ * @brief Close a tilegfx data file
+ *
+ * This frees all tilesets and maps gotten from the file, so make sure none of them are rendered anymore.
+ *
+ * @param f File to close
+ */
+void tilegfx_file_close(tilegfx_file_t *f);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,120 @@
+/*
+ Collision maps and queries. See tilegfx_collision.h.
+*/
+
+#include "tilegfx_collision.h"
+#include <stdlib.h>
+#include <string.h>
+
+//Tile position a pixel position is in. Also rounds down for negative positions.
+static int tile_pos(int px) {
+	return (px>=0)?px/8:-((7-px)/8);
+}
+
+uint8_t tilegfx_get_tile_collision(const tilegfx_map_t *map, int x, int y) {
+	if (x<0 || y<0 || x>=map->w || y>=map->h) return 0;
+	uint16_t t=tilegfx_get_tile(map, x, y);
+	if (t==0xffff) return 0;
+	t&=TILEGFX_TILE_IDX_MASK;
+	uint8_t ret=0;
+	for (int i=0; i<TILEGFX_COLLISION_FLAGS; i++) {
+		const uint32_t *c=map->gfx->collision[i];
+		if (c && (c[t/32]>>(t&31))&1) ret|=(1<<i);
+	}
+	return ret;
+}
+
+tilegfx_collision_map_t *tilegfx_create_collision_map(const tilegfx_map_t *map, uint8_t flags) {
+	int stride=(map->w+31)/32;
+	tilegfx_collision_map_t *cmap=calloc(1, sizeof(tilegfx_collision_map_t)+stride*map->h*4);
+	if (!cmap) return NULL;
+	cmap->w=map->w;
+	cmap->h=map->h;
+	cmap->stride=stride;
+	cmap->flags=flags;
+	tilegfx_update_collision_map(cmap, map, 0, 0, map->w, map->h);
+	return cmap;
+}
+
+void tilegfx_update_collision_map(tilegfx_collision_map_t *cmap, const tilegfx_map_t *map, int x, int y, int w, int h) {
+	if (x<0) {
+		w+=x;
+		x=0;
+	}
+	if (y<0) {
+		h+=y;
+		y=0;
+	}
+	if (x+w>cmap->w) w=cmap->w-x;
+	if (y+h>cmap->h) h=cmap->h-y;
+	for (int ty=y; ty<y+h; ty++) {
+		uint32_t *row=&cmap->bits[ty*cmap->stride];
+		for (int tx=x; tx<x+w; tx++) {
+			if (tilegfx_get_tile_collision(map, tx, ty)&cmap->flags) {
+				row[tx/32]|=(1U<<(tx&31));
+			} else {
+				row[tx/32]&=~(1U<<(tx&31));
+			}
+		}
+	}
+}
+
+void tilegfx_destroy_collision_map(tilegfx_collision_map_t *cmap) {
+	free(cmap);
+}
+
+bool tilegfx_collision_rect(const tilegfx_collision_map_t *cmap, int x, int y, int w, int h) {
+	if (w<=0 || h<=0) return false;
+	int tx0=tile_pos(x), ty0=tile_pos(y);
+	int tx1=tile_pos(x+w-1), ty1=tile_pos(y+h-1);
+	if (tx0<0) tx0=0;
+	if (ty0<0) ty0=0;
+	if (tx1>=cmap->w) tx1=cmap->w-1;
+	if (ty1>=cmap->h) ty1=cmap->h-1;
+	if (tx0>tx1 || ty0>ty1) return false;
+	//Masks for the first and last word of every row the rectangle covers
+	int w0=tx0/32, w1=tx1/32;
+	uint32_t m0=0xffffffffU<<(tx0&31);
+	uint32_t m1=0xffffffffU>>(31-(tx1&31));
+	if (w0==w1) m0&=m1;
+	for (int ty=ty0; ty<=ty1; ty++) {
+		const uint32_t *row=&cmap->bits[ty*cmap->stride];
+		if (row[w0]&m0) return true;
+		if (w0==w1) continue;
+		for (int i=w0+1; i<w1; i++) {
+			if (row[i]) return true;
+		}
+		if (row[w1]&m1) return true;
+	}
+	return false;
+}
+
+bool tilegfx_collision_ray(const tilegfx_collision_map_t *cmap, int x0, int y0, int x1, int y1, int *hit_x, int *hit_y) {
+	//Walk the tiles in the order the ray enters them. Positions are in half pixels here, so the ray starts
+	//and ends at a whole number; a tile is 16 half pixels. nx/dx and ny/dy are how far along the ray (as a
+	//fraction of its length) the next vertical and horizontal tile edge are.
+	int tx=tile_pos(x0), ty=tile_pos(y0);
+	int ex=tile_pos(x1), ey=tile_pos(y1);
+	int64_t dx=abs(x1-x0)*2, dy=abs(y1-y0)*2;
+	int stepx=(x1>x0)?1:-1, stepy=(y1>y0)?1:-1;
+	int64_t nx=(stepx>0)?(tx+1)*16-(x0*2+1):(x0*2+1)-tx*16;
+	int64_t ny=(stepy>0)?(ty+1)*16-(y0*2+1):(y0*2+1)-ty*16;
+	int left_x=abs(ex-tx), left_y=abs(ey-ty);
+	while (1) {
+		if (tilegfx_collision_at(cmap, tx, ty)) {
+			if (hit_x) *hit_x=tx;
+			if (hit_y) *hit_y=ty;
+			return true;
+		}
+		if (left_x==0 && left_y==0) return false;
+		if (left_y==0 || (left_x!=0 && nx*dy<=ny*dx)) {
+			tx+=stepx;
+			nx+=16;
+			left_x--;
+		} else {
+			ty+=stepy;
+			ny+=16;
+			left_y--;
+		}
+	}
+}
@@ -0,0 +1,114 @@
+/*
+Collision queries against tilemaps. Tiles can have up to TILEGFX_COLLISION_FLAGS collision flags, set using the
+'collision' property of the tile in Tiled. For the queries, a collision map is made from a tilemap: a bitset with one
+bit per tile position, set if the tile there has any of the flags asked for. Rectangle queries test 32 tile
+positions of a row at a time, which is a lot cheaper than looking up every tile under a moving object.
+*/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "tilegfx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Collision map of a tilemap
+ */
+typedef struct {
+	int w;					/*!< Width, in tiles */
+	int h;					/*!< Height, in tiles */
+	int stride;				/*!< Amount of words per row in bits[] */
+	uint8_t flags;			/*!< Collision flags the map was made for */
+	uint32_t bits[];		/*!< Bit x%32 of word y*stride+x/32 is set if the tile at (x, y) has any of the flags */
+} tilegfx_collision_map_t;
+
+/**
+ * @brief Get the collision flags of a tile in a tilemap
+ *
+ * @param map Tilemap to look in
+ * @param x X-position of the tile
+ * @param y Y-position of the tile
+ * @return Bitmap of the collision flags of the tile; 0 for empty tiles or tiles outside of the map
+ */
+uint8_t tilegfx_get_tile_collision(const tilegfx_map_t *map, int x, int y);
+
+/**
+ * @brief Create a collision map for a tilemap
+ *
+ * This reads the entire tilemap, so create collision maps when loading a level rather than every frame. If the
+ * tilemap is changed afterwards, use tilegfx_update_collision_map() to update the collision map as well.
+ *
+ * @param map Tilemap to make the collision map for
+ * @param flags Bitmap of collision flags (bit n is flag n) that should count as a collision
+ * @return The collision map, or NULL if out of memory
+ */
+tilegfx_collision_map_t *tilegfx_create_collision_map(const tilegfx_map_t *map, uint8_t flags);
+
+/**
+ * @brief Update part of a collision map after its tilemap has changed
+ *
+ * @param cmap Collision map to update
+ * @param map Tilemap it was made for
+ * @param x X-position of the changed area, in tiles
+ * @param y Y-position of the changed area, in tiles
+ * @param w Width of the changed area, in tiles
+ * @param h Height of the changed area, in tiles
+ */
+void tilegfx_update_collision_map(tilegfx_collision_map_t *cmap, const tilegfx_map_t *map, int x, int y, int w, int h);
+
+/**
+ * @brief Free a collision map created with tilegfx_create_collision_map
+ *
+ * @param cmap Collision map to free
+ */
+void tilegfx_destroy_collision_map(tilegfx_collision_map_t *cmap);
+
+/**
+ * @brief Check if there's a collision at a tile position
+ *
+ * @param cmap Collision map
+ * @param x X-position, in tiles
+ * @param y Y-position, in tiles
+ * @return True if the tile there has one of the flags of the collision map. Always false outside of the map.
+ */
+static inline bool tilegfx_collision_at(const tilegfx_collision_map_t *cmap, int x, int y) {
+	if (x<0 || y<0 || x>=cmap->w || y>=cmap->h) return false;
+	return (cmap->bits[y*cmap->stride+x/32]>>(x&31))&1;
+}
+
+/**
+ * @brief Check if a rectangle collides with the map
+ *
+ * @param cmap Collision map
+ * @param x X-position of the upper left corner of the rectangle, in pixels
+ * @param y Y-position of the upper left corner of the rectangle, in pixels
+ * @param w Width of the rectangle, in pixels
+ * @param h Height of the rectangle, in pixels
+ * @return True if any tile the rectangle overlaps has one of the flags of the collision map. The parts of the
+ *         rectangle outside of the map never collide.
+ */
+bool tilegfx_collision_rect(const tilegfx_collision_map_t *cmap, int x, int y, int w, int h);
+
+/**
+ * @brief Trace a ray through the map and find the first tile it collides with
+ *
+ * The ray goes from the center of pixel (x0, y0) to the center of pixel (x1, y1). All tiles it passes through are
+ * checked in order; if it passes exactly through the corner of a tile, the tiles on either side of the corner can
+ * be checked as well.
+ *
+ * @param cmap Collision map
+ * @param x0 X-position of the start of the ray, in pixels
+ * @param y0 Y-position of the start of the ray, in pixels
+ * @param x1 X-position of the end of the ray, in pixels
+ * @param y1 Y-position of the end of the ray, in pixels
+ * @param[out] hit_x If not NULL, gets the X-position of the tile that was hit, in tiles
+ * @param[out] hit_y If not NULL, gets the Y-position of the tile that was hit, in tiles
+ * @return True if the ray hit a tile with one of the flags of the collision map, false if it got to its end
+ */
+bool tilegfx_collision_ray(const tilegfx_collision_map_t *cmap, int x0, int y0, int x1, int y1, int *hit_x, int *hit_y);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+/*
+Downscaler for the double-resolution framebuffer. Every output pixel is made from a block of 2x2 input pixels.
+
+Pixels are RGB565, stored with the bytes swapped:
+rrrrrggggggbbbbb
+
+We first average the two lines together to keep the aspect ratio. Then, in subpixel mode, we try to do subpixel
+rendering, taking the position of the subpixels in the OLED into account. For a left pixel p1 and a right pixel p2:
+r=r1*0.25+r2*0.75
+g=g1*0.5+g2*0.5
+b=b1*0.75+b2*0.25
+In box mode, all channels are simply the average of both pixels.
+
+To do this fast, we work on two pixels at a time, packed into a 32-bit word. The average of two words, rounded
+down, for every channel at once, is (x&y)+(((x^y)&0xF7DEF7DE)>>1): x&y are the bits both have in common and
+(x^y)>>1 is half of the bits that differ. The mask removes the bits that would otherwise shift into the
+channel below. The 3:1 mixes are done as the average of the average and the pixel that should weigh more,
+which gives exactly the same result as (3*a+b)/4 rounded down.
+*/
+
+#include <stdint.h>
+#include "tilegfx_scale.h"
+
+//Average, rounded down, of each of the channels in two 565 pixels, or two pairs of 565 pixels.
+static inline uint32_t avg565(uint32_t x, uint32_t y) {
+	return (x&y)+(((x^y)&0xF7DEF7DE)>>1);
+}
+
+//Swaps the bytes in both 16-bit halves of p
+static inline uint32_t swap16x2(uint32_t p) {
+	return ((p&0xFF00FF00)>>8)|((p&0x00FF00FF)<<8);
+}
+
+//Gets the two pixels above each other at in and in+stride, averaged, as a word with the left pixel in the lower
+//half. Input is read as 32-bit words: on the (little-endian) ESP32, the left pixel ends up in the lower half.
+static inline uint32_t vert_avg(const uint32_t *in, int stride_words) {
+	return avg565(swap16x2(in[0]), swap16x2(in[stride_words]));
+}
+
+void tilegfx_scale_lines(const uint16_t *in, uint16_t *out, int w, int lines, tilegfx_scale_mode_t mode) {
+	const uint32_t *inw=(const uint32_t*)in; //accessed 2 16-bit pixels at a time
+	for (int y=0; y<lines; y++) {
+		if (mode==TILEGFX_SCALE_BOX) {
+			for (int x=0; x<w; x++) {
+				uint32_t p=vert_avg(inw++, w);
+				uint32_t c=avg565(p, p>>16)&0xffff;
+				*out++=(c<<8)|(c>>8);
+			}
+		} else {
+			for (int x=0; x<w; x++) {
+				uint32_t p=vert_avg(inw++, w);
+				//h is the average of both pixels; averaging it again with p gives the 3:1 mixes:
+				//the upper half weighs the right pixel 3x, the lower half the left pixel.
+				uint32_t h=avg565(p, p>>16)&0xffff;
+				uint32_t m=avg565(p, h|(h<<16));
+				uint32_t c=((m>>16)&0xF800)|(h&0x07E0)|(m&0x001F);
+				*out++=(c<<8)|(c>>8);
+			}
+		}
+		inw+=w; //skip the next line; we already read that.
+	}
+}
@@ -0,0 +1,19 @@
+/*
+Internal to tilegfx: downscaler for the double-resolution framebuffer.
+*/
+#pragma once
+#include <stdint.h>
+#include "tilegfx.h"
+
+/**
+ * @brief Scale down lines of a double-resolution buffer
+ *
+ * Every 2x2 block of input pixels is turned into one output pixel. Can be done in place: out may be the same as in.
+ *
+ * @param in Input, 2*w pixels wide and 2*lines lines high. Must be 32-bit aligned.
+ * @param out Output, w pixels wide and lines lines high
+ * @param w Width of the output, in pixels
+ * @param lines Amount of output lines
+ * @param mode How to mix the pixels
+ */
+void tilegfx_scale_lines(const uint16_t *in, uint16_t *out, int w, int lines, tilegfx_scale_mode_t mode);